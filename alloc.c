@@ -0,0 +1,208 @@
+#include "alloc.h"
+#include "arena.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CLASSSIZE  16               /* Granularity of the pool classes */
+#define NUMCLASSES 16               /* Classes up to 256 bytes */
+#define SLABSIZE   65536
+
+static void *heap_alloc(allocator_t *a, size_t size)
+{
+    (void)a;
+    return malloc(size);
+}
+
+static void heap_free(allocator_t *a, void *p, size_t size)
+{
+    (void)a;
+    (void)size;
+    free(p);
+}
+
+static void heap_destroy(allocator_t *a)
+{
+    /* Shared, never destroyed */
+    (void)a;
+}
+
+static allocator_t heap = {
+    .alloc = heap_alloc,
+    .free = heap_free,
+    .destroy = heap_destroy,
+};
+
+allocator_t *alloc_default(void)
+{
+    return &heap;
+}
+
+struct arena_allocator {
+    allocator_t base;
+    arena_t *arena;
+};
+
+static void *arena_alloc_fn(allocator_t *a, size_t size)
+{
+    return arena_alloc(((struct arena_allocator *)a)->arena, size);
+}
+
+static void arena_free_fn(allocator_t *a, void *p, size_t size)
+{
+    /* Released with the arena */
+    (void)a;
+    (void)p;
+    (void)size;
+}
+
+static void arena_destroy_fn(allocator_t *a)
+{
+    free(a);
+}
+
+allocator_t *alloc_arena(arena_t *arena)
+{
+    struct arena_allocator *a = calloc(1, sizeof(struct arena_allocator));
+
+    if (a == NULL)
+        fatal_error("out of memory");
+    a->base.alloc = arena_alloc_fn;
+    a->base.free = arena_free_fn;
+    a->base.destroy = arena_destroy_fn;
+    a->arena = arena;
+    return &a->base;
+}
+
+/*
+ * A free block of a pool keeps the link to the next free block of its
+ * class in its first bytes.
+ */
+struct freeblock {
+    struct freeblock *next;
+};
+
+struct slab {
+    struct slab *next;
+};
+
+struct pool {
+    allocator_t base;
+    struct freeblock *free[NUMCLASSES];
+    struct slab *slabs;
+    char *cur;                      /* Unused part of the newest slab */
+    size_t left;
+};
+
+static void *pool_alloc(allocator_t *a, size_t size)
+{
+    struct pool *pool = (struct pool *)a;
+    size_t class = (size + CLASSSIZE - 1) / CLASSSIZE;
+    struct freeblock *block;
+    char *p;
+
+    if (size == 0)
+        class = 1;
+    if (class > NUMCLASSES)
+        return malloc(size);
+    block = pool->free[class - 1];
+    if (block != NULL) {
+        pool->free[class - 1] = block->next;
+        return block;
+    }
+    size = class * CLASSSIZE;
+    if (pool->left < size) {
+        /* The rest of the old slab is left unused */
+        struct slab *slab = malloc(SLABSIZE);
+        if (slab == NULL)
+            return NULL;
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->cur = (char *)slab + CLASSSIZE;
+        pool->left = SLABSIZE - CLASSSIZE;
+    }
+    p = pool->cur;
+    pool->cur += size;
+    pool->left -= size;
+    return p;
+}
+
+static void pool_free(allocator_t *a, void *p, size_t size)
+{
+    struct pool *pool = (struct pool *)a;
+    size_t class = (size + CLASSSIZE - 1) / CLASSSIZE;
+    struct freeblock *block = p;
+
+    if (size == 0)
+        class = 1;
+    if (class > NUMCLASSES) {
+        free(p);
+        return;
+    }
+    block->next = pool->free[class - 1];
+    pool->free[class - 1] = block;
+}
+
+static void pool_destroy(allocator_t *a)
+{
+    struct pool *pool = (struct pool *)a;
+    struct slab *slab, *next;
+
+    for (slab = pool->slabs; slab != NULL; slab = next) {
+        next = slab->next;
+        free(slab);
+    }
+    free(pool);
+}
+
+allocator_t *alloc_pool(void)
+{
+    struct pool *pool = calloc(1, sizeof(struct pool));
+
+    if (pool == NULL)
+        fatal_error("out of memory");
+    pool->base.alloc = pool_alloc;
+    pool->base.free = pool_free;
+    pool->base.destroy = pool_destroy;
+    return &pool->base;
+}
+
+void alloc_destroy(allocator_t *a)
+{
+    a->destroy(a);
+}
+
+void *alloc_get(allocator_t *a, size_t size, alloc_stats_t *stats)
+{
+    void *p = a->alloc(a, size);
+
+    if (p == NULL)
+        fatal_error("out of memory");
+    if (a != &heap) {
+        a->stats.live += size;
+        if (a->stats.live > a->stats.peak)
+            a->stats.peak = a->stats.live;
+        a->stats.allocs++;
+    }
+    if (stats != NULL) {
+        stats->live += size;
+        if (stats->live > stats->peak)
+            stats->peak = stats->live;
+        stats->allocs++;
+    }
+    return p;
+}
+
+void alloc_put(allocator_t *a, void *p, size_t size, alloc_stats_t *stats)
+{
+    a->free(a, p, size);
+    if (a != &heap) {
+        a->stats.live -= size;
+        a->stats.frees++;
+    }
+    if (stats != NULL) {
+        stats->live -= size;
+        stats->frees++;
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Allocators for the nodes of lists and sets.  An allocator is a table
+ * of functions, so containers can take their memory from the heap, from
+ * an arena, or from a pool of free nodes, without knowing which.
+ *
+ * Memory is freed with the size it was allocated with, so allocators
+ * need no per-block headers.
+ */
+typedef struct allocator allocator_t;
+
+struct allocator {
+    void *(*alloc)(allocator_t *a, size_t size);    /* NULL when out */
+    void (*free)(allocator_t *a, void *p, size_t size);
+    void (*destroy)(allocator_t *a);
+    struct alloc_stats {
+        size_t live;        /* Bytes allocated and not yet freed */
+        size_t peak;        /* The most live bytes at any one time */
+        uint64_t allocs;
+        uint64_t frees;
+    } stats;                /* Over everything allocated from it */
+};
+
+typedef struct alloc_stats alloc_stats_t;
+
+/*
+ * Returns the allocator that takes memory from malloc() and gives it
+ * back to free().  It is shared, lives for the whole program, and is
+ * what list_create() and set_create() use.  Its statistics are not
+ * kept, since it is used from several threads at once.
+ */
+allocator_t *alloc_default(void);
+
+/*
+ * Creates an allocator that bumps a pointer through the given arena.
+ * Freeing does nothing: the memory is released when the arena is reset
+ * or destroyed, which makes clearing out a whole pipeline stage cheap.
+ * The arena is not destroyed with the allocator.
+ */
+struct arena;
+allocator_t *alloc_arena(struct arena *arena);
+
+/*
+ * Creates an allocator that rounds sizes up to classes of 16 bytes up
+ * to 256, and keeps freed blocks on a free list per class to reuse
+ * them.  Memory is taken from the heap in large slabs, and only given
+ * back when the allocator is destroyed, so it can be reused from one
+ * training phase to the next without going back to malloc().  Larger
+ * sizes go to malloc() directly.
+ */
+allocator_t *alloc_pool(void);
+
+/*
+ * Destroys the given allocator, releasing the memory it holds.  The
+ * containers using it must be destroyed first.
+ */
+void alloc_destroy(allocator_t *a);
+
+/*
+ * Allocates size bytes from the given allocator, counting them in its
+ * statistics and in the given ones of a container unless stats is
+ * NULL, or terminates the program if out of memory.
+ */
+void *alloc_get(allocator_t *a, size_t size, alloc_stats_t *stats);
+
+/*
+ * Gives back the given block of size bytes, counting it as alloc_get()
+ * did.
+ */
+void alloc_put(allocator_t *a, void *p, size_t size, alloc_stats_t *stats);
+
+#endif
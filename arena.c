@@ -0,0 +1,135 @@
+#include "arena.h"
+#include "alloc.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCKSIZE 65536
+#define ALIGNMENT 16
+
+struct block {
+    struct block *next;
+    size_t size;        /* Usable bytes in data */
+    size_t used;
+    char *data;
+};
+
+struct arena {
+    struct block *blocks;   /* All blocks, in allocation order */
+    struct block *current;  /* The block being allocated from */
+    size_t used;            /* Bytes handed out, over all blocks */
+    allocator_t *alloc;     /* For containers, once asked for */
+};
+
+arena_t *arena_create(void)
+{
+    arena_t *arena = malloc(sizeof(arena_t));
+    if (arena == NULL)
+        fatal_error("out of memory");
+    arena->blocks = NULL;
+    arena->current = NULL;
+    arena->used = 0;
+    arena->alloc = NULL;
+    return arena;
+}
+
+void arena_destroy(arena_t *arena)
+{
+    struct block *block, *next;
+
+    for (block = arena->blocks; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+    if (arena->alloc != NULL)
+        alloc_destroy(arena->alloc);
+    free(arena);
+}
+
+void arena_reset(arena_t *arena)
+{
+    struct block *block;
+
+    for (block = arena->blocks; block != NULL; block = block->next)
+        block->used = 0;
+    arena->current = arena->blocks;
+    arena->used = 0;
+}
+
+/*
+ * Returns a block with room for size bytes, reusing the blocks after
+ * the current one before allocating a new one.
+ */
+static struct block *next_block(arena_t *arena, size_t size)
+{
+    struct block *block, **link;
+
+    link = arena->current != NULL ? &arena->current->next : &arena->blocks;
+    while ((block = *link) != NULL) {
+        if (block->size >= size)
+            return block;
+        link = &block->next;
+    }
+    if (size < BLOCKSIZE)
+        size = BLOCKSIZE;
+    block = malloc(sizeof(struct block) + ALIGNMENT + size);
+    if (block == NULL)
+        fatal_error("out of memory");
+    block->data = (char *)block +
+        ((sizeof(struct block) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1));
+    block->size = size;
+    block->used = 0;
+    block->next = NULL;
+    *link = block;
+    return block;
+}
+
+/*
+ * Allocates size bytes at the given alignment, which must be a power
+ * of two no larger than ALIGNMENT.
+ */
+static void *bump(arena_t *arena, size_t size, size_t align)
+{
+    struct block *block = arena->current;
+    size_t start;
+
+    if (block != NULL) {
+        start = (block->used + align - 1) & ~(align - 1);
+        if (start + size <= block->size) {
+            block->used = start + size;
+            arena->used += size;
+            return block->data + start;
+        }
+    }
+    block = next_block(arena, size);
+    arena->current = block;
+    block->used = size;
+    arena->used += size;
+    return block->data;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    return bump(arena, size, ALIGNMENT);
+}
+
+char *arena_strdup(arena_t *arena, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *copy = bump(arena, len, 1);   /* Strings need no alignment */
+    memcpy(copy, s, len);
+    return copy;
+}
+
+size_t arena_used(arena_t *arena)
+{
+    return arena->used;
+}
+
+allocator_t *arena_allocator(arena_t *arena)
+{
+    if (arena->alloc == NULL)
+        arena->alloc = alloc_arena(arena);
+    return arena->alloc;
+}
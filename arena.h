@@ -0,0 +1,56 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * An arena is a region of memory that objects are allocated from by
+ * bumping a pointer, and that is released all at once.  Arenas give
+ * the words of a document, or of a model, a single owner: everything
+ * allocated from an arena lives exactly as long as the arena.
+ */
+struct arena;
+typedef struct arena arena_t;
+
+/*
+ * Creates a new, empty arena.
+ */
+arena_t *arena_create(void);
+
+/*
+ * Destroys the given arena, releasing everything allocated from it.
+ */
+void arena_destroy(arena_t *arena);
+
+/*
+ * Releases everything allocated from the given arena, but keeps its
+ * memory for reuse by later allocations.
+ */
+void arena_reset(arena_t *arena);
+
+/*
+ * Allocates size bytes from the given arena, aligned for any type.
+ */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/*
+ * Returns a copy of the given string, allocated from the given arena.
+ */
+char *arena_strdup(arena_t *arena, const char *s);
+
+/*
+ * Returns the number of bytes allocated from the given arena since it
+ * was created or last reset.
+ */
+size_t arena_used(arena_t *arena);
+
+/*
+ * Returns the allocator that takes memory from the given arena, as
+ * alloc_arena() would, creating it on first use.  It is destroyed with
+ * the arena.  Containers using it must be destroyed before the arena
+ * is reset.
+ */
+struct allocator;
+struct allocator *arena_allocator(arena_t *arena);
+
+#endif
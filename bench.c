@@ -0,0 +1,463 @@
+/*
+ * spambench: end-to-end benchmark for spamfilter.
+ *
+ * Generates a deterministic synthetic mail corpus, runs the spamfilter
+ * binary over it in each of its batch modes, and prints one JSON object
+ * per line: first the corpus parameters, then one line per stage with
+ * its file and byte counts, throughput, wall and CPU time, and peak
+ * resident set size.
+ *
+ * The corpus is drawn from a Zipf-distributed vocabulary.  Every spam
+ * mail carries a fixed set of signature words that never occur in
+ * non-spam mail, so training always finds spam words to classify with.
+ * A corpus left in the directory by an earlier run is removed first,
+ * and a directory that holds anything else is refused.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define SIGNATURE_WORDS 8
+
+struct params {
+    char *dir;
+    char *spamfilter;
+    uint64_t seed;
+    int vocab;          /* Vocabulary size */
+    double zipf;        /* Zipf exponent */
+    int spam;           /* Number of spam training mails */
+    int ham;            /* Number of non-spam training mails */
+    int mail;           /* Number of mails to classify */
+    int words;          /* Mean words per mail */
+    double spamratio;   /* Fraction of the mails to classify that are spam */
+    int threads;
+};
+
+struct corpus {
+    char **vocab;
+    double *cdf;        /* cdf[i] = P(rank <= i) */
+    char *signature[SIGNATURE_WORDS];
+    uint64_t state;     /* PRNG state */
+};
+
+/* Totals for one directory of the generated corpus */
+struct dirstats {
+    int files;
+    long bytes;
+};
+
+static void fatal(char *msg)
+{
+    fprintf(stderr, "spambench: %s\n", msg);
+    exit(1);
+}
+
+/* xorshift64* */
+static uint64_t next_random(struct corpus *c)
+{
+    c->state ^= c->state >> 12;
+    c->state ^= c->state << 25;
+    c->state ^= c->state >> 27;
+    return c->state * 2685821657736338717ULL;
+}
+
+static double uniform(struct corpus *c)
+{
+    return (next_random(c) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static char *random_word(struct corpus *c, char *prefix)
+{
+    int len = 2 + next_random(c) % 9, i, plen = strlen(prefix);
+    char *word = malloc(plen + len + 1);
+
+    if (word == NULL)
+        fatal("out of memory");
+    strcpy(word, prefix);
+    for (i = 0; i < len; i++)
+        word[plen + i] = 'a' + next_random(c) % 26;
+    word[plen + len] = 0;
+    return word;
+}
+
+static void corpus_init(struct corpus *c, struct params *p)
+{
+    double sum = 0;
+    int i;
+
+    c->state = p->seed ? p->seed : 1;
+    c->vocab = malloc(sizeof(char *) * p->vocab);
+    c->cdf = malloc(sizeof(double) * p->vocab);
+    if (c->vocab == NULL || c->cdf == NULL)
+        fatal("out of memory");
+    for (i = 0; i < p->vocab; i++) {
+        c->vocab[i] = random_word(c, "");
+        sum += 1.0 / pow(i + 1, p->zipf);
+        c->cdf[i] = sum;
+    }
+    for (i = 0; i < p->vocab; i++)
+        c->cdf[i] /= sum;
+    /* Vocabulary words are all letters, so a digit, which the tokenizer
+     * keeps in words, sets signature words apart from every one */
+    for (i = 0; i < SIGNATURE_WORDS; i++)
+        c->signature[i] = random_word(c, "0");
+}
+
+static char *zipf_word(struct corpus *c, int vocab)
+{
+    double u = uniform(c);
+    int lo = 0, hi = vocab - 1;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (c->cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return c->vocab[lo];
+}
+
+/*
+ * Writes one mail of Zipf filler words.  Spam mails carry the given
+ * number of signature words, scattered through the text.
+ */
+static long write_mail(struct corpus *c, struct params *p, char *path,
+                       int signature)
+{
+    int n = p->words / 2 + next_random(c) % (p->words + 1), i;
+    long bytes;
+    FILE *f;
+
+    f = fopen(path, "w");
+    if (f == NULL) {
+        perror(path);
+        fatal("fopen() failed");
+    }
+    for (i = 0; i < n; i++) {
+        fputs(zipf_word(c, p->vocab), f);
+        if (i < signature) {
+            fputc(' ', f);
+            fputs(c->signature[i], f);
+        }
+        fputs(i % 12 == 11 ? ".\n" : (i % 5 == 4 ? ", " : " "), f);
+    }
+    for (; i < signature; i++) {
+        fputs(c->signature[i], f);
+        fputc(' ', f);
+    }
+    fputc('\n', f);
+    bytes = ftell(f);
+    fclose(f);
+    return bytes;
+}
+
+static void make_dir(char *path)
+{
+    if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+        perror(path);
+        fatal("mkdir() failed");
+    }
+}
+
+/* The subdirectories of a corpus, and the prefix of its model files */
+static int is_corpus_dir(const char *name)
+{
+    return strcmp(name, "spam") == 0 || strcmp(name, "ham") == 0 ||
+           strcmp(name, "mail") == 0;
+}
+
+static int is_model_file(const char *name)
+{
+    return strncmp(name, "model", 5) == 0;
+}
+
+/* Mails are named by their number, as write_dir() names them */
+static int is_mail_file(const char *name)
+{
+    return strspn(name, "0123456789") == strlen(name);
+}
+
+/*
+ * Like clear_dir() below, for a subdirectory of a corpus, which holds
+ * only mails.
+ */
+static int clear_mails(char *dir, int unlink_files)
+{
+    char path[4096];
+    struct dirent *e;
+    struct stat st;
+    DIR *d = opendir(dir);
+    int status = 0;
+
+    if (d == NULL) {
+        perror(dir);
+        fatal("opendir() failed");
+    }
+    while (status == 0 && (e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, e->d_name) >=
+            (int)sizeof(path))
+            fatal("path too long");
+        if (lstat(path, &st) < 0) {
+            perror(path);
+            fatal("lstat() failed");
+        }
+        if (!S_ISREG(st.st_mode) || !is_mail_file(e->d_name))
+            status = -1;
+        else if (unlink_files && unlink(path) < 0) {
+            perror(path);
+            fatal("unlink() failed");
+        }
+    }
+    closedir(d);
+    return status;
+}
+
+/*
+ * Removes the files of an earlier corpus from the given directory, so
+ * that they are not mixed into the new one, or with unlink_files 0,
+ * only checks that the directory holds nothing but such files.  Returns
+ * -1 if it holds anything else, 0 otherwise.
+ */
+static int clear_dir(char *dir, int unlink_files)
+{
+    char path[4096];
+    struct dirent *e;
+    struct stat st;
+    DIR *d = opendir(dir);
+    int status = 0;
+
+    if (d == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        perror(dir);
+        fatal("opendir() failed");
+    }
+    while (status == 0 && (e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, e->d_name) >=
+            (int)sizeof(path))
+            fatal("path too long");
+        if (lstat(path, &st) < 0) {
+            perror(path);
+            fatal("lstat() failed");
+        }
+        if (S_ISDIR(st.st_mode) && is_corpus_dir(e->d_name)) {
+            status = clear_mails(path, unlink_files);
+            if (status == 0 && unlink_files && rmdir(path) < 0) {
+                perror(path);
+                fatal("rmdir() failed");
+            }
+        }
+        else if (S_ISREG(st.st_mode) && is_model_file(e->d_name)) {
+            if (unlink_files && unlink(path) < 0) {
+                perror(path);
+                fatal("unlink() failed");
+            }
+        }
+        else {
+            status = -1;
+        }
+    }
+    closedir(d);
+    return status;
+}
+
+/*
+ * Writes count mails into the given subdirectory of the corpus.  kind
+ * is 's' for spam, 'h' for non-spam, and 'm' for a mix of both.
+ */
+static struct dirstats write_dir(struct corpus *c, struct params *p,
+                                 char *name, int count, char kind)
+{
+    struct dirstats stats = { 0, 0 };
+    char path[4096];
+    int i, signature;
+
+    snprintf(path, sizeof(path), "%s/%s", p->dir, name);
+    make_dir(path);
+    for (i = 0; i < count; i++) {
+        if (kind == 's')
+            signature = SIGNATURE_WORDS;
+        else if (kind == 'm' && uniform(c) < p->spamratio)
+            signature = 1 + next_random(c) % SIGNATURE_WORDS;
+        else
+            signature = 0;
+        snprintf(path, sizeof(path), "%s/%s/%06d", p->dir, name, i);
+        stats.bytes += write_mail(c, p, path, signature);
+        stats.files++;
+    }
+    return stats;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Runs spamfilter with the given arguments, discarding its standard
+ * output, and prints a JSON line for the stage.
+ */
+static void run_stage(struct params *p, char *stage, struct dirstats work,
+                      char **args)
+{
+    struct rusage ru;
+    double start, elapsed;
+    int status, fd;
+    pid_t pid;
+
+    start = now();
+    pid = fork();
+    if (pid < 0)
+        fatal("fork() failed");
+    if (pid == 0) {
+        fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0)
+            dup2(fd, 1);
+        execv(p->spamfilter, args);
+        perror(p->spamfilter);
+        _exit(127);
+    }
+    if (wait4(pid, &status, 0, &ru) < 0)
+        fatal("wait4() failed");
+    elapsed = now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fatal("spamfilter failed");
+
+    printf("{\"stage\":\"%s\",\"files\":%d,\"bytes\":%ld,\"seconds\":%.6f,"
+           "\"files_per_sec\":%.1f,\"mb_per_sec\":%.3f,"
+           "\"user_seconds\":%.6f,\"sys_seconds\":%.6f,\"peak_rss_kb\":%ld}\n",
+           stage, work.files, work.bytes, elapsed,
+           work.files / elapsed, work.bytes / elapsed / 1e6,
+           ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+           ru.ru_maxrss);
+    fflush(stdout);
+}
+
+/* Prints the usage, to standard output if asked for with -h */
+static void usage(char *progname, int status)
+{
+    fprintf(status == 0 ? stdout : stderr,
+            "usage: %s [options]\n"
+            "  -o dir     corpus directory (default /tmp/spambench)\n"
+            "  -b path    spamfilter binary (default ./spamfilter)\n"
+            "  -s seed    random seed (default 1)\n"
+            "  -v n       vocabulary size (default 50000)\n"
+            "  -z s       Zipf exponent (default 1.1)\n"
+            "  -S n       spam training mails (default 500)\n"
+            "  -H n       non-spam training mails (default 2000)\n"
+            "  -M n       mails to classify (default 2000)\n"
+            "  -w n       mean words per mail (default 300)\n"
+            "  -r ratio   fraction of spam among the mails (default 0.3)\n"
+            "  -j n       classification threads (default 1)\n"
+            "  -h         print this help\n",
+            progname);
+    exit(status);
+}
+
+int main(int argc, char **argv)
+{
+    struct params p;
+    struct corpus c;
+    struct dirstats spam, ham, mail, training, all;
+    char spamdir[4096], hamdir[4096], maildir[4096], model[4096], threads[16];
+    int opt;
+
+    p.dir = "/tmp/spambench";
+    p.spamfilter = "./spamfilter";
+    p.seed = 1;
+    p.vocab = 50000;
+    p.zipf = 1.1;
+    p.spam = 500;
+    p.ham = 2000;
+    p.mail = 2000;
+    p.words = 300;
+    p.spamratio = 0.3;
+    p.threads = 1;
+    while ((opt = getopt(argc, argv, "o:b:s:v:z:S:H:M:w:r:j:h")) != -1) {
+        switch (opt) {
+        case 'o': p.dir = optarg; break;
+        case 'b': p.spamfilter = optarg; break;
+        case 's': p.seed = strtoull(optarg, NULL, 10); break;
+        case 'v': p.vocab = atoi(optarg); break;
+        case 'z': p.zipf = atof(optarg); break;
+        case 'S': p.spam = atoi(optarg); break;
+        case 'H': p.ham = atoi(optarg); break;
+        case 'M': p.mail = atoi(optarg); break;
+        case 'w': p.words = atoi(optarg); break;
+        case 'r': p.spamratio = atof(optarg); break;
+        case 'j': p.threads = atoi(optarg); break;
+        case 'h': usage(argv[0], 0); break;
+        default: usage(argv[0], 1);
+        }
+    }
+    if (optind != argc || p.vocab < 1 || p.spam < 1 || p.ham < 0 ||
+        p.mail < 0 || p.words < 1 || p.threads < 1)
+        usage(argv[0], 1);
+
+    /* Generate the corpus, in place of any earlier one */
+    if (clear_dir(p.dir, 0) < 0) {
+        fprintf(stderr, "spambench: %s holds files other than a corpus; "
+                "remove them or pick another directory\n", p.dir);
+        exit(1);
+    }
+    clear_dir(p.dir, 1);
+    make_dir(p.dir);
+    corpus_init(&c, &p);
+    spam = write_dir(&c, &p, "spam", p.spam, 's');
+    ham = write_dir(&c, &p, "ham", p.ham, 'h');
+    mail = write_dir(&c, &p, "mail", p.mail, 'm');
+    printf("{\"corpus\":\"%s\",\"seed\":%llu,\"vocab\":%d,\"zipf\":%.3f,"
+           "\"spam\":%d,\"ham\":%d,\"mail\":%d,\"words\":%d,"
+           "\"spam_ratio\":%.3f,\"threads\":%d,\"bytes\":%ld}\n",
+           p.dir, (unsigned long long)p.seed, p.vocab, p.zipf, p.spam, p.ham,
+           p.mail, p.words, p.spamratio, p.threads,
+           spam.bytes + ham.bytes + mail.bytes);
+    fflush(stdout);
+
+    snprintf(spamdir, sizeof(spamdir), "%s/spam", p.dir);
+    snprintf(hamdir, sizeof(hamdir), "%s/ham", p.dir);
+    snprintf(maildir, sizeof(maildir), "%s/mail", p.dir);
+    snprintf(model, sizeof(model), "%s/model", p.dir);
+    snprintf(threads, sizeof(threads), "%d", p.threads);
+    training.files = spam.files + ham.files;
+    training.bytes = spam.bytes + ham.bytes;
+    all.files = training.files + mail.files;
+    all.bytes = training.bytes + mail.bytes;
+
+    {
+        char *args[] = { p.spamfilter, "train", "-o", model, spamdir, hamdir,
+                         NULL };
+        run_stage(&p, "train", training, args);
+    }
+    {
+        char *args[] = { p.spamfilter, "classify", "-j", threads, model,
+                         maildir, NULL };
+        run_stage(&p, "classify", mail, args);
+    }
+    {
+        char *args[] = { p.spamfilter, "-j", threads, spamdir, hamdir,
+                         maildir, NULL };
+        run_stage(&p, "oneshot", all, args);
+    }
+    return 0;
+}
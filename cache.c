@@ -0,0 +1,567 @@
+#include "cache.h"
+#include "list.h"
+#include "set.h"
+#include "arena.h"
+#include "hash.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define ENTRY_MAGIC      "SPFT"
+#define MANIFEST_MAGIC   "SPFD"
+#define CACHE_VERSION    2
+#define READSIZE         65536     /* As in common.c */
+
+/*
+ * The identity of a file.  A file whose identity is unchanged is
+ * assumed to have unchanged contents.
+ */
+struct fileid {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+};
+
+/*
+ * On-disk layout of a token entry:
+ *
+ *   struct entry_header
+ *   the words of the file, each NUL-terminated, in set order
+ *
+ * The checksum covers the words.
+ */
+struct entry_header {
+    char magic[4];
+    uint32_t version;
+    struct fileid id;
+    uint32_t numwords;
+    uint32_t wordslen;
+    uint64_t checksum;
+};
+
+/*
+ * The cached listing of one directory.  Each entry is a type byte, 'd'
+ * for subdirectories and 'f' for anything else, followed by the
+ * NUL-terminated name of the entry, in the order readdir() gave them.
+ */
+struct dirrecord {
+    char *path;
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t numentries;
+    uint32_t nameslen;
+    char *names;
+};
+
+/*
+ * On-disk layout of the manifest:
+ *
+ *   struct manifest_header
+ *   numdirs records of {
+ *       struct manifest_record
+ *       char path[pathlen]
+ *       char names[nameslen]
+ *   }
+ *
+ * The checksum covers everything after the header.
+ */
+struct manifest_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t numdirs;
+    uint32_t reserved;
+    uint64_t checksum;
+};
+
+struct manifest_record {
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t numentries;
+    uint32_t nameslen;
+    uint32_t pathlen;
+    uint32_t reserved;
+};
+
+struct cache {
+    char *dir;
+    set_t *dirs;        /* Maps directory paths to their struct dirrecord */
+    int dirty;          /* The manifest has changed since it was loaded */
+};
+
+static char *cache_path(cache_t *cache, char *name)
+{
+    char *path = malloc(strlen(cache->dir) + strlen(name) + 2);
+    if (path == NULL)
+        fatal_error("out of memory");
+    sprintf(path, "%s/%s", cache->dir, name);
+    return path;
+}
+
+/*
+ * Writes the given bytes to a temporary file in the cache directory and
+ * renames it into place, so that readers never see a partial file.
+ * Failures are ignored: the cache only ever saves work.
+ */
+static void write_atomically(cache_t *cache, char *name, void *header,
+                             size_t headerlen, void *data, size_t len)
+{
+    char *tmp = cache_path(cache, "tmpXXXXXX"), *path = cache_path(cache, name);
+    FILE *f;
+    int fd, ok;
+
+    fd = mkstemp(tmp);
+    if (fd >= 0) {
+        f = fdopen(fd, "wb");
+        ok = f != NULL &&
+             fwrite(header, 1, headerlen, f) == headerlen &&
+             fwrite(data, 1, len, f) == len;
+        if (f != NULL && fclose(f) != 0)
+            ok = 0;
+        else if (f == NULL)
+            close(fd);
+        if (!ok || rename(tmp, path) < 0)
+            unlink(tmp);
+    }
+    free(tmp);
+    free(path);
+}
+
+/*
+ * Reads the manifest of the cache, if there is a valid one.
+ */
+static void load_manifest(cache_t *cache)
+{
+    struct manifest_header header;
+    char *path = cache_path(cache, "manifest"), *buf, *p, *end;
+    long size;
+    uint32_t i;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    free(path);
+    if (f == NULL)
+        return;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, MANIFEST_MAGIC, 4) != 0 ||
+        header.version != CACHE_VERSION) {
+        fclose(f);
+        return;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f) - (long)sizeof(header);
+    fseek(f, sizeof(header), SEEK_SET);
+    buf = malloc(size + 1);
+    if (buf == NULL)
+        fatal_error("out of memory");
+    if (size < 0 || fread(buf, 1, size, f) != (size_t)size ||
+        hash_bytes(buf, size) != header.checksum) {
+        fclose(f);
+        free(buf);
+        return;
+    }
+    fclose(f);
+
+    p = buf;
+    end = buf + size;
+    for (i = 0; i < header.numdirs; i++) {
+        struct manifest_record rec;
+        struct dirrecord *dir;
+
+        if (end - p < (long)sizeof(rec))
+            break;
+        memcpy(&rec, p, sizeof(rec));
+        p += sizeof(rec);
+        if ((uint64_t)(end - p) < (uint64_t)rec.pathlen + rec.nameslen)
+            break;
+        dir = malloc(sizeof(struct dirrecord));
+        if (dir == NULL)
+            fatal_error("out of memory");
+        dir->ino = rec.ino;
+        dir->mtime_sec = rec.mtime_sec;
+        dir->mtime_nsec = rec.mtime_nsec;
+        dir->numentries = rec.numentries;
+        dir->nameslen = rec.nameslen;
+        dir->path = malloc(rec.pathlen + 1);
+        dir->names = malloc(rec.nameslen + 1);
+        if (dir->path == NULL || dir->names == NULL)
+            fatal_error("out of memory");
+        memcpy(dir->path, p, rec.pathlen);
+        dir->path[rec.pathlen] = 0;
+        p += rec.pathlen;
+        memcpy(dir->names, p, rec.nameslen);
+        p += rec.nameslen;
+        set_add(cache->dirs, dir->path, dir);
+    }
+    free(buf);
+}
+
+static void save_manifest(cache_t *cache)
+{
+    struct manifest_header header;
+    set_iter_t *iter;
+    char *buf, *p;
+    size_t size = 0;
+
+    memcpy(header.magic, MANIFEST_MAGIC, 4);
+    header.version = CACHE_VERSION;
+    header.numdirs = set_size(cache->dirs);
+    header.reserved = 0;
+    iter = set_createiter(cache->dirs);
+    while (set_hasnext(iter)) {
+        struct dirrecord *dir = set_next(iter);
+        size += sizeof(struct manifest_record) + strlen(dir->path) +
+                dir->nameslen;
+    }
+    set_destroyiter(iter);
+    buf = p = malloc(size + 1);
+    if (buf == NULL)
+        fatal_error("out of memory");
+    iter = set_createiter(cache->dirs);
+    while (set_hasnext(iter)) {
+        struct dirrecord *dir = set_next(iter);
+        struct manifest_record rec;
+
+        rec.ino = dir->ino;
+        rec.mtime_sec = dir->mtime_sec;
+        rec.mtime_nsec = dir->mtime_nsec;
+        rec.numentries = dir->numentries;
+        rec.nameslen = dir->nameslen;
+        rec.pathlen = strlen(dir->path);
+        rec.reserved = 0;
+        memcpy(p, &rec, sizeof(rec));
+        p += sizeof(rec);
+        memcpy(p, dir->path, rec.pathlen);
+        p += rec.pathlen;
+        memcpy(p, dir->names, dir->nameslen);
+        p += dir->nameslen;
+    }
+    set_destroyiter(iter);
+    header.checksum = hash_bytes(buf, size);
+    write_atomically(cache, "manifest", &header, sizeof(header), buf, size);
+    free(buf);
+}
+
+cache_t *cache_open(char *dir)
+{
+    cache_t *cache = malloc(sizeof(cache_t));
+
+    if (cache == NULL)
+        fatal_error("out of memory");
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        perror("mkdir");
+        fatal_error("mkdir() failed");
+    }
+    cache->dir = strdup(dir);
+    if (cache->dir == NULL)
+        fatal_error("out of memory");
+    cache->dirs = set_create(compare_strings);
+    cache->dirty = 0;
+    load_manifest(cache);
+    return cache;
+}
+
+void cache_close(cache_t *cache)
+{
+    set_iter_t *iter;
+
+    if (cache->dirty)
+        save_manifest(cache);
+    iter = set_createiter(cache->dirs);
+    while (set_hasnext(iter)) {
+        struct dirrecord *dir = set_next(iter);
+        free(dir->path);
+        free(dir->names);
+        free(dir);
+    }
+    set_destroyiter(iter);
+    set_destroy(cache->dirs);
+    free(cache->dir);
+    free(cache);
+}
+
+static void get_fileid(struct stat *st, struct fileid *id)
+{
+    memset(id, 0, sizeof(*id));
+    id->dev = st->st_dev;
+    id->ino = st->st_ino;
+    id->size = st->st_size;
+    id->mtime_sec = st->st_mtim.tv_sec;
+    id->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+/*
+ * Returns the name of the entry of the file with the given identity.
+ */
+static void entry_name(struct fileid *id, char *name)
+{
+    sprintf(name, "%016llx.tok",
+            (unsigned long long)hash_bytes(id, sizeof(*id)));
+}
+
+/*
+ * Reads the words of the file with the given identity from its entry,
+ * or returns NULL if there is no valid entry for it.
+ */
+static set_t *read_entry(cache_t *cache, struct fileid *id, arena_t *arena)
+{
+    struct entry_header header;
+    char name[32], *path, *words, *p, *end;
+    set_t *wordset;
+    uint32_t i;
+    FILE *f;
+
+    entry_name(id, name);
+    path = cache_path(cache, name);
+    f = fopen(path, "rb");
+    free(path);
+    if (f == NULL)
+        return NULL;
+    if (fread(&header, sizeof(header), 1, f) != 1 ||
+        memcmp(header.magic, ENTRY_MAGIC, 4) != 0 ||
+        header.version != CACHE_VERSION ||
+        memcmp(&header.id, id, sizeof(*id)) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    words = arena_alloc(arena, header.wordslen + 1);
+    if (fread(words, 1, header.wordslen, f) != header.wordslen ||
+        hash_bytes(words, header.wordslen) != header.checksum) {
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    words[header.wordslen] = 0;
+
+    /* The words point into the entry's bytes, which the arena owns */
+    wordset = set_create_alloc(compare_words, arena_allocator(arena));
+    p = words;
+    end = words + header.wordslen;
+    for (i = 0; i < header.numwords && p < end; i++) {
+        set_add(wordset, p, p);
+        p += strlen(p) + 1;
+    }
+    return wordset;
+}
+
+static void write_entry(cache_t *cache, struct fileid *id, set_t *words)
+{
+    struct entry_header header;
+    set_iter_t *iter;
+    char name[32], *buf, *p;
+    size_t size = 0;
+
+    iter = set_createiter(words);
+    while (set_hasnext(iter))
+        size += strlen(set_next(iter)) + 1;
+    set_destroyiter(iter);
+    buf = p = malloc(size + 1);
+    if (buf == NULL)
+        fatal_error("out of memory");
+    iter = set_createiter(words);
+    while (set_hasnext(iter)) {
+        char *word = set_next(iter);
+        strcpy(p, word);
+        p += strlen(word) + 1;
+    }
+    set_destroyiter(iter);
+
+    memcpy(header.magic, ENTRY_MAGIC, 4);
+    header.version = CACHE_VERSION;
+    header.id = *id;
+    header.numwords = set_size(words);
+    header.wordslen = size;
+    header.checksum = hash_bytes(buf, size);
+    entry_name(id, name);
+    write_atomically(cache, name, &header, sizeof(header), buf, size);
+    free(buf);
+}
+
+set_t *cache_tokenize(cache_t *cache, char *filename, arena_t *arena,
+                     bytesink_t tap, void *taparg)
+{
+    struct fileid id, after;
+    struct stat st;
+    set_t *words;
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (f == NULL) {
+        perror("fopen");
+        fatal_error("fopen() failed");
+    }
+    if (fstat(fileno(f), &st) < 0) {
+        perror("fstat");
+        fatal_error("fstat() failed");
+    }
+    get_fileid(&st, &id);
+    words = read_entry(cache, &id, arena);
+    if (words != NULL) {
+        stats_count(STATS_CACHE_HITS, 1);
+        /* The words are cached, but the tap still needs the bytes */
+        if (tap != NULL) {
+            char buf[READSIZE];
+            size_t n;
+
+            while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+                tap(taparg, buf, n);
+        }
+        fclose(f);
+        return words;
+    }
+
+    stats_count(STATS_CACHE_MISSES, 1);
+    words = tokenize_stream_tap(f, arena, tap, taparg);
+    /* Only store the words if the file did not change while being read */
+    if (fstat(fileno(f), &st) == 0) {
+        get_fileid(&st, &after);
+        if (memcmp(&id, &after, sizeof(id)) == 0)
+            write_entry(cache, &id, words);
+    }
+    fclose(f);
+    return words;
+}
+
+static char *join_path(char *dir, char *name)
+{
+    size_t len = strlen(dir);
+    char *path = malloc(len + strlen(name) + 2);
+
+    if (path == NULL)
+        fatal_error("out of memory");
+    if (len > 0 && dir[len - 1] == '/')
+        sprintf(path, "%s%s", dir, name);
+    else
+        sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+/*
+ * Reads the listing of the given directory into its record.
+ */
+static void read_dir(char *path, struct dirrecord *dir)
+{
+    struct dirent *ent;
+    size_t capacity = 256;
+    DIR *d;
+
+    dir->numentries = 0;
+    dir->nameslen = 0;
+    dir->names = malloc(capacity);
+    if (dir->names == NULL)
+        fatal_error("out of memory");
+    d = opendir(path);
+    if (d == NULL) {
+        perror("opendir");
+        return;
+    }
+    while ((ent = readdir(d)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        char type;
+
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        if (ent->d_type == DT_UNKNOWN) {
+            struct stat st;
+            char *child = join_path(path, ent->d_name);
+            type = (lstat(child, &st) == 0 && S_ISDIR(st.st_mode)) ? 'd' : 'f';
+            free(child);
+        }
+        else {
+            type = ent->d_type == DT_DIR ? 'd' : 'f';
+        }
+        while (dir->nameslen + len + 2 > capacity) {
+            capacity *= 2;
+            dir->names = realloc(dir->names, capacity);
+            if (dir->names == NULL)
+                fatal_error("out of memory");
+        }
+        dir->names[dir->nameslen] = type;
+        memcpy(dir->names + dir->nameslen + 1, ent->d_name, len + 1);
+        dir->nameslen += len + 2;
+        dir->numentries++;
+    }
+    closedir(d);
+}
+
+/*
+ * Adds the files under the given directory to the list, in the order
+ * find(1) would list them.
+ */
+static void walk(cache_t *cache, char *path, struct stat *st, list_t *files)
+{
+    struct dirrecord *dir = set_get(cache->dirs, path);
+    char *p, *end;
+
+    if (dir == NULL || dir->ino != (uint64_t)st->st_ino ||
+        dir->mtime_sec != st->st_mtim.tv_sec ||
+        dir->mtime_nsec != st->st_mtim.tv_nsec) {
+        if (dir == NULL) {
+            dir = malloc(sizeof(struct dirrecord));
+            if (dir == NULL)
+                fatal_error("out of memory");
+            dir->path = strdup(path);
+            if (dir->path == NULL)
+                fatal_error("out of memory");
+            set_add(cache->dirs, dir->path, dir);
+        }
+        else {
+            free(dir->names);
+        }
+        dir->ino = st->st_ino;
+        dir->mtime_sec = st->st_mtim.tv_sec;
+        dir->mtime_nsec = st->st_mtim.tv_nsec;
+        read_dir(path, dir);
+        cache->dirty = 1;
+    }
+
+    p = dir->names;
+    end = dir->names + dir->nameslen;
+    while (p < end) {
+        char type = *p++, *child = join_path(path, p);
+        struct stat childst;
+
+        p += strlen(p) + 1;
+        if (type == 'd' && lstat(child, &childst) == 0 &&
+            S_ISDIR(childst.st_mode)) {
+            walk(cache, child, &childst, files);
+            free(child);
+        }
+        else {
+            list_addlast(files, child);
+        }
+    }
+}
+
+list_t *cache_find_files(cache_t *cache, char *root)
+{
+    list_t *files = list_create(compare_strings);
+    struct stat st;
+    char *path;
+
+    if (lstat(root, &st) < 0) {
+        perror(root);
+        return files;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        walk(cache, root, &st, files);
+    }
+    else {
+        path = strdup(root);
+        if (path == NULL)
+            fatal_error("out of memory");
+        list_addlast(files, path);
+    }
+    return files;
+}
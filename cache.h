@@ -0,0 +1,49 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "common.h"
+
+/*
+ * A persistent cache of tokenized files, kept in a directory.
+ *
+ * Each file's set of words is stored in an entry of its own, keyed by
+ * the file's identity: its device, inode, size and modification time.
+ * A file that has not changed since it was last tokenized is read back
+ * from its entry instead of being tokenized again.
+ *
+ * The cache also keeps a manifest of the directory trees it has walked.
+ * A directory whose modification time has not changed is not read
+ * again; its entries are taken from the manifest.
+ */
+struct cache;
+typedef struct cache cache_t;
+
+/*
+ * Opens the cache in the given directory, creating the directory if
+ * needed.
+ */
+cache_t *cache_open(char *dir);
+
+/*
+ * Saves the manifest of the given cache, if it has changed, and closes
+ * the cache.
+ */
+void cache_close(cache_t *cache);
+
+/*
+ * Returns the set of (unique) words found in the given file, like
+ * tokenize_tap(), reading them from the cache if the file is unchanged,
+ * and storing them there otherwise.  Safe to call from several threads.
+ */
+struct set *cache_tokenize(cache_t *cache, char *filename,
+                           struct arena *arena, bytesink_t tap,
+                           void *taparg);
+
+/*
+ * Returns the names of all files under the given root directory, like
+ * find_files(), reading unchanged directories from the manifest.  Not
+ * safe to call from several threads.
+ */
+struct list *cache_find_files(cache_t *cache, char *root);
+
+#endif
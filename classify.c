@@ -0,0 +1,535 @@
+#include "classify.h"
+#include "list.h"
+#include "set.h"
+#include "arena.h"
+#include "stats.h"
+#include "dedup.h"
+#include "ngram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define READSIZE 65536
+
+/*
+ * How messages are scored: with score against one model, or with
+ * multiscore against nmodels models at once.
+ */
+struct scoring {
+    scorefunc_t score;
+    multiscorefunc_t multiscore;
+    void *model;
+    char **names;       /* Of the models, with multiscore */
+    int nmodels;
+};
+
+struct classifier;
+
+/*
+ * A worker owns a range [lo, hi) of file indexes.  The owner takes
+ * files from the front of its range, while idle workers steal the back
+ * half of it.
+ */
+struct worker {
+    pthread_mutex_t lock;
+    int lo;
+    int hi;
+    int id;
+    arena_t *arena;     /* Holds the words of the file being scored */
+    ngram_t *ng;        /* Scans its phrases, if there are spam phrases */
+    pthread_t thread;
+    struct classifier *c;
+};
+
+struct classifier {
+    char **paths;
+    int numfiles;
+    struct scoring *s;
+    struct worker *workers;
+    int numworkers;
+
+    /* Reorder buffer: the nmodels counts of file i start at
+     * counts[i * nmodels], and are valid once ready[i] is set */
+    int *counts;
+    char *ready;
+
+    /* With deduplication, a first count of -1 means the file is a copy
+     * of file original[i], and takes its verdicts */
+    dedup_t *dedup;
+    int *original;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/* The spam phrases, if any, either one set for every model or an index
+ * of a set per model, and their order, or 0 without phrases */
+static gramset_t *spamphrases;
+static gramindex_t *phraseindex;
+static int phraseorder;
+
+void classify_setphrases(gramset_t *phrases, int order)
+{
+    spamphrases = phrases;
+    phraseorder = phrases != NULL ? order : 0;
+}
+
+void classify_setphraseindex(gramindex_t *index, int order)
+{
+    phraseindex = index;
+    phraseorder = index != NULL ? order : 0;
+}
+
+ngram_t *classify_phrasescanner(void)
+{
+    return phraseorder > 0 ? ngram_create(phraseorder) : NULL;
+}
+
+int classify_phrases(ngram_t *ng)
+{
+    int count;
+
+    if (ng == NULL)
+        return 0;
+    count = gramset_common(spamphrases, ngram_grams(ng));
+    ngram_reset(ng);
+    return count;
+}
+
+static void print_verdicts(struct scoring *s, char *path, int *counts)
+{
+    int i;
+
+    if (s->multiscore == NULL) {
+        printf("%s: %d spam word(s) -> %s\n", path, counts[0],
+               (counts[0] > 0) ? "SPAM" : "Not spam");
+        return;
+    }
+    for (i = 0; i < s->nmodels; i++)
+        printf("%s: %s: %d spam word(s) -> %s\n", path, s->names[i],
+               counts[i], (counts[i] > 0) ? "SPAM" : "Not spam");
+}
+
+static void score_words(struct scoring *s, set_t *words, int *counts)
+{
+    if (s->multiscore != NULL)
+        s->multiscore(s->model, words, counts);
+    else
+        counts[0] = s->score(s->model, words);
+}
+
+/*
+ * Counts the spam phrases against each model, or the same ones against
+ * every model without an index.
+ */
+static void add_phrases(struct scoring *s, gramset_t *grams, int *counts)
+{
+    int common, i;
+
+    if (phraseindex != NULL) {
+        gramindex_count(phraseindex, grams, counts);
+        return;
+    }
+    common = gramset_common(spamphrases, grams);
+    for (i = 0; i < s->nmodels; i++)
+        counts[i] += common;
+}
+
+/*
+ * Scores file i into its counts.  The phrase scanner, if any, is fed in
+ * the same pass as the tokenizer.  Returns -1 if the file is a copy of
+ * another file, 0 otherwise.
+ */
+static int score_file(struct classifier *c, int i, arena_t *arena,
+                      ngram_t *ng)
+{
+    uint64_t start = stats_now();
+    int *counts = c->counts + (size_t)i * c->s->nmodels;
+    bytesink_t tap = ng != NULL ? ngram_tap : NULL;
+    set_t *words;
+
+    if (c->dedup != NULL)
+        words = dedup_tokenize(c->dedup, c->paths[i], i, arena,
+                               &c->original[i], tap, ng);
+    else
+        words = tokenize_tap(c->paths[i], arena, tap, ng);
+    if (words != NULL) {
+        score_words(c->s, words, counts);
+        set_destroy(words);
+        if (ng != NULL)
+            add_phrases(c->s, ngram_grams(ng), counts);
+    }
+    else {
+        counts[0] = -1;
+    }
+    if (ng != NULL)
+        ngram_reset(ng);
+    arena_reset(arena);
+    stats_latency(stats_now() - start);
+    return words != NULL ? 0 : -1;
+}
+
+/*
+ * Takes the next file index from the worker's own range, or returns -1
+ * if the range is empty.
+ */
+static int take(struct worker *w)
+{
+    int i = -1;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->lo < w->hi)
+        i = w->lo++;
+    pthread_mutex_unlock(&w->lock);
+    return i;
+}
+
+/*
+ * Steals the back half of some other worker's range into the given
+ * worker's (empty) range.  Returns 0 if every other worker is out of
+ * work, 1 otherwise.
+ */
+static int steal(struct worker *w)
+{
+    struct classifier *c = w->c;
+    int k;
+
+    for (k = 1; k < c->numworkers; k++) {
+        struct worker *victim = &c->workers[(w->id + k) % c->numworkers];
+        int lo = 0, hi = 0;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->lo < victim->hi) {
+            hi = victim->hi;
+            lo = victim->lo + (victim->hi - victim->lo) / 2;
+            victim->hi = lo;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (lo < hi) {
+            pthread_mutex_lock(&w->lock);
+            w->lo = lo;
+            w->hi = hi;
+            pthread_mutex_unlock(&w->lock);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct classifier *c = w->c;
+    int i;
+
+    while (1) {
+        i = take(w);
+        if (i < 0) {
+            if (!steal(w))
+                break;
+            continue;
+        }
+        score_file(c, i, w->arena, w->ng);
+
+        pthread_mutex_lock(&c->lock);
+        c->ready[i] = 1;
+        pthread_cond_signal(&c->cond);
+        pthread_mutex_unlock(&c->lock);
+    }
+    return NULL;
+}
+
+static void run_files(list_t *files, struct scoring *s, int nthreads)
+{
+    struct classifier c;
+    list_iter_t *iter;
+    size_t width = s->nmodels;
+    int i, *counts;
+
+    c.numfiles = list_size(files);
+    c.s = s;
+    c.paths = malloc(sizeof(char *) * (c.numfiles + 1));
+    c.counts = malloc(sizeof(int) * width * (c.numfiles + 1));
+    c.dedup = dedup_enabled() ? dedup_create() : NULL;
+    c.original = malloc(sizeof(int) * (c.numfiles + 1));
+    if (c.paths == NULL || c.counts == NULL || c.original == NULL)
+        fatal_error("out of memory");
+    iter = list_createiter(files);
+    for (i = 0; list_hasnext(iter); i++)
+        c.paths[i] = list_next(iter);
+    list_destroyiter(iter);
+
+    if (nthreads > c.numfiles)
+        nthreads = c.numfiles;
+    if (nthreads <= 1) {
+        arena_t *arena = arena_create();
+        ngram_t *ng = classify_phrasescanner();
+        for (i = 0; i < c.numfiles; i++) {
+            counts = c.counts + i * width;
+            if (score_file(&c, i, arena, ng) < 0)
+                memcpy(counts, c.counts + c.original[i] * width,
+                       sizeof(int) * width);
+            print_verdicts(s, c.paths[i], counts);
+        }
+        if (ng != NULL)
+            ngram_destroy(ng);
+        arena_destroy(arena);
+        if (c.dedup != NULL)
+            dedup_destroy(c.dedup);
+        free(c.original);
+        free(c.counts);
+        free(c.paths);
+        return;
+    }
+
+    c.ready = calloc(c.numfiles, 1);
+    c.workers = malloc(sizeof(struct worker) * nthreads);
+    if (c.ready == NULL || c.workers == NULL)
+        fatal_error("out of memory");
+    c.numworkers = nthreads;
+    pthread_mutex_init(&c.lock, NULL);
+    pthread_cond_init(&c.cond, NULL);
+
+    /* Hand each worker an equal, contiguous slice to start with */
+    for (i = 0; i < nthreads; i++) {
+        struct worker *w = &c.workers[i];
+        pthread_mutex_init(&w->lock, NULL);
+        w->id = i;
+        w->c = &c;
+        w->arena = arena_create();
+        w->ng = classify_phrasescanner();
+        w->lo = (int)((long)c.numfiles * i / nthreads);
+        w->hi = (int)((long)c.numfiles * (i + 1) / nthreads);
+    }
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&c.workers[i].thread, NULL, worker_main,
+                           &c.workers[i]) != 0)
+            fatal_error("pthread_create() failed");
+    }
+
+    /* Drain the reorder buffer in list order as verdicts arrive.  The
+     * original of a copy may come later in the list, but is always
+     * being scored by some worker */
+    for (i = 0; i < c.numfiles; i++) {
+        int j = i;
+
+        pthread_mutex_lock(&c.lock);
+        while (!c.ready[j] || c.counts[j * width] < 0) {
+            if (c.ready[j])
+                j = c.original[j];
+            else
+                pthread_cond_wait(&c.cond, &c.lock);
+        }
+        pthread_mutex_unlock(&c.lock);
+        print_verdicts(s, c.paths[i], c.counts + j * width);
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(c.workers[i].thread, NULL);
+        pthread_mutex_destroy(&c.workers[i].lock);
+        arena_destroy(c.workers[i].arena);
+        if (c.workers[i].ng != NULL)
+            ngram_destroy(c.workers[i].ng);
+    }
+    pthread_mutex_destroy(&c.lock);
+    pthread_cond_destroy(&c.cond);
+    free(c.workers);
+    free(c.ready);
+    if (c.dedup != NULL)
+        dedup_destroy(c.dedup);
+    free(c.original);
+    free(c.counts);
+    free(c.paths);
+}
+
+void classify_files(list_t *files, scorefunc_t score, void *model,
+                    int nthreads)
+{
+    struct scoring s = { score, NULL, model, NULL, 1 };
+
+    run_files(files, &s, nthreads);
+}
+
+void classify_files_multi(list_t *files, multiscorefunc_t score,
+                          void *models, char **names, int nmodels,
+                          int nthreads)
+{
+    struct scoring s = { NULL, score, models, names, nmodels };
+
+    run_files(files, &s, nthreads);
+}
+
+/*
+ * Scores the message held by the tokenizer into counts, prints its
+ * verdicts under the given name right away, and readies the tokenizer
+ * for the next message.  The message started arriving at the given
+ * time.
+ */
+static void report_message(tokenizer_t *tok, ngram_t *ng, char *name,
+                           struct scoring *s, int *counts, uint64_t start)
+{
+    score_words(s, tokenizer_words(tok), counts);
+    if (ng != NULL) {
+        add_phrases(s, ngram_grams(ng), counts);
+        ngram_reset(ng);
+    }
+    print_verdicts(s, name, counts);
+    fflush(stdout);
+    tokenizer_reset(tok);
+    stats_latency(stats_now() - start);
+}
+
+static void finish_message(tokenizer_t *tok, ngram_t *ng, int num,
+                           struct scoring *s, int *counts, uint64_t start)
+{
+    char name[32];
+
+    sprintf(name, "stdin:%d", num);
+    report_message(tok, ng, name, s, counts, start);
+}
+
+/*
+ * Feeds the next bytes of a message to the tokenizer, and to the phrase
+ * scanner if there is one.
+ */
+static void feed(tokenizer_t *tok, ngram_t *ng, const char *data, size_t len)
+{
+    tokenizer_feed(tok, data, len);
+    if (ng != NULL)
+        ngram_feed(ng, data, len);
+}
+
+static void run_stream(int fd, enum framing framing, struct scoring *s)
+{
+    tokenizer_t *tok = tokenizer_create();
+    ngram_t *ng = classify_phrasescanner();
+    char *buf = malloc(READSIZE);
+    int *counts = malloc(sizeof(int) * s->nmodels);
+    unsigned char header[4];
+    int headerlen = 0, inmessage = 0, num = 0;
+    uint32_t remaining = 0;
+    uint64_t start = 0;
+    ssize_t n;
+
+    if (buf == NULL || counts == NULL)
+        fatal_error("out of memory");
+    while (1) {
+        char *p, *end;
+
+        n = read(fd, buf, READSIZE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            fatal_error("read() failed");
+        }
+        if (n == 0)
+            break;
+        p = buf;
+        end = buf + n;
+        while (p < end) {
+            if (!inmessage)
+                start = stats_now();
+            if (framing == FRAMING_NUL) {
+                char *nul = memchr(p, 0, end - p);
+                if (nul == NULL) {
+                    feed(tok, ng, p, end - p);
+                    inmessage = 1;
+                    break;
+                }
+                feed(tok, ng, p, nul - p);
+                finish_message(tok, ng, ++num, s, counts, start);
+                inmessage = 0;
+                p = nul + 1;
+            }
+            else if (headerlen < 4) {
+                header[headerlen++] = *p++;
+                if (headerlen == 4) {
+                    remaining = ((uint32_t)header[0] << 24) |
+                                ((uint32_t)header[1] << 16) |
+                                ((uint32_t)header[2] << 8) | header[3];
+                    inmessage = 1;
+                }
+            }
+            else {
+                size_t chunk = end - p;
+                if (chunk > remaining)
+                    chunk = remaining;
+                feed(tok, ng, p, chunk);
+                p += chunk;
+                remaining -= chunk;
+            }
+            if (framing == FRAMING_LENGTH && headerlen == 4 && remaining == 0) {
+                finish_message(tok, ng, ++num, s, counts, start);
+                headerlen = 0;
+                inmessage = 0;
+            }
+        }
+    }
+
+    /* A last NUL-delimited message may lack its terminator */
+    if (inmessage) {
+        if (framing == FRAMING_LENGTH)
+            fatal_error("truncated message on input");
+        finish_message(tok, ng, ++num, s, counts, start);
+    }
+    free(counts);
+    free(buf);
+    if (ng != NULL)
+        ngram_destroy(ng);
+    tokenizer_destroy(tok);
+}
+
+void classify_stream(int fd, enum framing framing, scorefunc_t score,
+                     void *model)
+{
+    struct scoring s = { score, NULL, model, NULL, 1 };
+
+    run_stream(fd, framing, &s);
+}
+
+void classify_stream_multi(int fd, enum framing framing,
+                           multiscorefunc_t score, void *models,
+                           char **names, int nmodels)
+{
+    struct scoring s = { NULL, score, models, names, nmodels };
+
+    run_stream(fd, framing, &s);
+}
+
+int classify_file(char *path, scorefunc_t score, void *model)
+{
+    struct scoring s = { score, NULL, model, NULL, 1 };
+    uint64_t start = stats_now();
+    tokenizer_t *tok;
+    ngram_t *ng;
+    char buf[READSIZE];
+    ssize_t n;
+    int fd = open(path, O_RDONLY), count;
+
+    if (fd < 0)
+        return -1;
+    tok = tokenizer_create();
+    ng = classify_phrasescanner();
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            fatal_error("read() failed");
+        }
+        feed(tok, ng, buf, n);
+    }
+    close(fd);
+    report_message(tok, ng, path, &s, &count, start);
+    if (ng != NULL)
+        ngram_destroy(ng);
+    tokenizer_destroy(tok);
+    return 0;
+}
@@ -0,0 +1,113 @@
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#include "common.h"
+
+/*
+ * The type of scoring functions.  A scoring function returns the number
+ * of spam words the given model finds in the given set of words.
+ *
+ * Scoring functions are called concurrently from several threads, so
+ * they must only read from the model.
+ */
+typedef int (*scorefunc_t)(void *model, struct set *words);
+
+/*
+ * The type of scoring functions for several models at once.  Stores in
+ * counts[i] the number of spam words model i of the given models finds
+ * in the given set of words, with the same rules as scorefunc_t.
+ */
+typedef void (*multiscorefunc_t)(void *models, struct set *words,
+                                 int *counts);
+
+/*
+ * Classifies each of the files in the given list as spam or not spam,
+ * and prints one verdict line per file to standard output.
+ *
+ * The files are tokenized and scored by nthreads worker threads that
+ * steal work from each other when they run out.  Verdicts are printed
+ * in the same order as the files appear in the list, regardless of the
+ * order in which the workers finish them.
+ */
+void classify_files(struct list *files, scorefunc_t score, void *model,
+                    int nthreads);
+
+/*
+ * Like classify_files(), but scores each file against the given number
+ * of models at once, tokenizing it only once, and prints one verdict
+ * line per file and model, naming the model, in the order of names.
+ */
+void classify_files_multi(struct list *files, multiscorefunc_t score,
+                          void *models, char **names, int nmodels,
+                          int nthreads);
+
+/*
+ * Makes classify_files() and classify_stream() also count the phrases
+ * of each message that are in the given set of spam phrases, as found
+ * by a scanner of the given order, or stop doing so if phrases is NULL.
+ * The phrases count as spam words in the verdicts.  Set before
+ * classifying anything.
+ */
+struct gramset;
+void classify_setphrases(struct gramset *phrases, int order);
+
+/*
+ * Like classify_setphrases(), but for classify_files_multi() and
+ * classify_stream_multi(): each model counts the phrases of the set of
+ * the same number in the given index, or none if index is NULL.  The
+ * order is the largest of those of the sets.
+ */
+struct gramindex;
+void classify_setphraseindex(struct gramindex *index, int order);
+
+/*
+ * Returns a new scanner for the spam phrases set with
+ * classify_setphrases(), or NULL if there are none.  The scanner is
+ * fed a message alongside the tokenizer, through ngram_tap() as the
+ * tap of tokenize_stream_tap(), and destroyed with ngram_destroy().
+ */
+struct ngram;
+struct ngram *classify_phrasescanner(void);
+
+/*
+ * Returns the number of spam phrases in the message fed to the given
+ * scanner, and readies the scanner for the next message.  Returns 0 if
+ * the scanner is NULL.
+ */
+int classify_phrases(struct ngram *ng);
+
+/*
+ * How messages are delimited in a stream passed to classify_stream().
+ */
+enum framing {
+    FRAMING_NUL,        /* Each message is terminated by a NUL byte */
+    FRAMING_LENGTH      /* Each message is preceded by its length, as a
+                           4-byte big-endian integer */
+};
+
+/*
+ * Classifies the messages read from the given file descriptor as they
+ * arrive, and prints one verdict line per message to standard output.
+ * Messages are numbered from 1 in the order they are read.  Nothing is
+ * written to disk, and the tokenizer buffers are reused from one
+ * message to the next.
+ */
+void classify_stream(int fd, enum framing framing, scorefunc_t score,
+                     void *model);
+
+/*
+ * Like classify_stream(), but against several models at once, as with
+ * classify_files_multi().
+ */
+void classify_stream_multi(int fd, enum framing framing,
+                           multiscorefunc_t score, void *models,
+                           char **names, int nmodels);
+
+/*
+ * Classifies the given file right away, in the calling thread, and
+ * prints its verdict line to standard output.  Returns -1 with errno
+ * set if the file cannot be opened, 0 otherwise.
+ */
+int classify_file(char *path, scorefunc_t score, void *model);
+
+#endif
@@ -0,0 +1,310 @@
+/*
+ * spamclient: sends mails to a running classifier daemon
+ * ('spamfilter serve') and prints its verdicts, or drives it with
+ * concurrent load and reports throughput and latency.
+ */
+#include "protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* A request frame, ready to be sent */
+struct request {
+    char *name;
+    char *frame;
+    size_t len;
+};
+
+/* State of one load-generating connection */
+struct loader {
+    pthread_t thread;
+    char *socketpath;
+    struct request *requests;
+    int numrequests;
+    int first;          /* Index of the first request this loader sends */
+    int count;          /* Number of requests this loader sends */
+    double *latencies;  /* Seconds, one per request sent */
+};
+
+static void fatal(char *msg)
+{
+    fprintf(stderr, "spamclient: %s\n", msg);
+    exit(1);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_to(char *socketpath)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(socketpath) >= sizeof(addr.sun_path))
+        fatal("socket path too long");
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        fatal("socket() failed");
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketpath);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        fatal("connect() failed");
+    }
+    return fd;
+}
+
+static void write_all(int fd, char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("write");
+            fatal("write() failed");
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+static void read_all(int fd, char *data, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = read(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            fatal("connection closed by server");
+        data += n;
+        len -= n;
+    }
+}
+
+/*
+ * Builds a request frame for the given file, either carrying its
+ * contents or just its path.
+ */
+static void make_request(struct request *req, char *filename, int bypath)
+{
+    size_t len;
+    FILE *f;
+
+    req->name = filename;
+    if (bypath) {
+        len = 1 + strlen(filename);
+        req->frame = malloc(4 + len);
+        if (req->frame == NULL)
+            fatal("out of memory");
+        req->frame[4] = PROTO_PATH;
+        memcpy(req->frame + 5, filename, len - 1);
+    }
+    else {
+        f = fopen(filename, "rb");
+        if (f == NULL) {
+            perror(filename);
+            fatal("fopen() failed");
+        }
+        fseek(f, 0, SEEK_END);
+        len = 1 + ftell(f);
+        fseek(f, 0, SEEK_SET);
+        req->frame = malloc(4 + len);
+        if (req->frame == NULL)
+            fatal("out of memory");
+        req->frame[4] = PROTO_MESSAGE;
+        if (fread(req->frame + 5, 1, len - 1, f) != len - 1)
+            fatal("fread() failed");
+        fclose(f);
+    }
+    if (len > PROTO_MAXFRAME)
+        fatal("mail too large");
+    req->frame[0] = (char)(len >> 24);
+    req->frame[1] = (char)(len >> 16);
+    req->frame[2] = (char)(len >> 8);
+    req->frame[3] = (char)len;
+    req->len = 4 + len;
+}
+
+/*
+ * Sends the given request and waits for its response.  Returns the
+ * number of spam words, or -1 if the server reported an error, in which
+ * case the message is copied to errmsg.
+ */
+static int roundtrip(int fd, struct request *req, char *errmsg, size_t errlen)
+{
+    unsigned char header[4];
+    char payload[256];
+    uint32_t len;
+
+    write_all(fd, req->frame, req->len);
+    read_all(fd, (char *)header, 4);
+    len = ((uint32_t)header[0] << 24) | ((uint32_t)header[1] << 16) |
+          ((uint32_t)header[2] << 8) | (uint32_t)header[3];
+    if (len == 0 || len >= sizeof(payload))
+        fatal("malformed response");
+    read_all(fd, payload, len);
+    payload[len] = 0;
+    if (payload[0] == PROTO_RESULT)
+        return atoi(payload + 1);
+    snprintf(errmsg, errlen, "%s", payload + 1);
+    return -1;
+}
+
+static void *loader_main(void *arg)
+{
+    struct loader *l = arg;
+    char errmsg[256];
+    double start;
+    int fd, i;
+
+    fd = connect_to(l->socketpath);
+    for (i = 0; i < l->count; i++) {
+        struct request *req = &l->requests[(l->first + i) % l->numrequests];
+        start = now();
+        if (roundtrip(fd, req, errmsg, sizeof(errmsg)) < 0) {
+            fprintf(stderr, "%s: %s\n", req->name, errmsg);
+            fatal("request failed");
+        }
+        l->latencies[i] = now() - start;
+    }
+    close(fd);
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+/*
+ * Sends total requests over nconns concurrent connections, cycling
+ * through the given requests, and prints a one-line report.
+ */
+static void loadtest(char *socketpath, struct request *requests,
+                     int numrequests, int total, int nconns)
+{
+    struct loader *loaders;
+    double *latencies, start, elapsed;
+    int i, sent;
+
+    loaders = malloc(sizeof(struct loader) * nconns);
+    latencies = malloc(sizeof(double) * total);
+    if (loaders == NULL || latencies == NULL)
+        fatal("out of memory");
+
+    start = now();
+    for (i = sent = 0; i < nconns; i++) {
+        struct loader *l = &loaders[i];
+        l->socketpath = socketpath;
+        l->requests = requests;
+        l->numrequests = numrequests;
+        l->first = sent;
+        l->count = total / nconns + (i < total % nconns);
+        l->latencies = latencies + sent;
+        sent += l->count;
+        if (pthread_create(&l->thread, NULL, loader_main, l) != 0)
+            fatal("pthread_create() failed");
+    }
+    for (i = 0; i < nconns; i++)
+        pthread_join(loaders[i].thread, NULL);
+    elapsed = now() - start;
+
+    qsort(latencies, total, sizeof(double), compare_doubles);
+    printf("requests=%d connections=%d seconds=%.3f requests_per_sec=%.1f "
+           "p50_us=%.1f p99_us=%.1f max_us=%.1f\n",
+           total, nconns, elapsed, total / elapsed,
+           latencies[total / 2] * 1e6,
+           latencies[(int)(total * 0.99)] * 1e6,
+           latencies[total - 1] * 1e6);
+    free(latencies);
+    free(loaders);
+}
+
+static void usage(char *progname)
+{
+    fprintf(stderr,
+            "usage: %s [-p] <socket> <file>...\n"
+            "       %s [-p] -n requests [-c connections] <socket> <file>...\n"
+            "  -p  send file paths instead of file contents\n"
+            "  -n  load test: send this many requests in total\n"
+            "  -c  load test: number of concurrent connections (default 1)\n",
+            progname, progname);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    struct request *requests;
+    char *socketpath, errmsg[256];
+    int opt, i, fd, count, numrequests;
+    int bypath = 0, total = 0, nconns = 1;
+
+    while ((opt = getopt(argc, argv, "pn:c:")) != -1) {
+        switch (opt) {
+        case 'p':
+            bypath = 1;
+            break;
+        case 'n':
+            total = atoi(optarg);
+            break;
+        case 'c':
+            nconns = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind < 2 || total < 0 || nconns < 1)
+        usage(argv[0]);
+    socketpath = argv[optind];
+    numrequests = argc - optind - 1;
+    requests = malloc(sizeof(struct request) * numrequests);
+    if (requests == NULL)
+        fatal("out of memory");
+    for (i = 0; i < numrequests; i++)
+        make_request(&requests[i], argv[optind + 1 + i], bypath);
+
+    if (total > 0) {
+        if (nconns > total)
+            nconns = total;
+        loadtest(socketpath, requests, numrequests, total, nconns);
+    }
+    else {
+        fd = connect_to(socketpath);
+        for (i = 0; i < numrequests; i++) {
+            count = roundtrip(fd, &requests[i], errmsg, sizeof(errmsg));
+            if (count < 0)
+                printf("%s: error: %s\n", requests[i].name, errmsg);
+            else
+                printf("%s: %d spam word(s) -> %s\n", requests[i].name, count,
+                       (count > 0) ? "SPAM" : "Not spam");
+        }
+        close(fd);
+    }
+
+    for (i = 0; i < numrequests; i++)
+        free(requests[i].frame);
+    free(requests);
+    return 0;
+}
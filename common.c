@@ -1,10 +1,32 @@
 #include "common.h"
 #include "list.h"
+#include "set.h"
+#include "arena.h"
+#include "alloc.h"
+#include "stats.h"
+#include "cache.h"
+#include "utf8.h"
 
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <unistd.h>
+
+#define MAXWORD  100       /* Longer words are split, in bytes */
+#define READSIZE 65536
+
+struct tokenizer {
+    char word[MAXWORD + 1];    /* The word being scanned, case-folded */
+    int wordlen;
+    utf8_decoder_t utf8;
+    set_t *words;
+    tokensink_t sink;          /* If set, every word goes here instead */
+    void *sinkarg;
+    arena_t *arena;            /* Storage for the words of the message */
+    int ownarena;              /* The arena belongs to the tokenizer */
+};
 
 void fatal_error(char *msg)
 {
@@ -12,23 +34,304 @@ void fatal_error(char *msg)
     exit(1);
 }
 
-void tokenize_file(FILE *file, list_t *list)
+FILE *save_open(char *filename, char **tmpname)
 {
-    char *word;
-    char buf[101];
-    buf[100] = 0;
-    
-    while (!feof(file)) {
-		/* Skip non-letters */
-		fscanf(file, "%*[^a-zA-Z0-9'_]");
-		/* Scan up to 100 letters */
-		if (fscanf(file, "%100[a-zA-Z0-9'_]", buf) == 1) {
-	    	word = strdup(buf);
-	    	if (word == NULL)
-				fatal_error("out of memory");
-	    	list_addlast(list, word);
-		}
+    FILE *f;
+
+    *tmpname = malloc(strlen(filename) + 5);
+    if (*tmpname == NULL)
+        fatal_error("out of memory");
+    sprintf(*tmpname, "%s.tmp", filename);
+    f = fopen(*tmpname, "wb");
+    if (f == NULL) {
+        perror("fopen");
+        fatal_error("fopen() failed");
+    }
+    return f;
+}
+
+void save_close(FILE *file, char *filename, char *tmpname)
+{
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        perror("fsync");
+        unlink(tmpname);
+        fatal_error("fsync() failed");
+    }
+    if (fclose(file) != 0) {
+        perror("fclose");
+        unlink(tmpname);
+        fatal_error("fclose() failed");
+    }
+    if (rename(tmpname, filename) < 0) {
+        perror("rename");
+        unlink(tmpname);
+        fatal_error("rename() failed");
     }
+    free(tmpname);
+}
+
+/* The cache consulted by tokenize() and find_files(), if any */
+static cache_t *tokcache;
+
+void tokenize_setcache(struct cache *cache)
+{
+	tokcache = cache;
+}
+
+set_t *tokenize(char *filename, arena_t *arena)
+{
+	return tokenize_tap(filename, arena, NULL, NULL);
+}
+
+set_t *tokenize_tap(char *filename, arena_t *arena, bytesink_t tap,
+                    void *taparg)
+{
+	set_t *wordset;
+	FILE *f;
+	
+	if (tokcache != NULL)
+		return cache_tokenize(tokcache, filename, arena, tap, taparg);
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		perror("fopen");
+		fatal_error("fopen() failed");
+	}
+	wordset = tokenize_stream_tap(f, arena, tap, taparg);
+	fclose(f);
+	return wordset;
+}
+
+/*
+ * Returns an empty set for the words of a message.  With an arena, its
+ * nodes are taken from the arena along with the words.
+ */
+static set_t *new_words(arena_t *arena)
+{
+	if (arena == NULL)
+		return set_create(compare_words);
+	return set_create_alloc(compare_words, arena_allocator(arena));
+}
+
+/*
+ * Readies a tokenizer to store its words in the given arena.
+ */
+static void tokenizer_init(tokenizer_t *tok, arena_t *arena)
+{
+	tok->wordlen = 0;
+	utf8_init(&tok->utf8);
+	tok->words = new_words(arena);
+	tok->sink = NULL;
+	tok->arena = arena;
+	tok->ownarena = 0;
+}
+
+tokenizer_t *tokenizer_create(void)
+{
+	tokenizer_t *tok = malloc(sizeof(tokenizer_t));
+	if (tok == NULL)
+		fatal_error("out of memory");
+	tokenizer_init(tok, arena_create());
+	tok->ownarena = 1;
+	return tok;
+}
+
+void tokenizer_destroy(tokenizer_t *tok)
+{
+	set_destroy(tok->words);
+	if (tok->ownarena)
+		arena_destroy(tok->arena);
+	free(tok);
+}
+
+/*
+ * Adds the word in the scan buffer to the set of words, unless it is
+ * already there.
+ */
+static void tokenizer_emit(tokenizer_t *tok)
+{
+	char *word;
+
+	tok->word[tok->wordlen] = 0;
+	tok->wordlen = 0;
+	stats_count(STATS_TOKENS, 1);
+	if (tok->sink != NULL) {
+		tok->sink(tok->sinkarg, tok->word);
+		return;
+	}
+	if (set_contains(tok->words, tok->word))
+		return;
+	word = arena_strdup(tok->arena, tok->word);
+	set_add(tok->words, word, word);
+	stats_count(STATS_UNIQUE_TOKENS, 1);
+}
+
+static void tokenizer_endword(tokenizer_t *tok)
+{
+	if (tok->wordlen > 0)
+		tokenizer_emit(tok);
+}
+
+/*
+ * Adds the given decoded character to the word being scanned, or ends
+ * the word.  A character that is a word on its own ends the word before
+ * it too.
+ */
+static void tokenizer_char(tokenizer_t *tok, uint32_t cp)
+{
+	char buf[4];
+	int len, class = utf8_wordchar(cp, buf, &len);
+
+	if (class == UTF8_SEPARATOR) {
+		tokenizer_endword(tok);
+		return;
+	}
+	if (class == UTF8_SOLO || tok->wordlen + len > MAXWORD)
+		tokenizer_endword(tok);
+	memcpy(tok->word + tok->wordlen, buf, len);
+	tok->wordlen += len;
+	if (class == UTF8_SOLO || tok->wordlen == MAXWORD)
+		tokenizer_emit(tok);
+}
+
+/*
+ * Decodes one byte outside of the ASCII fast path.  Invalid bytes end
+ * the word being scanned.
+ */
+static void tokenizer_byte(tokenizer_t *tok, unsigned char c)
+{
+	int32_t cp = utf8_decode(&tok->utf8, c);
+
+	if (cp == UTF8_AGAIN) {
+		tokenizer_endword(tok);
+		cp = utf8_decode(&tok->utf8, c);
+	}
+	if (cp >= 0)
+		tokenizer_char(tok, cp);
+	else if (cp != UTF8_MORE)
+		tokenizer_endword(tok);
+}
+
+/*
+ * Plain ASCII, which is most of most mail, is scanned a run at a time
+ * with a table lookup per byte.  Other bytes go through the decoder.
+ */
+void tokenizer_feed(tokenizer_t *tok, const char *data, size_t len)
+{
+	size_t i = 0, end;
+
+	stats_count(STATS_BYTES_READ, len);
+	while (i < len) {
+		while (i < len && (utf8_pending(&tok->utf8) ||
+		                   (unsigned char)data[i] >= 0x80))
+			tokenizer_byte(tok, data[i++]);
+		end = i + utf8_ascii_prefix(data + i, len - i);
+		for (; i < end; i++) {
+			unsigned char c = utf8_ascii[(unsigned char)data[i]];
+			if (c != 0) {
+				tok->word[tok->wordlen++] = c;
+				if (tok->wordlen == MAXWORD)
+					tokenizer_emit(tok);
+			}
+			else if (tok->wordlen > 0) {
+				tokenizer_emit(tok);
+			}
+		}
+	}
+}
+
+set_t *tokenizer_words(tokenizer_t *tok)
+{
+	alloc_stats_t mem;
+
+	/* A character cut short by the end of the message is dropped */
+	utf8_init(&tok->utf8);
+	tokenizer_endword(tok);
+	if (tok->sink == NULL) {
+		set_memstats(tok->words, &mem);
+		stats_wordset(mem.peak);
+	}
+	return tok->words;
+}
+
+void tokenizer_reset(tokenizer_t *tok)
+{
+	set_destroy(tok->words);
+	arena_reset(tok->arena);
+	tok->words = new_words(tok->arena);
+	tok->wordlen = 0;
+	utf8_init(&tok->utf8);
+}
+
+void tokenize_each(FILE *file, tokensink_t sink, void *arg)
+{
+	tokenizer_t tok;
+	char buf[READSIZE];
+	size_t n;
+	stats_timer_t timer;
+
+	stats_start(&timer);
+	tokenizer_init(&tok, NULL);
+	tok.sink = sink;
+	tok.sinkarg = arg;
+	while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+		tokenizer_feed(&tok, buf, n);
+	tokenizer_words(&tok);
+	set_destroy(tok.words);
+	stats_stop(&timer, STAGE_TOKENIZE);
+}
+
+static void add_to_list(void *list, const char *word)
+{
+	char *copy = strdup(word);
+
+	if (copy == NULL)
+		fatal_error("out of memory");
+	list_addlast(list, copy);
+}
+
+void tokenize_file(FILE *file, list_t *list)
+{
+	tokenize_each(file, add_to_list, list);
+}
+
+set_t *tokenize_stream(FILE *file, arena_t *arena)
+{
+	return tokenize_stream_tap(file, arena, NULL, NULL);
+}
+
+set_t *tokenize_stream_tap(FILE *file, arena_t *arena, bytesink_t tap,
+                           void *taparg)
+{
+	tokenizer_t tok;
+	char buf[READSIZE];
+	size_t n;
+	stats_timer_t timer;
+	set_t *words;
+
+	stats_start(&timer);
+	tokenizer_init(&tok, arena);
+	while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+		tokenizer_feed(&tok, buf, n);
+		if (tap != NULL)
+			tap(taparg, buf, n);
+	}
+	words = tokenizer_words(&tok);
+	stats_stop(&timer, STAGE_TOKENIZE);
+	return words;
+}
+
+set_t *tokenize_buffer(const char *data, size_t len, arena_t *arena)
+{
+	tokenizer_t tok;
+	stats_timer_t timer;
+	set_t *words;
+
+	stats_start(&timer);
+	tokenizer_init(&tok, arena);
+	tokenizer_feed(&tok, data, len);
+	words = tokenizer_words(&tok);
+	stats_stop(&timer, STAGE_TOKENIZE);
+	return words;
 }
 
 struct list *find_files(char *root)
@@ -36,7 +339,14 @@ struct list *find_files(char *root)
     list_t *files;
     char *command;
     FILE *f;
+    stats_timer_t timer;
     
+    stats_start(&timer);
+    if (tokcache != NULL) {
+        files = cache_find_files(tokcache, root);
+        stats_stop(&timer, STAGE_FIND_FILES);
+        return files;
+    }
     files = list_create(compare_strings);
     command = malloc(strlen(root) + 40);
     if (command == NULL)
@@ -70,6 +380,7 @@ struct list *find_files(char *root)
         fatal_error("fclose() failed");
     }
     free(command);    
+    stats_stop(&timer, STAGE_FIND_FILES);
     return files;
 }
 
@@ -77,3 +388,8 @@ int compare_strings(void *a, void *b)
 {
     return strcmp(a, b);
 }
+
+int compare_words(void *a, void *b)
+{
+    return strcasecmp(a, b);
+}
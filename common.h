@@ -4,6 +4,8 @@
 #include <stdio.h>
 
 struct list;
+struct set;
+struct arena;
 
 /*
  * The type of comparison functions.
@@ -16,26 +18,144 @@ typedef int (*cmpfunc_t)(void *, void *);
  */
 void fatal_error(char *msg);
 
+/*
+ * Opens <filename>.tmp for writing in place of the given file, and
+ * stores its name in *tmpname.  save_close() then flushes it to disk and
+ * renames it over the given file, so that a process which has the old
+ * file open or mapped keeps reading the old contents, and a crash never
+ * leaves a partly written file behind.  Both terminate the program on
+ * failure.
+ */
+FILE *save_open(char *filename, char **tmpname);
+void save_close(FILE *file, char *filename, char *tmpname);
+
 /*
  * Reads the given file, and parses it into words (tokens).
  * Adds the words to the given list, in the same order that they
  * occur in the file.
  *
- * This tokenizer ignores punctuation and whitespace, so if the file
- * contains the text "Hello! This is an example...." the recognized
- * words will be "Hello", "This", "is", "an", and "example".
+ * This tokenizer ignores punctuation and whitespace, and folds case,
+ * so if the file contains the text "Hello! This is an example...."
+ * the recognized words will be "hello", "this", "is", "an", and
+ * "example".  The file is read as UTF-8, and words may be in any
+ * script; see utf8.h for what makes a word.
  */
 void tokenize_file(FILE *file, struct list *list);
 
+/*
+ * Reads the given file like tokenize_file(), but passes each word to
+ * the given function as it is found, along with arg, instead of
+ * keeping it.  The word is only valid during the call.
+ */
+typedef void (*tokensink_t)(void *arg, const char *word);
+void tokenize_each(FILE *file, tokensink_t sink, void *arg);
+
+/*
+ * The type of streaming tokenizers.  A streaming tokenizer is fed the
+ * bytes of a message in arbitrary chunks, and recognizes the same words
+ * as tokenize_file().  Its buffers are kept from one message to the
+ * next, so tokenizing a stream of messages allocates little once the
+ * tokenizer has grown to fit the largest of them.
+ */
+struct tokenizer;
+typedef struct tokenizer tokenizer_t;
+
+/*
+ * Creates a new streaming tokenizer, ready for the first message.
+ */
+tokenizer_t *tokenizer_create(void);
+
+/*
+ * Destroys the given streaming tokenizer.
+ */
+void tokenizer_destroy(tokenizer_t *tok);
+
+/*
+ * Feeds the next len bytes of the current message to the tokenizer.
+ * A word may span several chunks.
+ */
+void tokenizer_feed(tokenizer_t *tok, const char *data, size_t len);
+
+/*
+ * Ends the current message and returns the set of (unique) words found
+ * in it.  The set and its words belong to the tokenizer, and remain
+ * valid until the next call to tokenizer_reset().
+ */
+struct set *tokenizer_words(tokenizer_t *tok);
+
+/*
+ * Discards the current message and starts a new one, reusing the
+ * buffers of the old one.
+ */
+void tokenizer_reset(tokenizer_t *tok);
+
 /*
  * Recursively finds the names of all files under the given root directory.
  * Returns the file names as a list of strings.
  */
 struct list *find_files(char *root);
 
+/*
+ * Returns the set of (unique) words found in the given file.
+ * Words are compared case-insensitively.
+ *
+ * The words are allocated from the given arena, which owns them: they
+ * stay valid after the set is destroyed, until the arena is reset or
+ * destroyed.  The nodes of the set are taken from the arena as well,
+ * so the set, and any set derived from it, must be destroyed before
+ * the arena is reset.
+ */
+struct set *tokenize(char *filename, struct arena *arena);
+
+/*
+ * The type of functions passed each piece of a file as the tokenizer
+ * reads it, so that another scanner sees the same bytes in the same
+ * pass.
+ */
+typedef void (*bytesink_t)(void *arg, const char *data, size_t len);
+
+/*
+ * Like tokenize(), but also passes the contents of the file to tap,
+ * unless tap is NULL.  A file whose words come from the cache is still
+ * read for tap.
+ */
+struct set *tokenize_tap(char *filename, struct arena *arena,
+                         bytesink_t tap, void *taparg);
+
+/*
+ * Returns the set of (unique) words read from the given stream,
+ * allocated from the given arena as with tokenize().
+ */
+struct set *tokenize_stream(FILE *file, struct arena *arena);
+
+/*
+ * Like tokenize_stream(), with a tap as for tokenize_tap().
+ */
+struct set *tokenize_stream_tap(FILE *file, struct arena *arena,
+                                bytesink_t tap, void *taparg);
+
+/*
+ * Returns the set of (unique) words in the given bytes, allocated from
+ * the given arena as with tokenize().
+ */
+struct set *tokenize_buffer(const char *data, size_t len,
+                            struct arena *arena);
+
+/*
+ * Makes tokenize() and find_files() go through the given cache, or
+ * bypass caching if it is NULL.  Set before starting any threads.
+ */
+struct cache;
+void tokenize_setcache(struct cache *cache);
+
 /* 
  * Compares two strings using strcmp().
  */
 int compare_strings(void *a, void *b);
 
+/*
+ * Case-insensitive comparison function for strings.
+ */
+int compare_words(void *a, void *b);
+
 #endif
@@ -0,0 +1,262 @@
+#include "counts.h"
+#include "set.h"
+#include "hash.h"
+#include "stats.h"
+#include "typedset.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define COUNTS_MAGIC   "SPFC"
+#define COUNTS_VERSION 1
+
+/*
+ * On-disk layout of document counts:
+ *
+ *   struct counts_header
+ *   numwords records of { uint32_t spam; uint32_t ham; char word[]; }
+ *   where word is NUL-terminated
+ *
+ * The checksum covers everything after the header.  Words that no
+ * longer occur in any document are not written.
+ */
+struct counts_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t numwords;
+    uint32_t spamdocs;
+    uint32_t hamdocs;
+    uint32_t reserved;
+    uint64_t checksum;
+};
+
+/* Document frequencies of a single word, kept in the node of its set */
+struct dfcount {
+    char *word;
+    uint32_t spam;
+    uint32_t ham;
+};
+
+#define DFCOUNT_CMP(c, a, b) strcasecmp((a).word, (b).word)
+
+SET_DEFINE(dfset, struct dfcount, DFCOUNT_CMP)
+
+struct counts {
+    dfset_t *words;
+    uint32_t spamdocs;
+    uint32_t hamdocs;
+};
+
+counts_t *counts_create(void)
+{
+    counts_t *counts = malloc(sizeof(counts_t));
+    if (counts == NULL)
+        fatal_error("out of memory");
+    counts->words = dfset_create(NULL);
+    counts->spamdocs = 0;
+    counts->hamdocs = 0;
+    return counts;
+}
+
+void counts_destroy(counts_t *counts)
+{
+    dfset_node_t *n;
+
+    for (n = dfset_first(counts->words); n != NULL; n = dfset_next(n))
+        free(n->key.word);
+    dfset_destroy(counts->words);
+    free(counts);
+}
+
+/*
+ * Returns the counters of the given word, creating them if needed.
+ */
+static struct dfcount *lookup(counts_t *counts, char *word)
+{
+    struct dfcount key = { word, 0, 0 };
+    struct dfcount *df = dfset_insert(counts->words, key);
+
+    /* A new word still refers to the caller's copy */
+    if (df->word == word) {
+        df->word = strdup(word);
+        if (df->word == NULL)
+            fatal_error("out of memory");
+    }
+    return df;
+}
+
+void counts_add(counts_t *counts, set_t *words, int spam)
+{
+    set_iter_t *iter = set_createiter(words);
+
+    while (set_hasnext(iter)) {
+        struct dfcount *df = lookup(counts, set_next(iter));
+        if (spam)
+            df->spam++;
+        else
+            df->ham++;
+    }
+    set_destroyiter(iter);
+    if (spam)
+        counts->spamdocs++;
+    else
+        counts->hamdocs++;
+}
+
+void counts_remove(counts_t *counts, set_t *words, int spam)
+{
+    set_iter_t *iter = set_createiter(words);
+
+    while (set_hasnext(iter)) {
+        struct dfcount key = { set_next(iter), 0, 0 };
+        struct dfcount *df = dfset_find(counts->words, key);
+
+        if (df == NULL)
+            continue;
+        if (spam && df->spam > 0)
+            df->spam--;
+        else if (!spam && df->ham > 0)
+            df->ham--;
+    }
+    set_destroyiter(iter);
+    if (spam && counts->spamdocs > 0)
+        counts->spamdocs--;
+    else if (!spam && counts->hamdocs > 0)
+        counts->hamdocs--;
+}
+
+int counts_spamdocs(counts_t *counts)
+{
+    return counts->spamdocs;
+}
+
+int counts_hamdocs(counts_t *counts)
+{
+    return counts->hamdocs;
+}
+
+set_t *counts_spamwords(counts_t *counts)
+{
+    set_t *spamwords = set_create(compare_words);
+    dfset_node_t *n;
+
+    for (n = dfset_first(counts->words); n != NULL; n = dfset_next(n)) {
+        struct dfcount *df = &n->key;
+        if (counts->spamdocs > 0 && df->spam == counts->spamdocs &&
+            df->ham == 0)
+            set_add(spamwords, df->word, df->word);
+    }
+    return spamwords;
+}
+
+void counts_save(counts_t *counts, char *filename)
+{
+    struct counts_header header;
+    dfset_node_t *n;
+    char *buf, *p, *tmpname;
+    size_t size = 0;
+    FILE *f;
+    stats_timer_t timer;
+
+    stats_start(&timer);
+    /* Serialize the live records into one buffer for checksumming */
+    memcpy(header.magic, COUNTS_MAGIC, 4);
+    header.version = COUNTS_VERSION;
+    header.numwords = 0;
+    header.spamdocs = counts->spamdocs;
+    header.hamdocs = counts->hamdocs;
+    header.reserved = 0;
+    for (n = dfset_first(counts->words); n != NULL; n = dfset_next(n)) {
+        struct dfcount *df = &n->key;
+        if (df->spam > 0 || df->ham > 0)
+            size += 2 * sizeof(uint32_t) + strlen(df->word) + 1;
+    }
+    buf = p = malloc(size + 1);
+    if (buf == NULL)
+        fatal_error("out of memory");
+    for (n = dfset_first(counts->words); n != NULL; n = dfset_next(n)) {
+        struct dfcount *df = &n->key;
+        if (df->spam == 0 && df->ham == 0)
+            continue;
+        memcpy(p, &df->spam, sizeof(uint32_t));
+        memcpy(p + sizeof(uint32_t), &df->ham, sizeof(uint32_t));
+        p += 2 * sizeof(uint32_t);
+        strcpy(p, df->word);
+        p += strlen(df->word) + 1;
+        header.numwords++;
+    }
+    header.checksum = hash_bytes(buf, size);
+
+    f = save_open(filename, &tmpname);
+    if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fwrite(buf, 1, size, f) != size) {
+        perror("fwrite");
+        fatal_error("fwrite() failed");
+    }
+    save_close(f, filename, tmpname);
+    free(buf);
+    stats_stop(&timer, STAGE_MODEL_IO);
+}
+
+counts_t *counts_load(char *filename)
+{
+    struct counts_header header;
+    counts_t *counts;
+    char *buf, *p, *end;
+    long size;
+    uint32_t i;
+    FILE *f;
+    stats_timer_t timer;
+
+    stats_start(&timer);
+    f = fopen(filename, "rb");
+    if (f == NULL) {
+        perror("fopen");
+        fatal_error("fopen() failed");
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1)
+        fatal_error("counts file is truncated");
+    if (memcmp(header.magic, COUNTS_MAGIC, 4) != 0)
+        fatal_error("not a counts file");
+    if (header.version != COUNTS_VERSION)
+        fatal_error("unsupported counts file version");
+    fseek(f, 0, SEEK_END);
+    size = ftell(f) - (long)sizeof(header);
+    fseek(f, sizeof(header), SEEK_SET);
+    buf = malloc(size + 1);
+    if (buf == NULL)
+        fatal_error("out of memory");
+    if (fread(buf, 1, size, f) != (size_t)size)
+        fatal_error("counts file is truncated");
+    fclose(f);
+    if (hash_bytes(buf, size) != header.checksum)
+        fatal_error("counts file checksum mismatch");
+    buf[size] = 0;
+
+    counts = counts_create();
+    counts->spamdocs = header.spamdocs;
+    counts->hamdocs = header.hamdocs;
+    p = buf;
+    end = buf + size;
+    for (i = 0; i < header.numwords; i++) {
+        struct dfcount *df;
+        uint32_t spam, ham;
+
+        if (end - p < (long)(2 * sizeof(uint32_t)) + 1)
+            fatal_error("counts file is corrupt");
+        memcpy(&spam, p, sizeof(uint32_t));
+        memcpy(&ham, p + sizeof(uint32_t), sizeof(uint32_t));
+        p += 2 * sizeof(uint32_t);
+        df = lookup(counts, p);
+        df->spam = spam;
+        df->ham = ham;
+        p += strlen(p) + 1;
+    }
+    if (p != end)
+        fatal_error("counts file is corrupt");
+    free(buf);
+    stats_stop(&timer, STAGE_MODEL_IO);
+    return counts;
+}
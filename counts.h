@@ -0,0 +1,68 @@
+#ifndef COUNTS_H
+#define COUNTS_H
+
+#include "common.h"
+
+/*
+ * Per-word document frequencies over a training corpus: for every word,
+ * the number of spam documents and the number of non-spam documents
+ * that contain it, along with the total number of documents of each
+ * kind.  Unlike the set algebra used by the one-shot filter, the counts
+ * can be updated one document at a time in both directions.
+ */
+struct counts;
+typedef struct counts counts_t;
+
+/*
+ * Creates new, empty document counts.
+ */
+counts_t *counts_create(void);
+
+/*
+ * Destroys the given document counts.
+ */
+void counts_destroy(counts_t *counts);
+
+/*
+ * Adds a document with the given set of (unique) words to the counts.
+ * The document is counted as spam if spam is nonzero, or as non-spam
+ * otherwise.
+ */
+void counts_add(counts_t *counts, struct set *words, int spam);
+
+/*
+ * Removes a document previously added with counts_add().  The words
+ * and the spam flag must be the same as when the document was added.
+ */
+void counts_remove(counts_t *counts, struct set *words, int spam);
+
+/*
+ * Returns the number of spam documents in the given counts.
+ */
+int counts_spamdocs(counts_t *counts);
+
+/*
+ * Returns the number of non-spam documents in the given counts.
+ */
+int counts_hamdocs(counts_t *counts);
+
+/*
+ * Returns the set of spam words: the words found in every spam document
+ * and in no non-spam document.  The words are owned by the counts, so
+ * the set must be destroyed before the counts are.
+ */
+struct set *counts_spamwords(counts_t *counts);
+
+/*
+ * Writes the given counts to the given file.
+ */
+void counts_save(counts_t *counts, char *filename);
+
+/*
+ * Reads counts previously written with counts_save().  Terminates the
+ * program if the file is not a valid counts file of the current
+ * version, or if its checksum does not match.
+ */
+counts_t *counts_load(char *filename);
+
+#endif
@@ -0,0 +1,170 @@
+#include "dedup.h"
+#include "set.h"
+#include "arena.h"
+#include "typedset.h"
+#include "hash.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define READSIZE 65536
+
+/*
+ * The digest of a file's contents.  Files are only taken to be equal if
+ * both their size and their 64-bit hash are.
+ */
+struct digest {
+    uint64_t hash;
+    uint64_t size;
+    int id;
+};
+
+#define DIGEST_CMP(c, a, b) \
+    ((a).hash != (b).hash ? TYPED_CMP_NUM(c, (a).hash, (b).hash) \
+                          : TYPED_CMP_NUM(c, (a).size, (b).size))
+
+SET_DEFINE(digestset, struct digest, DIGEST_CMP)
+
+struct dedup {
+    digestset_t *digests;
+    pthread_mutex_t lock;
+};
+
+static int enabled;
+
+/* Totals over every dedup, for the report */
+static uint64_t numfiles, numcopies, copybytes;
+
+void dedup_enable(int on)
+{
+    enabled = on;
+}
+
+int dedup_enabled(void)
+{
+    return enabled;
+}
+
+dedup_t *dedup_create(void)
+{
+    dedup_t *dedup = malloc(sizeof(dedup_t));
+
+    if (dedup == NULL)
+        fatal_error("out of memory");
+    dedup->digests = digestset_create(NULL);
+    pthread_mutex_init(&dedup->lock, NULL);
+    return dedup;
+}
+
+void dedup_destroy(dedup_t *dedup)
+{
+    digestset_destroy(dedup->digests);
+    pthread_mutex_destroy(&dedup->lock);
+    free(dedup);
+}
+
+/*
+ * Reads the given file, hashing it as it arrives.  Returns its contents
+ * if keep is nonzero, or NULL otherwise.
+ */
+static char *read_file(char *filename, int keep, struct digest *digest)
+{
+    hash_stream_t hs;
+    char *data = NULL, buf[READSIZE];
+    size_t n, len = 0, capacity = 0;
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (f == NULL) {
+        perror("fopen");
+        fatal_error("fopen() failed");
+    }
+    hash_stream_init(&hs);
+    for (;;) {
+        char *dst = buf;
+
+        if (keep) {
+            if (len + READSIZE > capacity) {
+                capacity = capacity == 0 ? READSIZE : capacity * 2;
+                data = realloc(data, capacity);
+                if (data == NULL)
+                    fatal_error("out of memory");
+            }
+            dst = data + len;
+        }
+        n = fread(dst, 1, READSIZE, f);
+        if (n == 0)
+            break;
+        hash_stream_update(&hs, dst, n);
+        len += n;
+    }
+    fclose(f);
+    digest->hash = hash_stream_final(&hs);
+    digest->size = len;
+    return data;
+}
+
+/*
+ * Records the given digest, or returns the id of the earlier file with
+ * the same digest.
+ */
+static int lookup(dedup_t *dedup, struct digest *digest)
+{
+    struct digest *found;
+    int original = -1;
+
+    pthread_mutex_lock(&dedup->lock);
+    found = digestset_find(dedup->digests, *digest);
+    if (found != NULL)
+        original = found->id;
+    else
+        digestset_add(dedup->digests, *digest);
+    pthread_mutex_unlock(&dedup->lock);
+
+    __atomic_add_fetch(&numfiles, 1, __ATOMIC_RELAXED);
+    if (original >= 0) {
+        __atomic_add_fetch(&numcopies, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&copybytes, digest->size, __ATOMIC_RELAXED);
+        stats_count(STATS_DUPLICATES, 1);
+    }
+    return original;
+}
+
+set_t *dedup_tokenize(dedup_t *dedup, char *filename, int id,
+                      arena_t *arena, int *original, bytesink_t tap,
+                      void *taparg)
+{
+    struct digest digest;
+    char *data = read_file(filename, 1, &digest);
+    set_t *words = NULL;
+
+    digest.id = id;
+    *original = lookup(dedup, &digest);
+    if (*original < 0) {
+        words = tokenize_buffer(data, digest.size, arena);
+        if (tap != NULL)
+            tap(taparg, data, digest.size);
+    }
+    free(data);
+    return words;
+}
+
+int dedup_check(dedup_t *dedup, char *filename, int id)
+{
+    struct digest digest;
+
+    read_file(filename, 0, &digest);
+    digest.id = id;
+    return lookup(dedup, &digest);
+}
+
+void dedup_report(FILE *out)
+{
+    fprintf(out, "dedup: %llu of %llu file(s) were copies, "
+            "%llu byte(s) not tokenized\n",
+            (unsigned long long)numcopies, (unsigned long long)numfiles,
+            (unsigned long long)copybytes);
+}
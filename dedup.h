@@ -0,0 +1,68 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "common.h"
+
+/*
+ * Deduplication of identical files.  A dedup remembers a digest of the
+ * contents of every file it has seen, hashed as the file is read, along
+ * with an id chosen by the caller.  A file whose contents match an
+ * earlier one is reported as a copy of it, so that the caller can reuse
+ * the work done on the original instead of tokenizing it again.
+ *
+ * Deduplication is off unless enabled with dedup_enable().  The callers
+ * that support it check dedup_enabled() and keep one dedup per group of
+ * files within which copies may be skipped, such as one training corpus.
+ */
+struct dedup;
+typedef struct dedup dedup_t;
+
+/*
+ * Turns deduplication on or off for the whole program.  Set before
+ * starting any threads.
+ */
+void dedup_enable(int on);
+
+/*
+ * Returns 1 if deduplication is on, 0 otherwise.
+ */
+int dedup_enabled(void);
+
+/*
+ * Creates a new dedup that has seen no files.
+ */
+dedup_t *dedup_create(void);
+
+/*
+ * Destroys the given dedup.
+ */
+void dedup_destroy(dedup_t *dedup);
+
+/*
+ * Reads the given file, hashing its contents on the way.  If the dedup
+ * has already seen a file with the same contents, stores the id of that
+ * file in *original and returns NULL.  Otherwise, records the file under
+ * the given id and returns its set of (unique) words, allocated from the
+ * given arena as with tokenize(), and passes the contents to tap as
+ * tokenize_tap() does, unless tap is NULL.  Bypasses the token cache,
+ * as the contents are already in memory.  Safe to call from several
+ * threads.
+ */
+struct set *dedup_tokenize(dedup_t *dedup, char *filename, int id,
+                           struct arena *arena, int *original,
+                           bytesink_t tap, void *taparg);
+
+/*
+ * Like dedup_tokenize(), but only hashes the file: returns the id of an
+ * earlier file with the same contents, or -1 after recording the file
+ * under the given id.
+ */
+int dedup_check(dedup_t *dedup, char *filename, int id);
+
+/*
+ * Prints how many of the files seen by any dedup were copies, and how
+ * many bytes were not tokenized as a result.
+ */
+void dedup_report(FILE *out);
+
+#endif
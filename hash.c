@@ -0,0 +1,161 @@
+#include "hash.h"
+
+#include <ctype.h>
+#include <string.h>
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+uint64_t hash_bytes(const void *data, size_t len)
+{
+    return hash_bytes_more(FNV_OFFSET, data, len);
+}
+
+uint64_t hash_bytes_more(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint64_t h = hash;
+
+    while (len-- > 0) {
+        h ^= *p++;
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+uint64_t hash_word(const char *word)
+{
+    const unsigned char *p = (const unsigned char *)word;
+    uint64_t h = FNV_OFFSET;
+
+    while (*p != 0) {
+        h ^= tolower(*p++);
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/*
+ * The streaming hash is XXH64 with a seed of zero: four independent
+ * lanes consume 32 bytes per round, which keeps it several times faster
+ * than FNV-1a on whole files.
+ */
+#define P1 11400714785074694791ULL
+#define P2 14029467366897019727ULL
+#define P3 1609587929392839161ULL
+#define P4 9650029242287828579ULL
+#define P5 2870177450012600261ULL
+
+static uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input)
+{
+    acc += input * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+}
+
+static uint64_t merge64(uint64_t h, uint64_t v)
+{
+    h ^= round64(0, v);
+    return h * P1 + P4;
+}
+
+void hash_stream_init(hash_stream_t *hs)
+{
+    hs->v[0] = P1 + P2;
+    hs->v[1] = P2;
+    hs->v[2] = 0;
+    hs->v[3] = -P1;
+    hs->total = 0;
+    hs->buflen = 0;
+}
+
+static void consume(hash_stream_t *hs, const unsigned char *p)
+{
+    hs->v[0] = round64(hs->v[0], read64(p));
+    hs->v[1] = round64(hs->v[1], read64(p + 8));
+    hs->v[2] = round64(hs->v[2], read64(p + 16));
+    hs->v[3] = round64(hs->v[3], read64(p + 24));
+}
+
+void hash_stream_update(hash_stream_t *hs, const void *data, size_t len)
+{
+    const unsigned char *p = data, *end = p + len;
+
+    hs->total += len;
+    if (hs->buflen > 0) {
+        size_t n = 32 - hs->buflen;
+        if (n > len)
+            n = len;
+        memcpy(hs->buf + hs->buflen, p, n);
+        hs->buflen += n;
+        p += n;
+        if (hs->buflen < 32)
+            return;
+        consume(hs, hs->buf);
+        hs->buflen = 0;
+    }
+    while (end - p >= 32) {
+        consume(hs, p);
+        p += 32;
+    }
+    memcpy(hs->buf, p, end - p);
+    hs->buflen = end - p;
+}
+
+uint64_t hash_stream_final(hash_stream_t *hs)
+{
+    const unsigned char *p = hs->buf, *end = p + hs->buflen;
+    uint64_t h;
+
+    if (hs->total >= 32) {
+        h = rotl(hs->v[0], 1) + rotl(hs->v[1], 7) + rotl(hs->v[2], 12) +
+            rotl(hs->v[3], 18);
+        h = merge64(h, hs->v[0]);
+        h = merge64(h, hs->v[1]);
+        h = merge64(h, hs->v[2]);
+        h = merge64(h, hs->v[3]);
+    }
+    else {
+        h = P5;
+    }
+    h += hs->total;
+    while (end - p >= 8) {
+        h ^= round64(0, read64(p));
+        h = rotl(h, 27) * P1 + P4;
+        p += 8;
+    }
+    if (end - p >= 4) {
+        h ^= read32(p) * P1;
+        h = rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= *p++ * P5;
+        h = rotl(h, 11) * P1;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,43 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Returns the 64-bit FNV-1a hash of the given bytes.
+ */
+uint64_t hash_bytes(const void *data, size_t len);
+
+/*
+ * Continues the given hash_bytes() hash over more bytes, so that data
+ * can be hashed in pieces: hash_bytes_more(hash_bytes(a), b) is the
+ * hash of a followed by b.
+ */
+uint64_t hash_bytes_more(uint64_t hash, const void *data, size_t len);
+
+/*
+ * Returns the 64-bit FNV-1a hash of the given word, with ASCII letters
+ * folded to lower case.  Words that compare equal with compare_words()
+ * hash to the same value.
+ */
+uint64_t hash_word(const char *word);
+
+/*
+ * A 64-bit hash computed over data that arrives in pieces, such as the
+ * contents of a file as it is read.  The result does not depend on how
+ * the data is split.  It is fast enough to run alongside reading, but
+ * is not the same function as hash_bytes().
+ */
+typedef struct hash_stream {
+    uint64_t v[4];
+    uint64_t total;
+    unsigned char buf[32];
+    size_t buflen;
+} hash_stream_t;
+
+void hash_stream_init(hash_stream_t *hs);
+void hash_stream_update(hash_stream_t *hs, const void *data, size_t len);
+uint64_t hash_stream_final(hash_stream_t *hs);
+
+#endif
@@ -1,7 +1,12 @@
 #include "list.h"
+#include "stats.h"
+#include "alloc.h"
 
 #include <stdlib.h>
 
+/* Calls the given comparison function, counting the call */
+#define COMPARE(cmpfunc, a, b) (stats_count(STATS_COMPARES, 1), (cmpfunc)(a, b))
+
 struct listnode;
 
 typedef struct listnode listnode_t;
@@ -17,17 +22,18 @@ struct list {
     listnode_t *tail;
     int size;
     cmpfunc_t cmpfunc;
+    allocator_t *alloc;
+    alloc_stats_t mem;      /* The list itself and its nodes */
 };
 
 struct list_iter {
     listnode_t *node;
 };
 
-static listnode_t *newnode(void *elem)
+static listnode_t *newnode(list_t *list, void *elem)
 {
-    listnode_t *node = malloc(sizeof(listnode_t));
-    if (node == NULL)
-	    fatal_error("out of memory");
+    listnode_t *node = alloc_get(list->alloc, sizeof(listnode_t), &list->mem);
+    stats_count(STATS_NODE_ALLOCS, 1);
     node->next = NULL;
     node->prev = NULL;
     node->elem = elem;
@@ -36,25 +42,40 @@ static listnode_t *newnode(void *elem)
 
 list_t *list_create(cmpfunc_t cmpfunc)
 {
-    list_t *list = malloc(sizeof(list_t));
-    if (list == NULL)
-	    fatal_error("out of memory");
+    return list_create_alloc(cmpfunc, alloc_default());
+}
+
+list_t *list_create_alloc(cmpfunc_t cmpfunc, allocator_t *alloc)
+{
+    alloc_stats_t mem = { 0 };
+    list_t *list = alloc_get(alloc, sizeof(list_t), &mem);
+
     list->head = NULL;
     list->tail = NULL;
     list->size = 0;
     list->cmpfunc = cmpfunc;
+    list->alloc = alloc;
+    list->mem = mem;
     return list;
 }
 
 void list_destroy(list_t *list)
 {
     listnode_t *node = list->head;
+    alloc_stats_t mem;
+
     while (node != NULL) {
 	    listnode_t *tmp = node;
 	    node = node->next;
-	    free(tmp);
+	    alloc_put(list->alloc, tmp, sizeof(listnode_t), &list->mem);
     }
-    free(list);
+    mem = list->mem;
+    alloc_put(list->alloc, list, sizeof(list_t), &mem);
+}
+
+void list_memstats(list_t *list, alloc_stats_t *stats)
+{
+    *stats = list->mem;
 }
 
 int list_size(list_t *list)
@@ -64,7 +85,7 @@ int list_size(list_t *list)
 
 void list_addfirst(list_t *list, void *elem)
 {
-    listnode_t *node = newnode(elem);
+    listnode_t *node = newnode(list, elem);
     if (list->head == NULL) {
 	    list->head = list->tail = node;
     }
@@ -78,7 +99,7 @@ void list_addfirst(list_t *list, void *elem)
 
 void list_addlast(list_t *list, void *elem)
 {
-    listnode_t *node = newnode(elem);
+    listnode_t *node = newnode(list, elem);
     if (list->head == NULL) {
 	    list->head = list->tail = node;
     }
@@ -106,7 +127,7 @@ void *list_popfirst(list_t *list)
 	        list->head->prev = NULL;
 	    }
 	    list->size--;
-	    free(tmp);
+	    alloc_put(list->alloc, tmp, sizeof(listnode_t), &list->mem);
 	    return elem;
     }
 }
@@ -126,7 +147,7 @@ void *list_poplast(list_t *list)
 	    else {
 	        list->tail->next = NULL;
 	    }
-	    free(tmp);
+	    alloc_put(list->alloc, tmp, sizeof(listnode_t), &list->mem);
 	    list->size--;
 	    return elem;
     }
@@ -136,7 +157,7 @@ int list_contains(list_t *list, void *elem)
 {
     listnode_t *node = list->head;
     while (node != NULL) {
-	    if (list->cmpfunc(elem, node->elem) == 0)
+	    if (COMPARE(list->cmpfunc, elem, node->elem) == 0)
 	        return 1;
 	    node = node->next;
     }
@@ -153,7 +174,7 @@ static listnode_t *merge(listnode_t *a, listnode_t *b, cmpfunc_t cmpfunc)
 	listnode_t *head, *tail;
 	
 	/* Pick the smallest head node */
-	if (cmpfunc(a->elem, b->elem) < 0) {
+	if (COMPARE(cmpfunc, a->elem, b->elem) < 0) {
 		head = tail = a;
 		a = a->next;
 	}
@@ -163,7 +184,7 @@ static listnode_t *merge(listnode_t *a, listnode_t *b, cmpfunc_t cmpfunc)
 	}
 	/* Now repeatedly pick the smallest head node */
 	while (a != NULL && b != NULL) {
-		if (cmpfunc(a->elem, b->elem) < 0) {
+		if (COMPARE(cmpfunc, a->elem, b->elem) < 0) {
 			tail->next = a;
 			tail = a;
 			a = a->next;
@@ -258,7 +279,7 @@ static void list_selection_sort(list_t *list)
     for (i = list->head; i != NULL; i = i->next) {
 	    min = i;
 	    for (j = i->next; j != NULL; j = j->next) {
-	        if (list->cmpfunc(j->elem, min->elem) < 0)
+	        if (COMPARE(list->cmpfunc, j->elem, min->elem) < 0)
 		        min = j;
 	    }
 	    if (min != i) {
@@ -271,16 +292,16 @@ static void list_selection_sort(list_t *list)
 
 list_iter_t *list_createiter(list_t *list)
 {
-    list_iter_t *iter = malloc(sizeof(list_iter_t));
-    if (iter == NULL)
-	    fatal_error("out of memory");
+    /* Iterators only read the list, which may be shared between threads,
+     * so they come from the heap rather than from its allocator */
+    list_iter_t *iter = alloc_get(alloc_default(), sizeof(list_iter_t), NULL);
     iter->node = list->head;
     return iter;
 }
 
 void list_destroyiter(list_iter_t *iter)
 {
-    free(iter);
+    alloc_put(alloc_default(), iter, sizeof(list_iter_t), NULL);
 }
 
 int list_hasnext(list_iter_t *iter)
@@ -3,6 +3,9 @@
 
 #include "common.h"
 
+struct allocator;
+struct alloc_stats;
+
 /*
  * The type of lists.
  */
@@ -19,6 +22,21 @@ typedef struct list list_t;
  */
 list_t *list_create(cmpfunc_t cmpfunc);
 
+/*
+ * Creates a new, empty list like list_create(), that takes its memory,
+ * and that of its nodes, from the given allocator.  Its iterators still
+ * come from alloc_default().  A list with an allocator of its own must
+ * not be used from several threads at once.
+ */
+list_t *list_create_alloc(cmpfunc_t cmpfunc, struct allocator *alloc);
+
+/*
+ * Stores the memory statistics of the given list in stats: the bytes
+ * taken by the list and its nodes, and the number of allocations and
+ * frees made for them.
+ */
+void list_memstats(list_t *list, struct alloc_stats *stats);
+
 /*
  * Destroys the given list.  Subsequently accessing the list
  * will lead to undefined behavior.
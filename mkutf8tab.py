@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+#
+# Generates utf8tab.h, the Unicode tables of utf8.c, from the Unicode
+# database that comes with Python.  Run 'make utf8tab' to regenerate.
+#
+# Every code point below LIMIT gets a class of two bits:
+#
+#   0  separator
+#   1  word character: letters, combining marks and decimal digits, as
+#      well as ' and _ like the ASCII tokenizer
+#   2  a word on its own: CJK ideographs and kana, which are written
+#      without spaces between words
+#
+# The classes are packed four to a byte in blocks of BLOCK code points,
+# identical blocks are stored once, and a first-stage table maps each
+# block of code points to its stored block.
+#
+# Simple case folding is kept as runs of code points that fold by the
+# same delta, either all of them or every other one.
+
+import sys
+import unicodedata
+
+LIMIT = 0x40000
+BLOCK = 128
+
+WORD_CATEGORIES = {'Lu', 'Ll', 'Lt', 'Lm', 'Lo', 'Mn', 'Mc', 'Nd'}
+SOLO_PREFIXES = ('CJK UNIFIED IDEOGRAPH', 'CJK COMPATIBILITY IDEOGRAPH',
+                 'HIRAGANA LETTER', 'KATAKANA LETTER')
+
+
+def char_class(cp):
+    if cp < 0x80:
+        c = chr(cp)
+        return 1 if c.isascii() and (c.isalnum() or c in "'_") else 0
+    if 0xD800 <= cp <= 0xDFFF:
+        return 0
+    c = chr(cp)
+    if unicodedata.category(c) not in WORD_CATEGORIES:
+        return 0
+    if unicodedata.name(c, '').startswith(SOLO_PREFIXES):
+        return 2
+    return 1
+
+
+def simple_fold(cp):
+    c = chr(cp)
+    for f in (c.casefold(), c.lower()):
+        if len(f) == 1:
+            return ord(f)
+    return cp
+
+
+def fold_runs(classes):
+    folds = [(cp, simple_fold(cp) - cp) for cp in range(LIMIT)
+             if classes[cp] and simple_fold(cp) != cp]
+    runs = []
+    for cp, delta in folds:
+        if runs:
+            first, last, d, stride = runs[-1]
+            if d == delta and (cp - last == stride or
+                               (first == last and cp - last in (1, 2))):
+                runs[-1] = (first, cp, d, cp - last)
+                continue
+        runs.append((cp, cp, delta, 1))
+    return runs
+
+
+def main():
+    classes = [char_class(cp) for cp in range(LIMIT)]
+    blocks, index = [], {}
+    stage1 = []
+    for start in range(0, LIMIT, BLOCK):
+        packed = bytearray(BLOCK // 4)
+        for i in range(BLOCK):
+            packed[i // 4] |= classes[start + i] << (2 * (i % 4))
+        packed = bytes(packed)
+        if packed not in index:
+            index[packed] = len(blocks)
+            blocks.append(packed)
+        stage1.append(index[packed])
+    if len(blocks) > 256:
+        sys.exit('too many distinct blocks')
+
+    ascii_fold = [simple_fold(cp) if classes[cp] else 0 for cp in range(0x80)]
+    runs = fold_runs(classes)
+
+    out = sys.stdout
+    out.write('/*\n'
+              ' * Generated by mkutf8tab.py from Unicode %s.  Do not edit.\n'
+              ' */\n\n' % unicodedata.unidata_version)
+    out.write('#define UTF8TAB_LIMIT 0x%x\n' % LIMIT)
+    out.write('#define UTF8TAB_BLOCK %d\n\n' % BLOCK)
+
+    out.write('/* The folded character of each ASCII word character, else 0 */\n')
+    out.write('const unsigned char utf8_ascii[128] = {\n')
+    for i in range(0, 128, 16):
+        out.write('    ' + ', '.join('%d' % v for v in ascii_fold[i:i + 16]) +
+                  ',\n')
+    out.write('};\n\n')
+
+    out.write('static const unsigned char utf8tab_stage1[%d] = {\n' % len(stage1))
+    for i in range(0, len(stage1), 16):
+        out.write('    ' + ', '.join('%d' % v for v in stage1[i:i + 16]) +
+                  ',\n')
+    out.write('};\n\n')
+
+    out.write('static const unsigned char utf8tab_blocks[%d][%d] = {\n' %
+              (len(blocks), BLOCK // 4))
+    for b in blocks:
+        out.write('    {')
+        for i in range(0, len(b), 16):
+            out.write('\n        ' +
+                      ', '.join('0x%02x' % v for v in b[i:i + 16]) + ',')
+        out.write('\n    },\n')
+    out.write('};\n\n')
+
+    out.write('static const struct utf8tab_fold {\n'
+              '    uint32_t first;\n'
+              '    uint32_t last;\n'
+              '    int32_t delta;\n'
+              '    uint32_t stride;\n'
+              '} utf8tab_folds[%d] = {\n' % len(runs))
+    for first, last, delta, stride in runs:
+        out.write('    { 0x%05x, 0x%05x, %d, %d },\n' %
+                  (first, last, delta, stride))
+    out.write('};\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,361 @@
+#include "model.h"
+#include "set.h"
+#include "hash.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MODEL_MAGIC   "SPFM"
+#define MODEL_VERSION 1
+
+/*
+ * On-disk (and in-memory) layout of a model:
+ *
+ *   struct model_header
+ *   uint32_t slots[numslots]   hash index; strtab offset + 1, 0 if empty
+ *   char strtab[strtabsize]    NUL-terminated words, in set order
+ *
+ * The checksum covers everything after the header.
+ */
+struct model_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t numwords;
+    uint32_t numslots;
+    uint32_t strtabsize;
+    uint32_t reserved;
+    uint64_t checksum;
+};
+
+struct model {
+    void *image;
+    size_t imagesize;
+    int mapped;
+    struct model_header *header;
+    uint32_t *slots;
+    char *strtab;
+};
+
+/*
+ * Points the section pointers of the model at its image.
+ */
+static void model_setup(model_t *model)
+{
+    model->header = model->image;
+    model->slots = (uint32_t *)(model->header + 1);
+    model->strtab = (char *)(model->slots + model->header->numslots);
+}
+
+model_t *model_create(set_t *words)
+{
+    model_t *model;
+    struct model_header *header;
+    set_iter_t *iter;
+    uint32_t numslots, strtabsize, offset;
+    char *word;
+
+    model = malloc(sizeof(model_t));
+    if (model == NULL)
+        fatal_error("out of memory");
+
+    /* Size the string table and a hash index at most half full */
+    strtabsize = 0;
+    iter = set_createiter(words);
+    while (set_hasnext(iter))
+        strtabsize += strlen(set_next(iter)) + 1;
+    set_destroyiter(iter);
+    numslots = 8;
+    while (numslots < 2 * (uint32_t)set_size(words))
+        numslots *= 2;
+
+    model->imagesize = sizeof(struct model_header) +
+        sizeof(uint32_t) * numslots + strtabsize;
+    model->image = calloc(1, model->imagesize);
+    if (model->image == NULL)
+        fatal_error("out of memory");
+    model->mapped = 0;
+
+    header = model->image;
+    memcpy(header->magic, MODEL_MAGIC, 4);
+    header->version = MODEL_VERSION;
+    header->numwords = set_size(words);
+    header->numslots = numslots;
+    header->strtabsize = strtabsize;
+    model_setup(model);
+
+    /* Copy the words and index them with linear probing */
+    offset = 0;
+    iter = set_createiter(words);
+    while (set_hasnext(iter)) {
+        uint32_t slot;
+
+        word = set_next(iter);
+        slot = hash_word(word) & (numslots - 1);
+        while (model->slots[slot] != 0)
+            slot = (slot + 1) & (numslots - 1);
+        model->slots[slot] = offset + 1;
+        strcpy(model->strtab + offset, word);
+        offset += strlen(word) + 1;
+    }
+    set_destroyiter(iter);
+
+    header->checksum = hash_bytes(model->slots,
+        model->imagesize - sizeof(struct model_header));
+    return model;
+}
+
+void model_save(model_t *model, char *filename)
+{
+    char *tmpname;
+    FILE *f;
+    stats_timer_t timer;
+
+    stats_start(&timer);
+    f = save_open(filename, &tmpname);
+    if (fwrite(model->image, 1, model->imagesize, f) != model->imagesize) {
+        perror("fwrite");
+        fatal_error("fwrite() failed");
+    }
+    save_close(f, filename, tmpname);
+    stats_stop(&timer, STAGE_MODEL_IO);
+}
+
+/*
+ * Returns 1 if the index and string table of the given model are
+ * consistent, 0 otherwise.  The checksum only catches damage, not a
+ * file built wrong, and lookups trust every offset in the index and
+ * stop only at an empty slot.
+ */
+static int model_valid(model_t *model)
+{
+    struct model_header *header = model->header;
+    uint32_t i, used = 0, offset;
+
+    if (header->numwords >= header->numslots)
+        return 0;
+    if (header->strtabsize > 0 && model->strtab[header->strtabsize - 1] != 0)
+        return 0;
+    for (i = 0; i < header->numslots; i++) {
+        if (model->slots[i] == 0)
+            continue;
+        /* Each offset must start a word of the string table */
+        offset = model->slots[i] - 1;
+        if (offset >= header->strtabsize ||
+            (offset > 0 && model->strtab[offset - 1] != 0))
+            return 0;
+        used++;
+    }
+    return used == header->numwords;
+}
+
+model_t *model_load(char *filename)
+{
+    model_t *model;
+    struct model_header *header;
+    struct stat st;
+    size_t expected;
+    int fd;
+    stats_timer_t timer;
+
+    stats_start(&timer);
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("open");
+        fatal_error("open() failed");
+    }
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        fatal_error("fstat() failed");
+    }
+    if ((size_t)st.st_size < sizeof(struct model_header))
+        fatal_error("model file is truncated");
+
+    model = malloc(sizeof(model_t));
+    if (model == NULL)
+        fatal_error("out of memory");
+    model->imagesize = st.st_size;
+    model->image = mmap(NULL, model->imagesize, PROT_READ, MAP_SHARED, fd, 0);
+    if (model->image == MAP_FAILED) {
+        perror("mmap");
+        fatal_error("mmap() failed");
+    }
+    close(fd);
+    model->mapped = 1;
+
+    header = model->image;
+    if (memcmp(header->magic, MODEL_MAGIC, 4) != 0)
+        fatal_error("not a model file");
+    if (header->version != MODEL_VERSION)
+        fatal_error("unsupported model file version");
+    if (header->numslots == 0 ||
+        (header->numslots & (header->numslots - 1)) != 0)
+        fatal_error("model file is corrupt");
+    expected = sizeof(struct model_header) +
+        sizeof(uint32_t) * (size_t)header->numslots + header->strtabsize;
+    if (expected != model->imagesize)
+        fatal_error("model file is truncated");
+    model_setup(model);
+    if (hash_bytes(model->slots,
+            model->imagesize - sizeof(struct model_header)) != header->checksum)
+        fatal_error("model file checksum mismatch");
+    if (!model_valid(model))
+        fatal_error("model file is corrupt");
+    stats_stop(&timer, STAGE_MODEL_IO);
+    return model;
+}
+
+void model_destroy(model_t *model)
+{
+    if (model->mapped)
+        munmap(model->image, model->imagesize);
+    else
+        free(model->image);
+    free(model);
+}
+
+int model_size(model_t *model)
+{
+    return model->header->numwords;
+}
+
+int model_contains(model_t *model, char *word)
+{
+    uint32_t mask = model->header->numslots - 1;
+    uint32_t slot = hash_word(word) & mask;
+
+    while (model->slots[slot] != 0) {
+        if (strcasecmp(model->strtab + model->slots[slot] - 1, word) == 0)
+            return 1;
+        slot = (slot + 1) & mask;
+    }
+    return 0;
+}
+
+int model_score(void *model, set_t *words)
+{
+    set_iter_t *iter;
+    int count = 0;
+
+    iter = set_createiter(words);
+    while (set_hasnext(iter)) {
+        if (model_contains(model, set_next(iter)))
+            count++;
+    }
+    set_destroyiter(iter);
+    return count;
+}
+
+/*
+ * The model set is a hash table with linear probing over the words of
+ * all its models.  Each word is stored once, pointing into the string
+ * table of the first model that holds it, with a bit for each model.
+ */
+struct modelset_entry {
+    const char *word;       /* NULL if the slot is empty */
+    uint64_t hash;
+    uint64_t models;
+};
+
+struct modelset {
+    struct modelset_entry *slots;
+    uint64_t mask;          /* Number of slots - 1 */
+    int nmodels;
+};
+
+modelset_t *modelset_create(model_t **models, int nmodels)
+{
+    modelset_t *set;
+    uint64_t total = 0, numslots = 8;
+    int i;
+
+    if (nmodels < 1 || nmodels > MODELSET_MAX)
+        fatal_error("too many models");
+    for (i = 0; i < nmodels; i++)
+        total += model_size(models[i]);
+    while (numslots < 2 * total)
+        numslots *= 2;
+
+    set = malloc(sizeof(modelset_t));
+    if (set == NULL)
+        fatal_error("out of memory");
+    set->slots = calloc(numslots, sizeof(struct modelset_entry));
+    if (set->slots == NULL)
+        fatal_error("out of memory");
+    set->mask = numslots - 1;
+    set->nmodels = nmodels;
+
+    for (i = 0; i < nmodels; i++) {
+        char *word = models[i]->strtab;
+        char *end = word + models[i]->header->strtabsize;
+
+        for (; word < end; word += strlen(word) + 1) {
+            uint64_t hash = hash_word(word), slot = hash & set->mask;
+            struct modelset_entry *e = &set->slots[slot];
+
+            while (e->word != NULL &&
+                   (e->hash != hash || strcasecmp(e->word, word) != 0)) {
+                slot = (slot + 1) & set->mask;
+                e = &set->slots[slot];
+            }
+            if (e->word == NULL) {
+                e->word = word;
+                e->hash = hash;
+            }
+            e->models |= (uint64_t)1 << i;
+        }
+    }
+    return set;
+}
+
+void modelset_destroy(modelset_t *models)
+{
+    free(models->slots);
+    free(models);
+}
+
+int modelset_count(modelset_t *models)
+{
+    return models->nmodels;
+}
+
+/* Returns the bitmask of the models holding the given word */
+static uint64_t modelset_lookup(modelset_t *models, const char *word)
+{
+    uint64_t hash = hash_word(word), slot = hash & models->mask;
+    struct modelset_entry *e = &models->slots[slot];
+
+    while (e->word != NULL) {
+        if (e->hash == hash && strcasecmp(e->word, word) == 0)
+            return e->models;
+        slot = (slot + 1) & models->mask;
+        e = &models->slots[slot];
+    }
+    return 0;
+}
+
+void modelset_score(void *models, set_t *words, int *counts)
+{
+    modelset_t *set = models;
+    set_iter_t *iter;
+    uint64_t bits;
+
+    memset(counts, 0, sizeof(int) * set->nmodels);
+    iter = set_createiter(words);
+    while (set_hasnext(iter)) {
+        /* Only the models that hold the word are visited */
+        bits = modelset_lookup(set, set_next(iter));
+        while (bits != 0) {
+            counts[__builtin_ctzll(bits)]++;
+            bits &= bits - 1;
+        }
+    }
+    set_destroyiter(iter);
+}
@@ -0,0 +1,89 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include "common.h"
+
+/*
+ * A model is a trained, read-only set of spam words laid out as a flat
+ * image: a header, a hash index and a string table.  The same image is
+ * used in memory and on disk, so a saved model can be mapped straight
+ * into memory and used without any parsing.
+ */
+struct model;
+typedef struct model model_t;
+
+/*
+ * Creates a new in-memory model holding the words of the given set.
+ */
+model_t *model_create(struct set *words);
+
+/*
+ * Writes the given model to the given file, replacing it with one
+ * rename() so that processes that have it mapped keep the old model.
+ */
+void model_save(model_t *model, char *filename);
+
+/*
+ * Maps the model stored in the given file read-only into memory.
+ * Terminates the program if the file is not a valid model of the
+ * current version, if its checksum does not match, or if its index
+ * points outside its words.
+ */
+model_t *model_load(char *filename);
+
+/*
+ * Destroys the given model, unmapping it if it was loaded from a file.
+ */
+void model_destroy(model_t *model);
+
+/*
+ * Returns the number of words in the given model.
+ */
+int model_size(model_t *model);
+
+/*
+ * Returns 1 if the given word is in the given model, 0 otherwise.
+ * Words are compared case-insensitively.
+ */
+int model_contains(model_t *model, char *word);
+
+/*
+ * Returns the number of words in the given set that are in the given
+ * model.  Suitable for use as a scoring function with classify_files().
+ */
+int model_score(void *model, struct set *words);
+
+/*
+ * A model set combines several models into one index that maps each
+ * word to the bitmask of the models holding it, so that a set of words
+ * can be scored against all of them with one lookup per word.
+ */
+struct modelset;
+typedef struct modelset modelset_t;
+
+#define MODELSET_MAX 64     /* Models per set, one bit each */
+
+/*
+ * Creates a set of the given models, numbered in the given order.  The
+ * models must outlive the set, which refers to their words.
+ */
+modelset_t *modelset_create(model_t **models, int nmodels);
+
+/*
+ * Destroys the given model set, but not its models.
+ */
+void modelset_destroy(modelset_t *models);
+
+/*
+ * Returns the number of models in the given set.
+ */
+int modelset_count(modelset_t *models);
+
+/*
+ * Stores in counts[i] the number of words in the given set that are in
+ * model i of the given model set.  Suitable for use as a scoring
+ * function with classify_files_multi().
+ */
+void modelset_score(void *models, struct set *words, int *counts);
+
+#endif
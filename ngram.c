@@ -0,0 +1,548 @@
+#include "ngram.h"
+#include "list.h"
+#include "hash.h"
+#include "stats.h"
+#include "utf8.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GRAMS_MAGIC   "SPFG"
+#define GRAMS_VERSION 1
+
+#define MAXWORD  100       /* As in common.c */
+#define READSIZE 65536
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME  1099511628211ULL
+
+/*
+ * A hash table with linear probing, kept at most half full.  Zero marks
+ * an empty slot, so a phrase that hashes to zero is stored as one.
+ */
+struct gramset {
+    uint64_t *slots;
+    size_t mask;
+    int size;
+};
+
+/*
+ * A hash table of phrases and the bitmasks of the sets holding them,
+ * with linear probing and kept at most half full like a gramset.
+ */
+struct gramindex_entry {
+    uint64_t hash;      /* 0 if the slot is empty */
+    uint64_t sets;
+};
+
+struct gramindex {
+    struct gramindex_entry *slots;
+    size_t mask;
+    int numsets;
+};
+
+/*
+ * On-disk layout of a phrase file:
+ *
+ *   struct grams_header
+ *   numgrams uint64_t phrase hashes
+ *
+ * The checksum covers the hashes.
+ */
+struct grams_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t order;
+    uint32_t numgrams;
+    uint64_t checksum;
+};
+
+struct ngram {
+    int order;
+    uint64_t word;                 /* Hash of the word being scanned */
+    int wordlen;                   /* Its length in bytes */
+    utf8_decoder_t utf8;
+    uint64_t prev[NGRAM_MAXORDER]; /* Hashes of the last words, newest first */
+    int numprev;
+    gramset_t *grams;
+};
+
+static uint64_t *newslots(size_t n)
+{
+    uint64_t *slots = calloc(n, sizeof(uint64_t));
+    if (slots == NULL)
+        fatal_error("out of memory");
+    return slots;
+}
+
+gramset_t *gramset_create(void)
+{
+    gramset_t *set = malloc(sizeof(gramset_t));
+
+    if (set == NULL)
+        fatal_error("out of memory");
+    set->mask = 63;
+    set->slots = newslots(set->mask + 1);
+    set->size = 0;
+    return set;
+}
+
+void gramset_destroy(gramset_t *set)
+{
+    free(set->slots);
+    free(set);
+}
+
+int gramset_size(gramset_t *set)
+{
+    return set->size;
+}
+
+static uint64_t *slot_of(gramset_t *set, uint64_t hash)
+{
+    size_t i = hash & set->mask;
+
+    while (set->slots[i] != 0 && set->slots[i] != hash)
+        i = (i + 1) & set->mask;
+    return &set->slots[i];
+}
+
+static void grow(gramset_t *set)
+{
+    uint64_t *old = set->slots;
+    size_t i, n = set->mask + 1;
+
+    set->mask = 2 * n - 1;
+    set->slots = newslots(2 * n);
+    for (i = 0; i < n; i++) {
+        if (old[i] != 0)
+            *slot_of(set, old[i]) = old[i];
+    }
+    free(old);
+}
+
+int gramset_add(gramset_t *set, uint64_t hash)
+{
+    uint64_t *slot;
+
+    if (hash == 0)
+        hash = 1;
+    slot = slot_of(set, hash);
+    if (*slot != 0)
+        return 0;
+    *slot = hash;
+    if (++set->size > (int)(set->mask / 2))
+        grow(set);
+    return 1;
+}
+
+int gramset_contains(gramset_t *set, uint64_t hash)
+{
+    if (hash == 0)
+        hash = 1;
+    return *slot_of(set, hash) != 0;
+}
+
+/*
+ * Keeps the hashes of set whose presence in other is as given, by
+ * rehashing them into a table of their own.
+ */
+static void filter(gramset_t *set, gramset_t *other, int present)
+{
+    uint64_t *old = set->slots;
+    size_t i, n = set->mask + 1;
+
+    set->slots = newslots(n);
+    set->size = 0;
+    for (i = 0; i < n; i++) {
+        if (old[i] != 0 && gramset_contains(other, old[i]) == present) {
+            *slot_of(set, old[i]) = old[i];
+            set->size++;
+        }
+    }
+    free(old);
+}
+
+void gramset_retain(gramset_t *set, gramset_t *other)
+{
+    filter(set, other, 1);
+}
+
+void gramset_discard(gramset_t *set, gramset_t *other)
+{
+    filter(set, other, 0);
+}
+
+int gramset_common(gramset_t *a, gramset_t *b)
+{
+    size_t i;
+    int count = 0;
+
+    /* Probe the larger table with the keys of the smaller one */
+    if (a->size > b->size) {
+        gramset_t *t = a;
+        a = b;
+        b = t;
+    }
+    for (i = 0; i <= a->mask; i++) {
+        if (a->slots[i] != 0 && *slot_of(b, a->slots[i]) != 0)
+            count++;
+    }
+    return count;
+}
+
+void gramset_save(gramset_t *set, int order, char *filename)
+{
+    struct grams_header header;
+    uint64_t *buf;
+    char *tmpname;
+    size_t i, n = 0;
+    FILE *f;
+    stats_timer_t timer;
+
+    stats_start(&timer);
+    buf = malloc(sizeof(uint64_t) * (set->size + 1));
+    if (buf == NULL)
+        fatal_error("out of memory");
+    for (i = 0; i <= set->mask; i++) {
+        if (set->slots[i] != 0)
+            buf[n++] = set->slots[i];
+    }
+    memcpy(header.magic, GRAMS_MAGIC, 4);
+    header.version = GRAMS_VERSION;
+    header.order = order;
+    header.numgrams = n;
+    header.checksum = hash_bytes(buf, n * sizeof(uint64_t));
+
+    f = save_open(filename, &tmpname);
+    if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+        fwrite(buf, sizeof(uint64_t), n, f) != n) {
+        perror("fwrite");
+        fatal_error("fwrite() failed");
+    }
+    save_close(f, filename, tmpname);
+    free(buf);
+    stats_stop(&timer, STAGE_MODEL_IO);
+}
+
+gramset_t *gramset_load(char *filename, int *order)
+{
+    struct grams_header header;
+    gramset_t *set;
+    uint64_t *buf;
+    uint32_t i;
+    long size;
+    FILE *f;
+    stats_timer_t timer;
+
+    stats_start(&timer);
+    f = fopen(filename, "rb");
+    if (f == NULL) {
+        perror("fopen");
+        fatal_error("fopen() failed");
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1)
+        fatal_error("phrase file is truncated");
+    if (memcmp(header.magic, GRAMS_MAGIC, 4) != 0)
+        fatal_error("not a phrase file");
+    if (header.version != GRAMS_VERSION)
+        fatal_error("unsupported phrase file version");
+    if (header.order < 2 || header.order > NGRAM_MAXORDER)
+        fatal_error("phrase file is corrupt");
+
+    /* The hashes must fill the rest of the file exactly */
+    fseek(f, 0, SEEK_END);
+    size = ftell(f) - (long)sizeof(header);
+    fseek(f, sizeof(header), SEEK_SET);
+    if (size < 0 ||
+        (uint64_t)size != (uint64_t)header.numgrams * sizeof(uint64_t))
+        fatal_error("phrase file is corrupt");
+    buf = malloc(sizeof(uint64_t) * ((size_t)header.numgrams + 1));
+    if (buf == NULL)
+        fatal_error("out of memory");
+    if (fread(buf, sizeof(uint64_t), header.numgrams, f) != header.numgrams)
+        fatal_error("phrase file is truncated");
+    fclose(f);
+    if (hash_bytes(buf, header.numgrams * sizeof(uint64_t)) != header.checksum)
+        fatal_error("phrase file checksum mismatch");
+
+    set = gramset_create();
+    for (i = 0; i < header.numgrams; i++)
+        gramset_add(set, buf[i]);
+    free(buf);
+    *order = header.order;
+    stats_stop(&timer, STAGE_MODEL_IO);
+    return set;
+}
+
+gramindex_t *gramindex_create(gramset_t **sets, int numsets)
+{
+    gramindex_t *index;
+    size_t total = 0, numslots = 8, i, slot;
+    int s;
+
+    if (numsets < 1 || numsets > GRAMINDEX_MAX)
+        fatal_error("too many phrase sets");
+    for (s = 0; s < numsets; s++) {
+        if (sets[s] != NULL)
+            total += sets[s]->size;
+    }
+    while (numslots < 2 * total)
+        numslots *= 2;
+
+    index = malloc(sizeof(gramindex_t));
+    if (index == NULL)
+        fatal_error("out of memory");
+    index->slots = calloc(numslots, sizeof(struct gramindex_entry));
+    if (index->slots == NULL)
+        fatal_error("out of memory");
+    index->mask = numslots - 1;
+    index->numsets = numsets;
+
+    for (s = 0; s < numsets; s++) {
+        if (sets[s] == NULL)
+            continue;
+        for (i = 0; i <= sets[s]->mask; i++) {
+            uint64_t hash = sets[s]->slots[i];
+
+            if (hash == 0)
+                continue;
+            slot = hash & index->mask;
+            while (index->slots[slot].hash != 0 &&
+                   index->slots[slot].hash != hash)
+                slot = (slot + 1) & index->mask;
+            index->slots[slot].hash = hash;
+            index->slots[slot].sets |= (uint64_t)1 << s;
+        }
+    }
+    return index;
+}
+
+void gramindex_destroy(gramindex_t *index)
+{
+    free(index->slots);
+    free(index);
+}
+
+void gramindex_count(gramindex_t *index, gramset_t *grams, int *counts)
+{
+    size_t i, slot;
+    uint64_t bits;
+
+    for (i = 0; i <= grams->mask; i++) {
+        if (grams->slots[i] == 0)
+            continue;
+        slot = grams->slots[i] & index->mask;
+        while (index->slots[slot].hash != 0 &&
+               index->slots[slot].hash != grams->slots[i])
+            slot = (slot + 1) & index->mask;
+        /* Only the sets that hold the phrase are visited */
+        bits = index->slots[slot].sets;
+        while (bits != 0) {
+            counts[__builtin_ctzll(bits)]++;
+            bits &= bits - 1;
+        }
+    }
+}
+
+/*
+ * Mixes the hash of one more word into the hash of a phrase.  The
+ * multiply and the final avalanche make phrases of the same words in a
+ * different order hash differently.
+ */
+static uint64_t combine(uint64_t phrase, uint64_t word)
+{
+    uint64_t h = phrase * 0x9E3779B97F4A7C15ULL ^ word;
+
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 31;
+    return h;
+}
+
+ngram_t *ngram_create(int order)
+{
+    ngram_t *ng = malloc(sizeof(ngram_t));
+
+    if (ng == NULL)
+        fatal_error("out of memory");
+    ng->order = order;
+    ng->grams = gramset_create();
+    ng->word = FNV_OFFSET;
+    ng->wordlen = 0;
+    ng->numprev = 0;
+    utf8_init(&ng->utf8);
+    return ng;
+}
+
+void ngram_destroy(ngram_t *ng)
+{
+    gramset_destroy(ng->grams);
+    free(ng);
+}
+
+/*
+ * Ends the word being scanned, and adds the phrases that end with it.
+ * Phrases of n words start from the seed n, so that they never collide
+ * with shorter phrases ending in the same words.
+ */
+static void ngram_emit(ngram_t *ng)
+{
+    uint64_t phrase;
+    int n, i;
+
+    for (n = 2; n <= ng->order && n - 1 <= ng->numprev; n++) {
+        phrase = n;
+        for (i = n - 2; i >= 0; i--)
+            phrase = combine(phrase, ng->prev[i]);
+        gramset_add(ng->grams, combine(phrase, ng->word));
+    }
+    memmove(ng->prev + 1, ng->prev, sizeof(uint64_t) * (NGRAM_MAXORDER - 1));
+    ng->prev[0] = ng->word;
+    if (ng->numprev < NGRAM_MAXORDER - 1)
+        ng->numprev++;
+    ng->word = FNV_OFFSET;
+    ng->wordlen = 0;
+}
+
+static void ngram_endword(ngram_t *ng)
+{
+    if (ng->wordlen > 0)
+        ngram_emit(ng);
+}
+
+/*
+ * The words are split as the tokenizer in common.c splits them, and
+ * hashed over the same case-folded bytes.
+ */
+static void ngram_char(ngram_t *ng, uint32_t cp)
+{
+    char buf[4];
+    int i, len, class = utf8_wordchar(cp, buf, &len);
+
+    if (class == UTF8_SEPARATOR) {
+        ngram_endword(ng);
+        return;
+    }
+    if (class == UTF8_SOLO || ng->wordlen + len > MAXWORD)
+        ngram_endword(ng);
+    for (i = 0; i < len; i++)
+        ng->word = (ng->word ^ (unsigned char)buf[i]) * FNV_PRIME;
+    ng->wordlen += len;
+    if (class == UTF8_SOLO || ng->wordlen == MAXWORD)
+        ngram_emit(ng);
+}
+
+static void ngram_byte(ngram_t *ng, unsigned char c)
+{
+    int32_t cp = utf8_decode(&ng->utf8, c);
+
+    if (cp == UTF8_AGAIN) {
+        ngram_endword(ng);
+        cp = utf8_decode(&ng->utf8, c);
+    }
+    if (cp >= 0)
+        ngram_char(ng, cp);
+    else if (cp != UTF8_MORE)
+        ngram_endword(ng);
+}
+
+void ngram_feed(ngram_t *ng, const char *data, size_t len)
+{
+    size_t i = 0, end;
+
+    while (i < len) {
+        while (i < len && (utf8_pending(&ng->utf8) ||
+                           (unsigned char)data[i] >= 0x80))
+            ngram_byte(ng, data[i++]);
+        end = i + utf8_ascii_prefix(data + i, len - i);
+        for (; i < end; i++) {
+            unsigned char c = utf8_ascii[(unsigned char)data[i]];
+
+            if (c != 0) {
+                ng->word = (ng->word ^ c) * FNV_PRIME;
+                if (++ng->wordlen == MAXWORD)
+                    ngram_emit(ng);
+            }
+            else if (ng->wordlen > 0) {
+                ngram_emit(ng);
+            }
+        }
+    }
+}
+
+void ngram_tap(void *ng, const char *data, size_t len)
+{
+    ngram_feed(ng, data, len);
+}
+
+gramset_t *ngram_grams(ngram_t *ng)
+{
+    utf8_init(&ng->utf8);
+    ngram_endword(ng);
+    return ng->grams;
+}
+
+void ngram_reset(ngram_t *ng)
+{
+    gramset_destroy(ng->grams);
+    ng->grams = gramset_create();
+    ng->word = FNV_OFFSET;
+    ng->wordlen = 0;
+    ng->numprev = 0;
+    utf8_init(&ng->utf8);
+}
+
+gramset_t *ngram_tokenize(char *filename, int order)
+{
+    ngram_t *ng = ngram_create(order);
+    gramset_t *grams;
+    char buf[READSIZE];
+    size_t n;
+    FILE *f;
+
+    f = fopen(filename, "r");
+    if (f == NULL) {
+        perror("fopen");
+        fatal_error("fopen() failed");
+    }
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        ngram_feed(ng, buf, n);
+    fclose(f);
+    grams = ngram_grams(ng);
+    free(ng);
+    return grams;
+}
+
+gramset_t *ngram_train(list_t *spamfiles, list_t *hamfiles, int order)
+{
+    gramset_t *cand = NULL, *grams;
+    list_iter_t *iter;
+
+    /* Like the set expressions, stop reading once no candidates remain */
+    iter = list_createiter(spamfiles);
+    while (list_hasnext(iter) && (cand == NULL || gramset_size(cand) > 0)) {
+        grams = ngram_tokenize(list_next(iter), order);
+        if (cand == NULL) {
+            cand = grams;
+            continue;
+        }
+        gramset_retain(cand, grams);
+        gramset_destroy(grams);
+    }
+    list_destroyiter(iter);
+    if (cand == NULL)
+        return gramset_create();
+
+    iter = list_createiter(hamfiles);
+    while (list_hasnext(iter) && gramset_size(cand) > 0) {
+        grams = ngram_tokenize(list_next(iter), order);
+        gramset_discard(cand, grams);
+        gramset_destroy(grams);
+    }
+    list_destroyiter(iter);
+    return cand;
+}
@@ -0,0 +1,138 @@
+#ifndef NGRAM_H
+#define NGRAM_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+/*
+ * Word n-gram features.  A phrase of n consecutive words, for n from 2
+ * up to a chosen order of at most 3, is reduced to a 64-bit hash of the
+ * case-folded words as they are scanned.  Phrases are never stored as
+ * strings: the feature sets hold their hashes only.  Words are split
+ * exactly as the tokenizer in common.h splits them.
+ */
+#define NGRAM_MAXORDER 3
+
+/*
+ * The type of sets of phrase hashes, kept in open-addressed hash
+ * tables.
+ */
+struct gramset;
+typedef struct gramset gramset_t;
+
+gramset_t *gramset_create(void);
+void gramset_destroy(gramset_t *set);
+int gramset_size(gramset_t *set);
+
+/*
+ * Adds the given hash to the set.  Returns 1 if it was added, 0 if the
+ * set already held it.
+ */
+int gramset_add(gramset_t *set, uint64_t hash);
+
+/*
+ * Returns 1 if the set holds the given hash, 0 otherwise.
+ */
+int gramset_contains(gramset_t *set, uint64_t hash);
+
+/*
+ * Removes the hashes of set that are not in other, or with
+ * gramset_discard(), those that are.
+ */
+void gramset_retain(gramset_t *set, gramset_t *other);
+void gramset_discard(gramset_t *set, gramset_t *other);
+
+/*
+ * Returns the number of hashes the two sets have in common.
+ */
+int gramset_common(gramset_t *a, gramset_t *b);
+
+/*
+ * Writes the given set, and the order of the phrases it holds, to the
+ * given file.
+ */
+void gramset_save(gramset_t *set, int order, char *filename);
+
+/*
+ * Reads a set written with gramset_save(), and stores the order of its
+ * phrases in *order.  Terminates the program if the file is not a valid
+ * phrase file of the current version, or if its checksum does not
+ * match.
+ */
+gramset_t *gramset_load(char *filename, int *order);
+
+/*
+ * The type of phrase indexes, which map each phrase of up to
+ * GRAMINDEX_MAX sets to the bitmask of the sets holding it, so that the
+ * phrases of a message are counted against all of the sets at once.
+ */
+struct gramindex;
+typedef struct gramindex gramindex_t;
+
+#define GRAMINDEX_MAX 64    /* Sets per index, one bit each */
+
+/*
+ * Creates an index of the given sets, which may be NULL for no phrases.
+ * The index does not refer to the sets once created.
+ */
+gramindex_t *gramindex_create(gramset_t **sets, int numsets);
+void gramindex_destroy(gramindex_t *index);
+
+/*
+ * Adds to counts[i] the number of phrases of grams that are in the i-th
+ * set of the index.
+ */
+void gramindex_count(gramindex_t *index, gramset_t *grams, int *counts);
+
+/*
+ * The type of phrase scanners.  Like a streaming tokenizer, a scanner
+ * is fed a message in pieces of any size, and is reset between
+ * messages.
+ */
+struct ngram;
+typedef struct ngram ngram_t;
+
+/*
+ * Creates a scanner for phrases of 2 up to the given number of words.
+ */
+ngram_t *ngram_create(int order);
+void ngram_destroy(ngram_t *ng);
+
+/*
+ * Feeds the next len bytes of the current message to the scanner.
+ */
+void ngram_feed(ngram_t *ng, const char *data, size_t len);
+
+/*
+ * Like ngram_feed(), as a bytesink_t, to feed a scanner from the read
+ * loop of tokenize_tap().
+ */
+void ngram_tap(void *ng, const char *data, size_t len);
+
+/*
+ * Returns the set of phrases of the current message.  The set belongs
+ * to the scanner, and remains valid until the next call to
+ * ngram_reset().
+ */
+gramset_t *ngram_grams(ngram_t *ng);
+
+/*
+ * Readies the scanner for the next message.
+ */
+void ngram_reset(ngram_t *ng);
+
+/*
+ * Returns the set of phrases of the given file, which the caller must
+ * destroy.
+ */
+gramset_t *ngram_tokenize(char *filename, int order);
+
+/*
+ * Returns the spam phrases of the given corpora: the phrases found in
+ * every spam file and in no non-spam file.
+ */
+gramset_t *ngram_train(struct list *spamfiles, struct list *hamfiles,
+                       int order);
+
+#endif
@@ -1,17 +1,36 @@
 #include "set.h"
+#include "list.h"
+#include "typedset.h"
+#include "alloc.h"
+#include "arena.h"
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * With no arguments, prints a few sets of the integers 0..50 built with
+ * the set API.  'numbers test' runs a randomized differential test of
+ * the set and list backends against simple reference implementations,
+ * and 'numbers bench' times their operations at a configurable size and
+ * key distribution, reporting ns/op.
+ */
 
 static int compare_ints(void *a, void *b)
 {
     int *ia = a;
     int *ib = b;
 
-    return (*ia)-(*ib);
+    return (*ia > *ib) - (*ia < *ib);
 }
 
 static void *newint(int i)
 {
     int *p = malloc(sizeof(int));
+    if (p == NULL)
+        fatal_error("out of memory");
     *p = i;
     return p;
 }
@@ -42,14 +61,16 @@ static void dumpset(char *prefix, set_t *set)
     set_destroy(set);
 }
 
-int main(int argc, char **argv)
+static void demo(void)
 {
     set_t *all, *evens, *odds, *nonprimes, *primes;
     int i, j, n = 50;
     int **numbers;
 
     /* Allocate numbers from 0 to n */
-    numbers = (int **) malloc(sizeof(int) * (n+1));
+    numbers = (int **) malloc(sizeof(int *) * (n+1));
+    if (numbers == NULL)
+        fatal_error("out of memory");
     for (i = 0; i <= n; i++) {
 	    numbers[i] = newint(i);
     }
@@ -89,7 +110,7 @@ int main(int argc, char **argv)
     printset("Odd numbers:", odds);
     printset("Non-prime numbers:", nonprimes);
     printset("Prime numbers:", primes);
-    
+
     /* Test unions */
     dumpset("Even or odd numbers:", set_union(evens, odds));
     dumpset("Prime or non-prime numbers:", set_union(primes, nonprimes));
@@ -121,3 +142,1396 @@ int main(int argc, char **argv)
     }
     free(numbers);
 }
+
+/*
+ * Backends.  Each set and list implementation is driven through a table
+ * of functions over ints, so that the test and the benchmark treat them
+ * alike.  Elements are passed by pointer and must stay valid for as
+ * long as they are in a container.  A new backend is added by writing
+ * its table and listing it in setbackends[] or listbackends[].
+ */
+struct setbackend {
+    char *name;
+    void *(*create)(void);
+    void (*destroy)(void *set);
+    void (*add)(void *set, int *elem);
+    int (*contains)(void *set, int elem);
+    int (*size)(void *set);
+    void *(*setunion)(void *a, void *b);
+    void *(*intersection)(void *a, void *b);
+    void *(*difference)(void *a, void *b);
+    /* Stores the elements in order into out, returns how many */
+    int (*elements)(void *set, int *out);
+};
+
+struct listbackend {
+    char *name;
+    void *(*create)(void);
+    void (*destroy)(void *list);
+    void (*addfirst)(void *list, int *elem);
+    void (*addlast)(void *list, int *elem);
+    int (*popfirst)(void *list);   /* The list must not be empty */
+    int (*poplast)(void *list);
+    int (*contains)(void *list, int elem);
+    int (*size)(void *list);
+    void (*sort)(void *list);
+    int (*elements)(void *list, int *out);
+};
+
+/* The red-black tree of set.c */
+
+static void *rb_create(void)
+{
+    return set_create(compare_ints);
+}
+
+static void rb_destroy(void *set)
+{
+    set_destroy(set);
+}
+
+static void rb_add(void *set, int *elem)
+{
+    set_add(set, elem, elem);
+}
+
+static int rb_contains(void *set, int elem)
+{
+    return set_contains(set, &elem);
+}
+
+static int rb_size(void *set)
+{
+    return set_size(set);
+}
+
+static void *rb_union(void *a, void *b)
+{
+    return set_union(a, b);
+}
+
+static void *rb_intersection(void *a, void *b)
+{
+    return set_intersection(a, b);
+}
+
+static void *rb_difference(void *a, void *b)
+{
+    return set_difference(a, b);
+}
+
+static int rb_elements(void *set, int *out)
+{
+    set_iter_t *it = set_createiter(set);
+    int n = 0;
+
+    while (set_hasnext(it))
+        out[n++] = *(int *)set_next(it);
+    set_destroyiter(it);
+    return n;
+}
+
+/*
+ * The same red-black tree with its memory from a size-class pool, and
+ * from an arena.  The allocators are shared by all the sets of their
+ * backend, and must have nothing live left once the sets are gone.
+ */
+static allocator_t *rbpool, *rbarena;
+static arena_t *arena;
+
+static void *rbpool_create(void)
+{
+    if (rbpool == NULL)
+        rbpool = alloc_pool();
+    return set_create_alloc(compare_ints, rbpool);
+}
+
+static void *rbarena_create(void)
+{
+    if (rbarena == NULL) {
+        arena = arena_create();
+        rbarena = alloc_arena(arena);
+    }
+    return set_create_alloc(compare_ints, rbarena);
+}
+
+/* The int instantiation of typedset.h, with keys stored in the nodes */
+
+static void *is_create(void)
+{
+    return intset_create(NULL);
+}
+
+static void is_destroy(void *set)
+{
+    intset_destroy(set);
+}
+
+static void is_add(void *set, int *elem)
+{
+    intset_add(set, *elem);
+}
+
+static int is_contains(void *set, int elem)
+{
+    return intset_contains(set, elem);
+}
+
+static int is_size(void *set)
+{
+    return intset_size(set);
+}
+
+static void *is_union(void *a, void *b)
+{
+    return intset_union(a, b);
+}
+
+static void *is_intersection(void *a, void *b)
+{
+    return intset_intersection(a, b);
+}
+
+static void *is_difference(void *a, void *b)
+{
+    return intset_difference(a, b);
+}
+
+static int is_elements(void *set, int *out)
+{
+    intset_node_t *node;
+    int n = 0;
+
+    for (node = intset_first(set); node != NULL; node = intset_next(node))
+        out[n++] = node->key;
+    return n;
+}
+
+/*
+ * The string instantiations of typedset.h, over the ints spelled as
+ * zero-padded decimals so that they sort as numbers do.  Every third
+ * int gets a suffix that makes it too long for ssoset to keep inline.
+ * The strings added are kept in an arena that is reset after each
+ * round.
+ */
+static arena_t *ssoarena;
+
+static char *sso_spell(char *buf, int elem)
+{
+    sprintf(buf, elem % 3 == 0 ? "%010d-spelled-out" : "%010d", elem);
+    return buf;
+}
+
+/* The spelling of elem, to be added to a container */
+static char *spell_added(int elem)
+{
+    char buf[32];
+
+    if (ssoarena == NULL)
+        ssoarena = arena_create();
+    return arena_strdup(ssoarena, sso_spell(buf, elem));
+}
+
+/* The spelling of elem, to be looked up; valid until the next call */
+static char *spell_probe(int elem)
+{
+    static char buf[32];
+
+    return sso_spell(buf, elem);
+}
+
+static void *ss_create(void)
+{
+    if (ssoarena == NULL)
+        ssoarena = arena_create();
+    return ssoset_create(NULL);
+}
+
+static void ss_destroy(void *set)
+{
+    ssoset_destroy(set);
+}
+
+static void ss_add(void *set, int *elem)
+{
+    char buf[32];
+
+    sso_spell(buf, *elem);
+    if (!ssoset_contains(set, sso_make(buf)))
+        ssoset_add(set, sso_make(arena_strdup(ssoarena, buf)));
+}
+
+static int ss_contains(void *set, int elem)
+{
+    char buf[32];
+
+    return ssoset_contains(set, sso_make(sso_spell(buf, elem)));
+}
+
+static int ss_size(void *set)
+{
+    return ssoset_size(set);
+}
+
+static void *ss_union(void *a, void *b)
+{
+    return ssoset_union(a, b);
+}
+
+static void *ss_intersection(void *a, void *b)
+{
+    return ssoset_intersection(a, b);
+}
+
+static void *ss_difference(void *a, void *b)
+{
+    return ssoset_difference(a, b);
+}
+
+static int ss_elements(void *set, int *out)
+{
+    ssoset_node_t *node;
+    int n = 0;
+
+    for (node = ssoset_first(set); node != NULL; node = ssoset_next(node))
+        out[n++] = atoi(sso_str(&node->key));
+    return n;
+}
+
+/*
+ * The other instantiations of typedset.h share their wrappers: each
+ * names the comparison function it is created with, how an element is
+ * turned into a key to add or to look up, and how a stored key is
+ * turned back into an element.
+ */
+#define TYPED_SET_BACKEND(p, name, compare, addkey, probekey, elemof)      \
+static void *p##_create(void)                                              \
+{                                                                          \
+    return name##_create(compare);                                         \
+}                                                                          \
+                                                                           \
+static void p##_destroy(void *set)                                         \
+{                                                                          \
+    name##_destroy(set);                                                   \
+}                                                                          \
+                                                                           \
+static void p##_add(void *set, int *elem)                                  \
+{                                                                          \
+    name##_add(set, addkey(elem));                                         \
+}                                                                          \
+                                                                           \
+static int p##_contains(void *set, int elem)                               \
+{                                                                          \
+    return name##_contains(set, probekey(elem));                           \
+}                                                                          \
+                                                                           \
+static int p##_size(void *set)                                             \
+{                                                                          \
+    return name##_size(set);                                               \
+}                                                                          \
+                                                                           \
+static void *p##_union(void *a, void *b)                                   \
+{                                                                          \
+    return name##_union(a, b);                                             \
+}                                                                          \
+                                                                           \
+static void *p##_intersection(void *a, void *b)                            \
+{                                                                          \
+    return name##_intersection(a, b);                                      \
+}                                                                          \
+                                                                           \
+static void *p##_difference(void *a, void *b)                              \
+{                                                                          \
+    return name##_difference(a, b);                                        \
+}                                                                          \
+                                                                           \
+static int p##_elements(void *set, int *out)                               \
+{                                                                          \
+    name##_node_t *node;                                                   \
+    int n = 0;                                                             \
+                                                                           \
+    for (node = name##_first(set); node != NULL; node = name##_next(node)) \
+        out[n++] = elemof(node->key);                                      \
+    return n;                                                              \
+}
+
+#define STR_ADDKEY(elem)    spell_added(*(elem))
+#define STR_PROBEKEY(elem)  spell_probe(elem)
+#define STR_ELEMOF(key)     atoi(key)
+#define U32_ADDKEY(elem)    (uint32_t)*(elem)
+#define U32_PROBEKEY(elem)  (uint32_t)(elem)
+#define U32_ELEMOF(key)     (int)(key)
+#define V_ADDKEY(elem)      (void *)(elem)
+#define V_PROBEKEY(elem)    (void *)&(elem)
+#define V_ELEMOF(key)       *(int *)(key)
+#define SSO_ADDKEY(elem)    sso_make(spell_added(*(elem)))
+#define SSO_PROBEKEY(elem)  sso_make(spell_probe(elem))
+#define SSO_ELEMOF(key)     sso_elem(key)
+
+static int sso_elem(sso_t key)
+{
+    return atoi(sso_str(&key));
+}
+
+TYPED_SET_BACKEND(strs, strset, NULL, STR_ADDKEY, STR_PROBEKEY, STR_ELEMOF)
+TYPED_SET_BACKEND(ws, wordset, NULL, STR_ADDKEY, STR_PROBEKEY, STR_ELEMOF)
+TYPED_SET_BACKEND(u32s, u32set, NULL, U32_ADDKEY, U32_PROBEKEY, U32_ELEMOF)
+TYPED_SET_BACKEND(vs, vset, compare_ints, V_ADDKEY, V_PROBEKEY, V_ELEMOF)
+
+/*
+ * The reference set: a sorted array of ints.  Adds are appended and
+ * the array is sorted and deduplicated when it is next read.
+ */
+struct sortedarray {
+    int *elems;
+    int size;
+    int capacity;
+    int sorted;
+};
+
+static int compare_ints_qsort(const void *a, const void *b)
+{
+    return compare_ints((void *)a, (void *)b);
+}
+
+static void *sa_create(void)
+{
+    struct sortedarray *sa = calloc(1, sizeof(struct sortedarray));
+    if (sa == NULL)
+        fatal_error("out of memory");
+    sa->sorted = 1;
+    return sa;
+}
+
+static void sa_destroy(void *set)
+{
+    struct sortedarray *sa = set;
+    free(sa->elems);
+    free(sa);
+}
+
+static void sa_append(struct sortedarray *sa, int elem)
+{
+    if (sa->size == sa->capacity) {
+        sa->capacity = sa->capacity ? 2 * sa->capacity : 16;
+        sa->elems = realloc(sa->elems, sizeof(int) * sa->capacity);
+        if (sa->elems == NULL)
+            fatal_error("out of memory");
+    }
+    sa->elems[sa->size++] = elem;
+}
+
+static void sa_normalize(struct sortedarray *sa)
+{
+    int i, n = 0;
+
+    if (sa->sorted)
+        return;
+    qsort(sa->elems, sa->size, sizeof(int), compare_ints_qsort);
+    for (i = 0; i < sa->size; i++) {
+        if (n == 0 || sa->elems[n - 1] != sa->elems[i])
+            sa->elems[n++] = sa->elems[i];
+    }
+    sa->size = n;
+    sa->sorted = 1;
+}
+
+static void sa_add(void *set, int *elem)
+{
+    struct sortedarray *sa = set;
+    sa_append(sa, *elem);
+    sa->sorted = 0;
+}
+
+static int sa_contains(void *set, int elem)
+{
+    struct sortedarray *sa = set;
+    int lo = 0, hi;
+
+    sa_normalize(sa);
+    hi = sa->size;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (sa->elems[mid] < elem)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < sa->size && sa->elems[lo] == elem;
+}
+
+static int sa_size(void *set)
+{
+    sa_normalize(set);
+    return ((struct sortedarray *)set)->size;
+}
+
+/*
+ * Merges two sorted arrays, keeping the elements found in a only
+ * (keep = 1), in both (keep = 2), or in either (keep = 3).
+ */
+static void *sa_merge(void *seta, void *setb, int keep)
+{
+    struct sortedarray *a = seta, *b = setb, *r = sa_create();
+    int i = 0, j = 0;
+
+    sa_normalize(a);
+    sa_normalize(b);
+    while (i < a->size || j < b->size) {
+        if (j == b->size || (i < a->size && a->elems[i] < b->elems[j])) {
+            if (keep != 2)
+                sa_append(r, a->elems[i]);
+            i++;
+        }
+        else if (i == a->size || b->elems[j] < a->elems[i]) {
+            if (keep == 3)
+                sa_append(r, b->elems[j]);
+            j++;
+        }
+        else {
+            if (keep != 1)
+                sa_append(r, a->elems[i]);
+            i++;
+            j++;
+        }
+    }
+    return r;
+}
+
+static void *sa_union(void *a, void *b)
+{
+    return sa_merge(a, b, 3);
+}
+
+static void *sa_intersection(void *a, void *b)
+{
+    return sa_merge(a, b, 2);
+}
+
+static void *sa_difference(void *a, void *b)
+{
+    return sa_merge(a, b, 1);
+}
+
+static int sa_elements(void *set, int *out)
+{
+    struct sortedarray *sa = set;
+    sa_normalize(sa);
+    memcpy(out, sa->elems, sizeof(int) * sa->size);
+    return sa->size;
+}
+
+/* The doubly linked list of linkedlist.c */
+
+static void *ll_create(void)
+{
+    return list_create(compare_ints);
+}
+
+static void ll_destroy(void *list)
+{
+    list_destroy(list);
+}
+
+static void ll_addfirst(void *list, int *elem)
+{
+    list_addfirst(list, elem);
+}
+
+static void ll_addlast(void *list, int *elem)
+{
+    list_addlast(list, elem);
+}
+
+static int ll_popfirst(void *list)
+{
+    return *(int *)list_popfirst(list);
+}
+
+static int ll_poplast(void *list)
+{
+    return *(int *)list_poplast(list);
+}
+
+static int ll_contains(void *list, int elem)
+{
+    return list_contains(list, &elem);
+}
+
+static int ll_size(void *list)
+{
+    return list_size(list);
+}
+
+static void ll_sort(void *list)
+{
+    list_sort(list);
+}
+
+static int ll_elements(void *list, int *out)
+{
+    list_iter_t *it = list_createiter(list);
+    int n = 0;
+
+    while (list_hasnext(it))
+        out[n++] = *(int *)list_next(it);
+    list_destroyiter(it);
+    return n;
+}
+
+/* The same list with its memory from a size-class pool */
+static allocator_t *llpool;
+
+static void *llpool_create(void)
+{
+    if (llpool == NULL)
+        llpool = alloc_pool();
+    return list_create_alloc(compare_ints, llpool);
+}
+
+/* The int instantiation of typedset.h, with elements stored in the nodes */
+
+static void *il_create(void)
+{
+    return intlist_create(NULL);
+}
+
+static void il_destroy(void *list)
+{
+    intlist_destroy(list);
+}
+
+static void il_addfirst(void *list, int *elem)
+{
+    intlist_addfirst(list, *elem);
+}
+
+static void il_addlast(void *list, int *elem)
+{
+    intlist_addlast(list, *elem);
+}
+
+static int il_popfirst(void *list)
+{
+    return intlist_popfirst(list);
+}
+
+static int il_poplast(void *list)
+{
+    return intlist_poplast(list);
+}
+
+static int il_contains(void *list, int elem)
+{
+    return intlist_contains(list, elem);
+}
+
+static int il_size(void *list)
+{
+    return intlist_size(list);
+}
+
+static void il_sort(void *list)
+{
+    intlist_sort(list);
+}
+
+static int il_elements(void *list, int *out)
+{
+    intlist_node_t *node;
+    int n = 0;
+
+    for (node = intlist_first(list); node != NULL; node = intlist_next(node))
+        out[n++] = node->elem;
+    return n;
+}
+
+/* The other instantiations of typedset.h, as for TYPED_SET_BACKEND */
+#define TYPED_LIST_BACKEND(p, name, compare, addkey, probekey, elemof)     \
+static void *p##_create(void)                                              \
+{                                                                          \
+    return name##_create(compare);                                         \
+}                                                                          \
+                                                                           \
+static void p##_destroy(void *list)                                        \
+{                                                                          \
+    name##_destroy(list);                                                  \
+}                                                                          \
+                                                                           \
+static void p##_addfirst(void *list, int *elem)                            \
+{                                                                          \
+    name##_addfirst(list, addkey(elem));                                   \
+}                                                                          \
+                                                                           \
+static void p##_addlast(void *list, int *elem)                             \
+{                                                                          \
+    name##_addlast(list, addkey(elem));                                    \
+}                                                                          \
+                                                                           \
+static int p##_popfirst(void *list)                                        \
+{                                                                          \
+    return elemof(name##_popfirst(list));                                  \
+}                                                                          \
+                                                                           \
+static int p##_poplast(void *list)                                         \
+{                                                                          \
+    return elemof(name##_poplast(list));                                   \
+}                                                                          \
+                                                                           \
+static int p##_contains(void *list, int elem)                              \
+{                                                                          \
+    return name##_contains(list, probekey(elem));                          \
+}                                                                          \
+                                                                           \
+static int p##_size(void *list)                                            \
+{                                                                          \
+    return name##_size(list);                                              \
+}                                                                          \
+                                                                           \
+static void p##_sort(void *list)                                           \
+{                                                                          \
+    name##_sort(list);                                                     \
+}                                                                          \
+                                                                           \
+static int p##_elements(void *list, int *out)                              \
+{                                                                          \
+    name##_node_t *node;                                                   \
+    int n = 0;                                                             \
+                                                                           \
+    for (node = name##_first(list); node != NULL; node = name##_next(node))\
+        out[n++] = elemof(node->elem);                                     \
+    return n;                                                              \
+}
+
+TYPED_LIST_BACKEND(strl, strlist, NULL, STR_ADDKEY, STR_PROBEKEY, STR_ELEMOF)
+TYPED_LIST_BACKEND(ssol, ssolist, NULL, SSO_ADDKEY, SSO_PROBEKEY, SSO_ELEMOF)
+TYPED_LIST_BACKEND(u32l, u32list, NULL, U32_ADDKEY, U32_PROBEKEY, U32_ELEMOF)
+TYPED_LIST_BACKEND(vl, vlist, compare_ints, V_ADDKEY, V_PROBEKEY, V_ELEMOF)
+
+/* The reference list: a ring buffer of element pointers */
+struct ring {
+    int **elems;
+    int head;
+    int size;
+    int capacity;       /* A power of two */
+};
+
+static void *ring_create(void)
+{
+    struct ring *r = calloc(1, sizeof(struct ring));
+    if (r == NULL)
+        fatal_error("out of memory");
+    return r;
+}
+
+static void ring_destroy(void *list)
+{
+    struct ring *r = list;
+    free(r->elems);
+    free(r);
+}
+
+#define RING_AT(r, i) ((r)->elems[((r)->head + (i)) & ((r)->capacity - 1)])
+
+static void ring_grow(struct ring *r)
+{
+    int **elems, i, capacity = r->capacity ? 2 * r->capacity : 16;
+
+    if (r->size < r->capacity)
+        return;
+    elems = malloc(sizeof(int *) * capacity);
+    if (elems == NULL)
+        fatal_error("out of memory");
+    for (i = 0; i < r->size; i++)
+        elems[i] = RING_AT(r, i);
+    free(r->elems);
+    r->elems = elems;
+    r->head = 0;
+    r->capacity = capacity;
+}
+
+static void ring_addfirst(void *list, int *elem)
+{
+    struct ring *r = list;
+    ring_grow(r);
+    r->head = (r->head - 1) & (r->capacity - 1);
+    r->elems[r->head] = elem;
+    r->size++;
+}
+
+static void ring_addlast(void *list, int *elem)
+{
+    struct ring *r = list;
+    ring_grow(r);
+    RING_AT(r, r->size) = elem;
+    r->size++;
+}
+
+static int ring_popfirst(void *list)
+{
+    struct ring *r = list;
+    int *elem = r->elems[r->head];
+
+    r->head = (r->head + 1) & (r->capacity - 1);
+    r->size--;
+    return *elem;
+}
+
+static int ring_poplast(void *list)
+{
+    struct ring *r = list;
+
+    r->size--;
+    return *RING_AT(r, r->size);
+}
+
+static int ring_contains(void *list, int elem)
+{
+    struct ring *r = list;
+    int i;
+
+    for (i = 0; i < r->size; i++) {
+        if (*RING_AT(r, i) == elem)
+            return 1;
+    }
+    return 0;
+}
+
+static int ring_size(void *list)
+{
+    return ((struct ring *)list)->size;
+}
+
+static int compare_intptrs_qsort(const void *a, const void *b)
+{
+    return compare_ints(*(int **)a, *(int **)b);
+}
+
+static void ring_sort(void *list)
+{
+    struct ring *r = list;
+    int **elems, i;
+
+    /* Straighten the buffer out, then sort it in place */
+    elems = malloc(sizeof(int *) * (r->capacity + 1));
+    if (elems == NULL)
+        fatal_error("out of memory");
+    for (i = 0; i < r->size; i++)
+        elems[i] = RING_AT(r, i);
+    free(r->elems);
+    r->elems = elems;
+    r->head = 0;
+    qsort(r->elems, r->size, sizeof(int *), compare_intptrs_qsort);
+}
+
+static int ring_elements(void *list, int *out)
+{
+    struct ring *r = list;
+    int i;
+
+    for (i = 0; i < r->size; i++)
+        out[i] = *RING_AT(r, i);
+    return r->size;
+}
+
+static struct setbackend setbackends[] = {
+    { "sortedarray", sa_create, sa_destroy, sa_add, sa_contains, sa_size,
+      sa_union, sa_intersection, sa_difference, sa_elements },
+    { "rbtree", rb_create, rb_destroy, rb_add, rb_contains, rb_size,
+      rb_union, rb_intersection, rb_difference, rb_elements },
+    { "rbtree-pool", rbpool_create, rb_destroy, rb_add, rb_contains, rb_size,
+      rb_union, rb_intersection, rb_difference, rb_elements },
+    { "rbtree-arena", rbarena_create, rb_destroy, rb_add, rb_contains,
+      rb_size, rb_union, rb_intersection, rb_difference, rb_elements },
+    { "intset", is_create, is_destroy, is_add, is_contains, is_size,
+      is_union, is_intersection, is_difference, is_elements },
+    { "ssoset", ss_create, ss_destroy, ss_add, ss_contains, ss_size,
+      ss_union, ss_intersection, ss_difference, ss_elements },
+    { "strset", strs_create, strs_destroy, strs_add, strs_contains,
+      strs_size, strs_union, strs_intersection, strs_difference,
+      strs_elements },
+    { "wordset", ws_create, ws_destroy, ws_add, ws_contains, ws_size,
+      ws_union, ws_intersection, ws_difference, ws_elements },
+    { "u32set", u32s_create, u32s_destroy, u32s_add, u32s_contains,
+      u32s_size, u32s_union, u32s_intersection, u32s_difference,
+      u32s_elements },
+    { "vset", vs_create, vs_destroy, vs_add, vs_contains, vs_size,
+      vs_union, vs_intersection, vs_difference, vs_elements },
+};
+
+static struct listbackend listbackends[] = {
+    { "ring", ring_create, ring_destroy, ring_addfirst, ring_addlast,
+      ring_popfirst, ring_poplast, ring_contains, ring_size, ring_sort,
+      ring_elements },
+    { "linkedlist", ll_create, ll_destroy, ll_addfirst, ll_addlast,
+      ll_popfirst, ll_poplast, ll_contains, ll_size, ll_sort, ll_elements },
+    { "linkedlist-pool", llpool_create, ll_destroy, ll_addfirst, ll_addlast,
+      ll_popfirst, ll_poplast, ll_contains, ll_size, ll_sort, ll_elements },
+    { "intlist", il_create, il_destroy, il_addfirst, il_addlast,
+      il_popfirst, il_poplast, il_contains, il_size, il_sort, il_elements },
+    { "strlist", strl_create, strl_destroy, strl_addfirst, strl_addlast,
+      strl_popfirst, strl_poplast, strl_contains, strl_size, strl_sort,
+      strl_elements },
+    { "ssolist", ssol_create, ssol_destroy, ssol_addfirst, ssol_addlast,
+      ssol_popfirst, ssol_poplast, ssol_contains, ssol_size, ssol_sort,
+      ssol_elements },
+    { "u32list", u32l_create, u32l_destroy, u32l_addfirst, u32l_addlast,
+      u32l_popfirst, u32l_poplast, u32l_contains, u32l_size, u32l_sort,
+      u32l_elements },
+    { "vlist", vl_create, vl_destroy, vl_addfirst, vl_addlast, vl_popfirst,
+      vl_poplast, vl_contains, vl_size, vl_sort, vl_elements },
+};
+
+#define NUMSETBACKENDS  (int)(sizeof(setbackends) / sizeof(setbackends[0]))
+#define NUMLISTBACKENDS (int)(sizeof(listbackends) / sizeof(listbackends[0]))
+
+/* xorshift64* */
+static uint64_t rng_state = 1;
+
+static uint64_t next_random(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+enum distribution { DIST_UNIFORM, DIST_SEQUENTIAL, DIST_ZIPF };
+
+/*
+ * Fills keys[0..n) with keys drawn from the given distribution over
+ * [0, range).  Zipf keys are ranked by their value, so small keys are
+ * the most frequent.
+ */
+static void make_keys(int *keys, int n, int range, enum distribution dist)
+{
+    double *cdf, sum = 0;
+    int i;
+
+    switch (dist) {
+    case DIST_UNIFORM:
+        for (i = 0; i < n; i++)
+            keys[i] = next_random() % range;
+        break;
+    case DIST_SEQUENTIAL:
+        for (i = 0; i < n; i++)
+            keys[i] = (int)((long)i * range / n);
+        break;
+    case DIST_ZIPF:
+        cdf = malloc(sizeof(double) * range);
+        if (cdf == NULL)
+            fatal_error("out of memory");
+        for (i = 0; i < range; i++) {
+            sum += 1.0 / (i + 1);
+            cdf[i] = sum;
+        }
+        for (i = 0; i < n; i++) {
+            double u = (next_random() >> 11) * (1.0 / 9007199254740992.0) * sum;
+            int lo = 0, hi = range - 1;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (cdf[mid] < u)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            keys[i] = lo;
+        }
+        free(cdf);
+        break;
+    }
+}
+
+/*
+ * Differential test.  Every backend is given the same random operations
+ * and must give the same answers as the first (reference) backend.
+ */
+
+static void check(int ok, char *backend, char *what, int round)
+{
+    if (!ok) {
+        fprintf(stderr, "round %d: %s: %s disagrees with the reference\n",
+                round, backend, what);
+        exit(1);
+    }
+}
+
+/* Checks that a set holds exactly the n elements of expected */
+static void check_set(struct setbackend *b, void *set, int *expected, int n,
+                      int *scratch, char *what, int round)
+{
+    check(b->size(set) == n, b->name, what, round);
+    check(b->elements(set, scratch) == n &&
+          memcmp(scratch, expected, sizeof(int) * n) == 0,
+          b->name, what, round);
+    if (b->size == rb_size) {
+        /* A node per element, and the set itself */
+        alloc_stats_t mem;
+        set_memstats(set, &mem);
+        check(mem.allocs - mem.frees == (uint64_t)n + 1 && mem.live > 0,
+              b->name, "memstats", round);
+    }
+}
+
+/*
+ * Checks the operations of set.c that have no counterpart in the other
+ * backends against the reference results of the round.
+ */
+static void check_setextras(set_t *a, set_t *b, int *ref, int nunion,
+                            int ninter, int ndiff, int round)
+{
+    set_t *sets[3], *result;
+    set_iter_t *it;
+    int limit = 1 + next_random() % 8, key, i, n;
+    int *scratch = malloc(sizeof(int) * (nunion + 1));
+
+    if (scratch == NULL)
+        fatal_error("out of memory");
+    check(set_union_size(a, b, 0) == nunion, "rbtree", "union_size", round);
+    check(set_intersection_size(a, b, 0) == ninter, "rbtree",
+          "intersection_size", round);
+    check(set_difference_size(a, b, 0) == ndiff, "rbtree", "difference_size",
+          round);
+    check(set_intersection_size(a, b, limit) ==
+          (ninter < limit ? ninter : limit), "rbtree",
+          "intersection_size with limit", round);
+    check(set_union_size(a, b, limit) == (nunion < limit ? nunion : limit),
+          "rbtree", "union_size with limit", round);
+
+    /* a n b n a is a n b; a u b u a is a u b */
+    sets[0] = a;
+    sets[1] = b;
+    sets[2] = a;
+    result = set_intersection_many(sets, 3);
+    check(set_size(result) == ninter, "rbtree", "intersection_many", round);
+    set_destroy(result);
+    result = set_union_many(sets, 3);
+    n = rb_elements(result, scratch);
+    check(n == nunion && memcmp(scratch, ref, sizeof(int) * n) == 0,
+          "rbtree", "union_many", round);
+    set_destroy(result);
+
+    /* Seeking an increasing sequence of keys finds their lower bounds */
+    it = set_createiter(result = set_union(a, b));
+    for (i = 0, key = 0; i < 8 && nunion > 0; i++) {
+        int j = 0;
+        key += next_random() % 64;
+        set_iter_seek(it, &key);
+        while (j < nunion && ref[j] < key)
+            j++;
+        check(set_hasnext(it) == (j < nunion), "rbtree", "iter_seek", round);
+        if (j < nunion)
+            check(*(int *)set_next(it) == ref[j], "rbtree", "iter_seek", round);
+        /* The next seek starts after the element just returned */
+        if (j < nunion)
+            key = ref[j] + 1;
+    }
+    set_destroyiter(it);
+    set_destroy(result);
+    free(scratch);
+}
+
+enum setop { OP_UNION, OP_INTERSECTION, OP_DIFFERENCE };
+
+static char *setop_names[] = { "union", "intersection", "difference" };
+
+static void *apply(struct setbackend *b, enum setop op, void *x, void *y)
+{
+    switch (op) {
+    case OP_UNION:
+        return b->setunion(x, y);
+    case OP_INTERSECTION:
+        return b->intersection(x, y);
+    default:
+        return b->difference(x, y);
+    }
+}
+
+static void test_sets(int round, int *pool, int range)
+{
+    void *a[NUMSETBACKENDS], *b[NUMSETBACKENDS], *r;
+    int *unionref, *expected, *scratch, na, nb, n, i, k, key, expect = 0;
+    int sizes[3];
+    enum setop op;
+
+    na = next_random() % 2000;
+    nb = next_random() % 2000;
+    unionref = malloc(sizeof(int) * (na + nb + 1));
+    expected = malloc(sizeof(int) * (na + nb + 1));
+    scratch = malloc(sizeof(int) * (na + nb + 1));
+    if (unionref == NULL || expected == NULL || scratch == NULL)
+        fatal_error("out of memory");
+    for (k = 0; k < NUMSETBACKENDS; k++) {
+        a[k] = setbackends[k].create();
+        b[k] = setbackends[k].create();
+    }
+
+    /* Interleave adds with membership queries */
+    for (i = 0; i < na + nb; i++) {
+        int *elem = &pool[next_random() % range];
+        key = next_random() % range;
+        for (k = 0; k < NUMSETBACKENDS; k++) {
+            setbackends[k].add(i < na ? a[k] : b[k], elem);
+            if (k == 0)
+                expect = setbackends[k].contains(a[k], key);
+            else
+                check(setbackends[k].contains(a[k], key) == expect,
+                      setbackends[k].name, "contains", round);
+        }
+    }
+
+    n = setbackends[0].elements(a[0], expected);
+    for (k = 1; k < NUMSETBACKENDS; k++)
+        check_set(&setbackends[k], a[k], expected, n, scratch, "add", round);
+
+    for (op = OP_UNION; op <= OP_DIFFERENCE; op++) {
+        r = apply(&setbackends[0], op, a[0], b[0]);
+        sizes[op] = setbackends[0].elements(r, expected);
+        setbackends[0].destroy(r);
+        if (op == OP_UNION)
+            memcpy(unionref, expected, sizeof(int) * sizes[op]);
+        for (k = 1; k < NUMSETBACKENDS; k++) {
+            r = apply(&setbackends[k], op, a[k], b[k]);
+            check_set(&setbackends[k], r, expected, sizes[op], scratch,
+                      setop_names[op], round);
+            setbackends[k].destroy(r);
+        }
+    }
+
+    for (k = 0; k < NUMSETBACKENDS; k++) {
+        if (setbackends[k].create == rb_create)
+            check_setextras(a[k], b[k], unionref, sizes[OP_UNION],
+                            sizes[OP_INTERSECTION], sizes[OP_DIFFERENCE],
+                            round);
+    }
+
+    for (k = 0; k < NUMSETBACKENDS; k++) {
+        setbackends[k].destroy(a[k]);
+        setbackends[k].destroy(b[k]);
+    }
+    free(unionref);
+    free(expected);
+    free(scratch);
+}
+
+static void test_lists(int round, int *pool, int range)
+{
+    void *l[NUMLISTBACKENDS];
+    int *ref, *scratch, nops, i, k, n;
+
+    nops = next_random() % 2000;
+    ref = malloc(sizeof(int) * (nops + 1));
+    scratch = malloc(sizeof(int) * (nops + 1));
+    if (ref == NULL || scratch == NULL)
+        fatal_error("out of memory");
+    for (k = 0; k < NUMLISTBACKENDS; k++)
+        l[k] = listbackends[k].create();
+
+    for (i = 0; i < nops; i++) {
+        int op = next_random() % 8, key = next_random() % range;
+        int *elem = &pool[key];
+        int popped = -1, found = 0;
+
+        for (k = 0; k < NUMLISTBACKENDS; k++) {
+            struct listbackend *b = &listbackends[k];
+            int p = -1, f = 0;
+
+            if (op < 3)
+                b->addfirst(l[k], elem);
+            else if (op < 6)
+                b->addlast(l[k], elem);
+            else if (op == 6 && b->size(l[k]) > 0)
+                p = (key & 1) ? b->popfirst(l[k]) : b->poplast(l[k]);
+            else
+                f = b->contains(l[k], key);
+            if (k == 0) {
+                popped = p;
+                found = f;
+            }
+            else {
+                check(p == popped, b->name, "pop", round);
+                check(f == found, b->name, "contains", round);
+            }
+        }
+    }
+
+    n = listbackends[0].elements(l[0], ref);
+    for (k = 1; k < NUMLISTBACKENDS; k++) {
+        check(listbackends[k].size(l[k]) == n, listbackends[k].name, "size",
+              round);
+        check(listbackends[k].elements(l[k], scratch) == n &&
+              memcmp(scratch, ref, sizeof(int) * n) == 0,
+              listbackends[k].name, "order", round);
+        if (listbackends[k].size == ll_size) {
+            /* A node per element, and the list itself */
+            alloc_stats_t mem;
+            list_memstats(l[k], &mem);
+            check(mem.allocs - mem.frees == (uint64_t)n + 1,
+                  listbackends[k].name, "memstats", round);
+        }
+    }
+    for (k = 0; k < NUMLISTBACKENDS; k++)
+        listbackends[k].sort(l[k]);
+    n = listbackends[0].elements(l[0], ref);
+    for (k = 1; k < NUMLISTBACKENDS; k++) {
+        check(listbackends[k].elements(l[k], scratch) == n &&
+              memcmp(scratch, ref, sizeof(int) * n) == 0,
+              listbackends[k].name, "sort", round);
+    }
+
+    for (k = 0; k < NUMLISTBACKENDS; k++)
+        listbackends[k].destroy(l[k]);
+    free(ref);
+    free(scratch);
+}
+
+static void run_tests(int rounds)
+{
+    int *pool, i, j, range;
+
+    for (i = 0; i < rounds; i++) {
+        /* Vary how dense the keys are, and so how often sets overlap */
+        range = 1 + next_random() % 5000;
+        pool = malloc(sizeof(int) * range);
+        if (pool == NULL)
+            fatal_error("out of memory");
+        for (j = 0; j < range; j++)
+            pool[j] = j;
+        test_sets(i, pool, range);
+        test_lists(i, pool, range);
+        free(pool);
+
+        /* Everything taken from the allocators has been given back */
+        check(rbpool == NULL || rbpool->stats.live == 0, "rbtree-pool",
+              "live bytes", i);
+        check(rbarena == NULL || rbarena->stats.live == 0, "rbtree-arena",
+              "live bytes", i);
+        check(llpool == NULL || llpool->stats.live == 0, "linkedlist-pool",
+              "live bytes", i);
+        if (arena != NULL)
+            arena_reset(arena);
+        if (ssoarena != NULL)
+            arena_reset(ssoarena);
+    }
+    printf("%d round(s) passed: %d set backend(s), %d list backend(s)\n",
+           rounds, NUMSETBACKENDS, NUMLISTBACKENDS);
+}
+
+/*
+ * Benchmark.  Each operation is timed over enough calls to cover about
+ * ops elements, and reported in nanoseconds per element.
+ */
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *dist_names[] = { "uniform", "sequential", "zipf" };
+
+static void report(char *backend, char *op, int size, enum distribution dist,
+                   long count, double seconds)
+{
+    printf("backend=%s op=%s size=%d dist=%s ops=%ld ns_per_op=%.1f\n",
+           backend, op, size, dist_names[dist], count,
+           seconds * 1e9 / (count > 0 ? count : 1));
+    fflush(stdout);
+}
+
+static void bench_set(struct setbackend *b, int *keys, int *keys2,
+                      int *probes, int size, long ops, enum distribution dist)
+{
+    void *a, *c, *r;
+    long i, reps, count;
+    double start;
+    int *scratch;
+    volatile long sink = 0;
+
+    a = b->create();
+    c = b->create();
+    start = now();
+    for (i = 0; i < size; i++)
+        b->add(a, &keys[i]);
+    sink += b->size(a);
+    report(b->name, "add", size, dist, size, now() - start);
+    for (i = 0; i < size; i++)
+        b->add(c, &keys2[i]);
+    sink += b->size(c);
+
+    start = now();
+    for (i = 0; i < ops; i++)
+        sink += b->contains(a, probes[i % size]);
+    report(b->name, "contains", size, dist, ops, now() - start);
+
+    /* Set operations touch every element of both inputs */
+    count = b->size(a) + b->size(c);
+    reps = ops / (count > 0 ? count : 1);
+    reps = reps > 0 ? reps : 1;
+    start = now();
+    for (i = 0; i < reps; i++) {
+        r = b->setunion(a, c);
+        sink += b->size(r);
+        b->destroy(r);
+    }
+    report(b->name, "union", size, dist, reps * count, now() - start);
+    start = now();
+    for (i = 0; i < reps; i++) {
+        r = b->intersection(a, c);
+        sink += b->size(r);
+        b->destroy(r);
+    }
+    report(b->name, "intersection", size, dist, reps * count, now() - start);
+    start = now();
+    for (i = 0; i < reps; i++) {
+        r = b->difference(a, c);
+        sink += b->size(r);
+        b->destroy(r);
+    }
+    report(b->name, "difference", size, dist, reps * count, now() - start);
+
+    scratch = malloc(sizeof(int) * (b->size(a) + 1));
+    if (scratch == NULL)
+        fatal_error("out of memory");
+    count = b->size(a);
+    reps = ops / (count > 0 ? count : 1);
+    reps = reps > 0 ? reps : 1;
+    start = now();
+    for (i = 0; i < reps; i++)
+        sink += b->elements(a, scratch);
+    report(b->name, "iterate", size, dist, reps * count, now() - start);
+
+    free(scratch);
+    b->destroy(a);
+    b->destroy(c);
+}
+
+static void bench_list(struct listbackend *b, int *keys, int *probes, int size,
+                       long ops, enum distribution dist)
+{
+    void *l;
+    long i, reps;
+    double start;
+    int *scratch;
+    volatile long sink = 0;
+
+    l = b->create();
+    start = now();
+    for (i = 0; i < size; i++)
+        b->addlast(l, &keys[i]);
+    report(b->name, "addlast", size, dist, size, now() - start);
+    start = now();
+    for (i = 0; i < size; i++)
+        sink += b->popfirst(l);
+    report(b->name, "popfirst", size, dist, size, now() - start);
+    start = now();
+    for (i = 0; i < size; i++)
+        b->addfirst(l, &keys[i]);
+    report(b->name, "addfirst", size, dist, size, now() - start);
+
+    /* Lookups scan the list, so count the elements scanned */
+    reps = ops / (size > 0 ? size : 1);
+    reps = reps > 0 ? reps : 1;
+    start = now();
+    for (i = 0; i < reps; i++)
+        sink += b->contains(l, probes[i % size]);
+    report(b->name, "contains", size, dist, reps * size, now() - start);
+
+    scratch = malloc(sizeof(int) * (size + 1));
+    if (scratch == NULL)
+        fatal_error("out of memory");
+    start = now();
+    for (i = 0; i < reps; i++)
+        sink += b->elements(l, scratch);
+    report(b->name, "iterate", size, dist, reps * size, now() - start);
+
+    start = now();
+    b->sort(l);
+    report(b->name, "sort", size, dist, size, now() - start);
+
+    free(scratch);
+    b->destroy(l);
+}
+
+static void run_bench(int size, long ops, enum distribution dist,
+                      char *only)
+{
+    int *keys, *keys2, *probes, range = 4 * size, k;
+
+    keys = malloc(sizeof(int) * size);
+    keys2 = malloc(sizeof(int) * size);
+    probes = malloc(sizeof(int) * size);
+    if (keys == NULL || keys2 == NULL || probes == NULL)
+        fatal_error("out of memory");
+    make_keys(keys, size, range, dist);
+    make_keys(keys2, size, range, dist);
+    make_keys(probes, size, range, DIST_UNIFORM);
+
+    for (k = 0; k < NUMSETBACKENDS; k++) {
+        if (only == NULL || strcmp(only, setbackends[k].name) == 0)
+            bench_set(&setbackends[k], keys, keys2, probes, size, ops, dist);
+    }
+    for (k = 0; k < NUMLISTBACKENDS; k++) {
+        if (only == NULL || strcmp(only, listbackends[k].name) == 0)
+            bench_list(&listbackends[k], keys, probes, size, ops, dist);
+    }
+    free(keys);
+    free(keys2);
+    free(probes);
+}
+
+static void usage(char *progname)
+{
+    fprintf(stderr,
+            "usage: %s\n"
+            "       %s test [-i rounds] [-s seed]\n"
+            "       %s bench [-n size] [-o ops] [-d uniform|sequential|zipf]\n"
+            "                [-s seed] [-b backend]\n",
+            progname, progname, progname);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int opt, rounds = 200, size = 1000000;
+    long ops = 1000000;
+    enum distribution dist = DIST_UNIFORM;
+    char *only = NULL;
+
+    if (argc < 2) {
+        demo();
+        return 0;
+    }
+    if (strcmp(argv[1], "test") != 0 && strcmp(argv[1], "bench") != 0)
+        usage(argv[0]);
+    optind = 2;
+    while ((opt = getopt(argc, argv, "i:s:n:o:d:b:")) != -1) {
+        switch (opt) {
+        case 'i': rounds = atoi(optarg); break;
+        case 's': rng_state = strtoull(optarg, NULL, 10) | 1; break;
+        case 'n': size = atoi(optarg); break;
+        case 'o': ops = atol(optarg); break;
+        case 'd':
+            if (strcmp(optarg, "uniform") == 0)
+                dist = DIST_UNIFORM;
+            else if (strcmp(optarg, "sequential") == 0)
+                dist = DIST_SEQUENTIAL;
+            else if (strcmp(optarg, "zipf") == 0)
+                dist = DIST_ZIPF;
+            else
+                usage(argv[0]);
+            break;
+        case 'b': only = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || rounds < 1 || size < 1 || ops < 1)
+        usage(argv[0]);
+
+    if (strcmp(argv[1], "test") == 0)
+        run_tests(rounds);
+    else
+        run_bench(size, ops, dist, only);
+    return 0;
+}
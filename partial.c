@@ -0,0 +1,290 @@
+#include "partial.h"
+#include "list.h"
+#include "set.h"
+#include "arena.h"
+#include "hash.h"
+#include "setexpr.h"
+#include "spill.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define PARTIAL_MAGIC   "SPFP"
+#define PARTIAL_VERSION 1
+
+/*
+ * On-disk layout of a partial model:
+ *
+ *   struct partial_header
+ *   numspam NUL-terminated spam-side words
+ *   numham NUL-terminated non-spam-side words
+ *
+ * The checksum covers everything after the header.
+ */
+struct partial_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t spamdocs;
+    uint32_t hamdocs;
+    uint32_t numspam;
+    uint32_t numham;
+    uint64_t checksum;
+};
+
+/*
+ * While spamdocs is zero, the spam side stands for every word, and the
+ * spam set is empty and unused.  The spam side is never larger than the
+ * smallest spam mail, but the non-spam side grows with the corpus, so
+ * it is kept in a spilled set.
+ */
+struct partial {
+    set_t *spam;        /* Words in every spam mail */
+    spill_t *ham;       /* Words in any non-spam mail */
+    int spamdocs;
+    int hamdocs;
+    arena_t *arena;     /* Owns the words of the spam set */
+};
+
+/* Memory budget of the non-spam sides, or 0 for no limit */
+static size_t memlimit;
+
+void partial_setmemlimit(size_t limit)
+{
+    memlimit = limit;
+}
+
+static partial_t *partial_create(void)
+{
+    partial_t *partial = malloc(sizeof(partial_t));
+
+    if (partial == NULL)
+        fatal_error("out of memory");
+    partial->spam = set_create(compare_words);
+    partial->ham = spill_create(memlimit);
+    partial->spamdocs = 0;
+    partial->hamdocs = 0;
+    partial->arena = arena_create();
+    return partial;
+}
+
+partial_t *partial_train(list_t *spamfiles, list_t *hamfiles)
+{
+    partial_t *partial = partial_create();
+    arena_t *doc = arena_create();
+    list_iter_t *iter;
+    setexpr_t *expr;
+
+    set_destroy(partial->spam);
+    expr = setexpr_alldocs(spamfiles);
+    partial->spam = setexpr_eval(expr, partial->arena);
+    setexpr_destroy(expr);
+
+    iter = list_createiter(hamfiles);
+    while (list_hasnext(iter)) {
+        set_t *words = tokenize(list_next(iter), doc);
+        set_iter_t *witer = set_createiter(words);
+        while (set_hasnext(witer))
+            spill_add(partial->ham, set_next(witer));
+        set_destroyiter(witer);
+        set_destroy(words);
+        arena_reset(doc);
+    }
+    list_destroyiter(iter);
+    arena_destroy(doc);
+    partial->spamdocs = list_size(spamfiles);
+    partial->hamdocs = list_size(hamfiles);
+    return partial;
+}
+
+void partial_destroy(partial_t *partial)
+{
+    set_destroy(partial->spam);
+    spill_destroy(partial->ham);
+    arena_destroy(partial->arena);
+    free(partial);
+}
+
+void partial_merge(partial_t *dst, partial_t *src)
+{
+    spill_iter_t *hamiter;
+
+    if (dst->spamdocs == 0) {
+        set_iter_t *iter = set_createiter(src->spam);
+        while (set_hasnext(iter)) {
+            char *word = arena_strdup(dst->arena, set_next(iter));
+            set_add(dst->spam, word, word);
+        }
+        set_destroyiter(iter);
+    }
+    else if (src->spamdocs > 0) {
+        set_t *spam = set_intersection(dst->spam, src->spam);
+        set_destroy(dst->spam);
+        dst->spam = spam;
+    }
+    hamiter = spill_createiter(src->ham);
+    while (spill_hasnext(hamiter))
+        spill_add(dst->ham, spill_next(hamiter));
+    spill_destroyiter(hamiter);
+    dst->spamdocs += src->spamdocs;
+    dst->hamdocs += src->hamdocs;
+}
+
+int partial_spamdocs(partial_t *partial)
+{
+    return partial->spamdocs;
+}
+
+int partial_hamdocs(partial_t *partial)
+{
+    return partial->hamdocs;
+}
+
+/*
+ * The spam words are the spam side minus the non-spam side.  Both come
+ * out in order, so they are walked side by side, and the non-spam side
+ * is never read into memory.
+ */
+set_t *partial_spamwords(partial_t *partial)
+{
+    set_t *spamwords = set_create(compare_words);
+    set_iter_t *iter;
+    spill_iter_t *hamiter;
+    char *ham = NULL;
+
+    if (partial->spamdocs == 0)
+        return spamwords;
+    iter = set_createiter(partial->spam);
+    hamiter = spill_createiter(partial->ham);
+    while (set_hasnext(iter)) {
+        char *word = set_next(iter);
+        while ((ham == NULL || compare_words(ham, word) < 0) &&
+               spill_hasnext(hamiter))
+            ham = spill_next(hamiter);
+        if (ham == NULL || compare_words(ham, word) != 0)
+            set_add(spamwords, word, word);
+    }
+    spill_destroyiter(hamiter);
+    set_destroyiter(iter);
+    return spamwords;
+}
+
+static void put_word(FILE *f, char *word, uint64_t *checksum)
+{
+    size_t len = strlen(word) + 1;
+
+    if (fwrite(word, 1, len, f) != len) {
+        perror("fwrite");
+        fatal_error("fwrite() failed");
+    }
+    *checksum = hash_bytes_more(*checksum, word, len);
+}
+
+/*
+ * The words are written as they are iterated over, and the header,
+ * which counts them, is written last.
+ */
+void partial_save(partial_t *partial, char *filename)
+{
+    struct partial_header header;
+    set_iter_t *iter;
+    spill_iter_t *hamiter;
+    char *tmpname;
+    FILE *f;
+    stats_timer_t timer;
+
+    stats_start(&timer);
+    memcpy(header.magic, PARTIAL_MAGIC, 4);
+    header.version = PARTIAL_VERSION;
+    header.spamdocs = partial->spamdocs;
+    header.hamdocs = partial->hamdocs;
+    header.numspam = set_size(partial->spam);
+    header.numham = 0;
+    header.checksum = hash_bytes(NULL, 0);
+
+    f = save_open(filename, &tmpname);
+    if (fseek(f, sizeof(header), SEEK_SET) != 0) {
+        perror("fseek");
+        fatal_error("fseek() failed");
+    }
+    iter = set_createiter(partial->spam);
+    while (set_hasnext(iter))
+        put_word(f, set_next(iter), &header.checksum);
+    set_destroyiter(iter);
+    hamiter = spill_createiter(partial->ham);
+    while (spill_hasnext(hamiter)) {
+        put_word(f, spill_next(hamiter), &header.checksum);
+        header.numham++;
+    }
+    spill_destroyiter(hamiter);
+
+    rewind(f);
+    if (fwrite(&header, sizeof(header), 1, f) != 1) {
+        perror("fwrite");
+        fatal_error("fwrite() failed");
+    }
+    save_close(f, filename, tmpname);
+    stats_stop(&timer, STAGE_MODEL_IO);
+}
+
+/*
+ * Reads the next word of a partial model file into the buffer.
+ */
+static char *get_word(FILE *f, char **buf, size_t *cap, uint64_t *checksum)
+{
+    ssize_t len = getdelim(buf, cap, '\0', f);
+
+    if (len <= 0 || (*buf)[len - 1] != 0)
+        fatal_error("partial model file is truncated");
+    *checksum = hash_bytes_more(*checksum, *buf, len);
+    return *buf;
+}
+
+/*
+ * The words are read one at a time, so that the non-spam side can go
+ * straight into its spilled set.
+ */
+partial_t *partial_load(char *filename)
+{
+    struct partial_header header;
+    partial_t *partial;
+    char *buf = NULL, *word;
+    size_t cap = 0;
+    uint64_t checksum = hash_bytes(NULL, 0);
+    uint32_t i;
+    FILE *f;
+    stats_timer_t timer;
+
+    stats_start(&timer);
+    f = fopen(filename, "rb");
+    if (f == NULL) {
+        perror("fopen");
+        fatal_error("fopen() failed");
+    }
+    if (fread(&header, sizeof(header), 1, f) != 1)
+        fatal_error("partial model file is truncated");
+    if (memcmp(header.magic, PARTIAL_MAGIC, 4) != 0)
+        fatal_error("not a partial model file");
+    if (header.version != PARTIAL_VERSION)
+        fatal_error("unsupported partial model file version");
+
+    partial = partial_create();
+    for (i = 0; i < header.numspam; i++) {
+        word = arena_strdup(partial->arena, get_word(f, &buf, &cap, &checksum));
+        set_add(partial->spam, word, word);
+    }
+    for (i = 0; i < header.numham; i++)
+        spill_add(partial->ham, get_word(f, &buf, &cap, &checksum));
+    if (getc(f) != EOF)
+        fatal_error("partial model file is corrupt");
+    fclose(f);
+    free(buf);
+    if (checksum != header.checksum)
+        fatal_error("partial model file checksum mismatch");
+    partial->spamdocs = header.spamdocs;
+    partial->hamdocs = header.hamdocs;
+    stats_stop(&timer, STAGE_MODEL_IO);
+    return partial;
+}
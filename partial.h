@@ -0,0 +1,70 @@
+#ifndef PARTIAL_H
+#define PARTIAL_H
+
+#include "common.h"
+
+/*
+ * A partial model is what training on one shard of the corpora leaves
+ * behind: the words found in every spam mail of the shard, the words
+ * found in any non-spam mail of the shard, and the number of mails of
+ * each kind.  Partials trained on disjoint shards merge into the
+ * partial of their union, in any order and grouping, and the spam words
+ * of the final partial are the same as those of training on all the
+ * mails at once.
+ */
+struct partial;
+typedef struct partial partial_t;
+
+/*
+ * Caps the memory taken by the non-spam side of each partial model
+ * created from now on at about the given number of bytes, spilling the
+ * rest to temporary files, or lifts the cap if limit is 0.
+ */
+void partial_setmemlimit(size_t limit);
+
+/*
+ * Trains a partial model on the given lists of spam and non-spam file
+ * names.
+ */
+partial_t *partial_train(struct list *spamfiles, struct list *hamfiles);
+
+/*
+ * Destroys the given partial model.
+ */
+void partial_destroy(partial_t *partial);
+
+/*
+ * Merges the partial model src into dst.  src is left unchanged.
+ * Several partial models may be read from disk and merged one after
+ * the other without the non-spam side of any of them having to fit in
+ * memory.
+ */
+void partial_merge(partial_t *dst, partial_t *src);
+
+/*
+ * Returns the number of spam and non-spam mails the given partial model
+ * was trained on.
+ */
+int partial_spamdocs(partial_t *partial);
+int partial_hamdocs(partial_t *partial);
+
+/*
+ * Returns the set of spam words of the given partial model: the words
+ * found in every spam mail and in no non-spam mail.  The words are
+ * owned by the partial model, so the set must be destroyed before it.
+ */
+struct set *partial_spamwords(partial_t *partial);
+
+/*
+ * Writes the given partial model to the given file.
+ */
+void partial_save(partial_t *partial, char *filename);
+
+/*
+ * Reads a partial model previously written with partial_save().
+ * Terminates the program if the file is not a valid partial model of
+ * the current version, or if its checksum does not match.
+ */
+partial_t *partial_load(char *filename);
+
+#endif
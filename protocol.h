@@ -0,0 +1,28 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+/*
+ * Wire protocol spoken by the classifier daemon ('spamfilter serve')
+ * over its Unix domain socket.
+ *
+ * Every request and response is a frame: a 4-byte big-endian payload
+ * length, followed by that many bytes of payload.  The first payload
+ * byte gives the frame type, and the rest of the payload depends on it:
+ *
+ *   PROTO_PATH     request; the path of a mail file readable by the server
+ *   PROTO_MESSAGE  request; the raw bytes of a mail
+ *   PROTO_RESULT   response; the number of spam words, in decimal
+ *   PROTO_ERROR    response; a human-readable error message
+ *
+ * A client may send any number of requests on one connection, and may
+ * pipeline them.  Responses come back in request order.
+ */
+#define PROTO_PATH    'P'
+#define PROTO_MESSAGE 'M'
+#define PROTO_RESULT  'R'
+#define PROTO_ERROR   'E'
+
+/* Largest payload accepted, in bytes */
+#define PROTO_MAXFRAME (64 * 1024 * 1024)
+
+#endif
@@ -0,0 +1,546 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "protocol.h"
+#include "set.h"
+#include "arena.h"
+#include "stats.h"
+#include "ngram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define MAXEVENTS 64
+#define READSIZE  65536
+
+/* A growable byte buffer */
+struct buffer {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+/* A client connection, owned by the event loop */
+struct conn {
+    int fd;
+    struct buffer in;
+    struct buffer out;
+    int busy;       /* One of our requests is with the workers */
+    int eof;        /* The peer has stopped sending */
+    int dead;       /* Closed; freed at the end of the current batch */
+    uint32_t events;
+    struct conn *nextdead;
+};
+
+/* A request travelling from the event loop to a worker and back */
+struct job {
+    struct conn *conn;
+    char *payload;
+    size_t len;
+    char response[64];
+    struct job *next;
+};
+
+struct server {
+    scorefunc_t score;
+    void *model;
+    int epfd;
+    int eventfd;
+    int listenfd;
+    struct conn *deadlist;
+
+    /* Shared with the workers, protected by lock */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct job *todo;
+    struct job *todotail;
+    struct job *done;
+    int stopping;
+};
+
+/* Markers telling the socket events apart from the connection events */
+static char listen_marker, event_marker;
+
+static volatile sig_atomic_t stop_requested;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void buffer_reserve(struct buffer *buf, size_t extra)
+{
+    if (buf->len + extra <= buf->cap)
+        return;
+    while (buf->len + extra > buf->cap)
+        buf->cap = buf->cap ? 2 * buf->cap : READSIZE;
+    buf->data = realloc(buf->data, buf->cap);
+    if (buf->data == NULL)
+        fatal_error("out of memory");
+}
+
+static void buffer_append(struct buffer *buf, const void *data, size_t len)
+{
+    buffer_reserve(buf, len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static void buffer_consume(struct buffer *buf, size_t len)
+{
+    memmove(buf->data, buf->data + len, buf->len - len);
+    buf->len -= len;
+}
+
+static uint32_t get_be32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) |
+           ((uint32_t)u[2] << 8) | (uint32_t)u[3];
+}
+
+static void put_be32(char *p, uint32_t v)
+{
+    p[0] = (char)(v >> 24);
+    p[1] = (char)(v >> 16);
+    p[2] = (char)(v >> 8);
+    p[3] = (char)v;
+}
+
+/*
+ * Classifies the mail named or carried by the given request, and fills
+ * in the response payload.
+ */
+static void handle_job(struct server *server, struct job *job, arena_t *arena,
+                       ngram_t *ng)
+{
+    set_t *words;
+    FILE *f;
+    int count;
+
+    if (job->len < 1 ||
+        (job->payload[0] != PROTO_PATH && job->payload[0] != PROTO_MESSAGE)) {
+        snprintf(job->response, sizeof(job->response), "%cbad request",
+                 PROTO_ERROR);
+        return;
+    }
+    if (job->payload[0] == PROTO_PATH) {
+        job->payload[job->len] = 0;
+        f = fopen(job->payload + 1, "r");
+    }
+    else if (job->len > 1) {
+        f = fmemopen(job->payload + 1, job->len - 1, "r");
+    }
+    else {
+        f = fopen("/dev/null", "r");
+    }
+    if (f == NULL) {
+        snprintf(job->response, sizeof(job->response), "%c%s",
+                 PROTO_ERROR, strerror(errno));
+        return;
+    }
+    /* Spam phrases, if any, are scanned in the same pass as the words */
+    words = tokenize_stream_tap(f, arena, ng != NULL ? ngram_tap : NULL, ng);
+    count = server->score(server->model, words) + classify_phrases(ng);
+    fclose(f);
+    snprintf(job->response, sizeof(job->response), "%c%d",
+             PROTO_RESULT, count);
+    set_destroy(words);
+    arena_reset(arena);
+}
+
+static void *worker_main(void *arg)
+{
+    struct server *server = arg;
+    struct job *job;
+    uint64_t one = 1, start;
+    arena_t *arena = arena_create();
+    ngram_t *ng = classify_phrasescanner();
+
+    while (1) {
+        pthread_mutex_lock(&server->lock);
+        while (server->todo == NULL && !server->stopping)
+            pthread_cond_wait(&server->cond, &server->lock);
+        if (server->stopping) {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+        job = server->todo;
+        server->todo = job->next;
+        if (server->todo == NULL)
+            server->todotail = NULL;
+        pthread_mutex_unlock(&server->lock);
+
+        start = stats_now();
+        handle_job(server, job, arena, ng);
+        stats_latency(stats_now() - start);
+
+        pthread_mutex_lock(&server->lock);
+        job->next = server->done;
+        server->done = job;
+        pthread_mutex_unlock(&server->lock);
+        if (write(server->eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("write");
+    }
+    if (ng != NULL)
+        ngram_destroy(ng);
+    arena_destroy(arena);
+    return NULL;
+}
+
+static void conn_kill(struct server *server, struct conn *conn)
+{
+    if (conn->dead)
+        return;
+    epoll_ctl(server->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    conn->dead = 1;
+    conn->nextdead = server->deadlist;
+    server->deadlist = conn;
+}
+
+static void conn_setevents(struct server *server, struct conn *conn)
+{
+    struct epoll_event ev;
+    uint32_t events = 0;
+
+    /* Stop reading while a full frame is already waiting to be served */
+    if (!conn->eof && conn->in.len <= (size_t)PROTO_MAXFRAME + 4)
+        events |= EPOLLIN;
+    if (conn->out.len > 0)
+        events |= EPOLLOUT;
+
+    if (events == conn->events)
+        return;
+    ev.events = events;
+    ev.data.ptr = conn;
+    epoll_ctl(server->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+    conn->events = events;
+}
+
+/*
+ * Writes as much of the output buffer as the socket accepts.
+ */
+static void conn_flush(struct server *server, struct conn *conn)
+{
+    size_t sent = 0;
+    ssize_t n;
+
+    while (sent < conn->out.len) {
+        n = send(conn->fd, conn->out.data + sent, conn->out.len - sent,
+                 MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            conn_kill(server, conn);
+            return;
+        }
+        sent += n;
+    }
+    buffer_consume(&conn->out, sent);
+}
+
+/*
+ * Hands the next complete request of an idle connection to the workers.
+ * Requests of one connection are processed one at a time so that the
+ * responses go out in request order.  Closes the connection once it has
+ * nothing more to do.
+ */
+static void conn_dispatch(struct server *server, struct conn *conn)
+{
+    struct job *job;
+    uint32_t len;
+
+    if (conn->dead || conn->busy)
+        return;
+    if (conn->in.len >= 4) {
+        len = get_be32(conn->in.data);
+        if (len == 0 || len > PROTO_MAXFRAME) {
+            conn_kill(server, conn);
+            return;
+        }
+        if (conn->in.len >= 4 + (size_t)len) {
+            job = malloc(sizeof(struct job));
+            if (job == NULL)
+                fatal_error("out of memory");
+            job->payload = malloc((size_t)len + 1);
+            if (job->payload == NULL)
+                fatal_error("out of memory");
+            memcpy(job->payload, conn->in.data + 4, len);
+            job->len = len;
+            job->conn = conn;
+            job->next = NULL;
+            buffer_consume(&conn->in, 4 + (size_t)len);
+            conn->busy = 1;
+
+            pthread_mutex_lock(&server->lock);
+            if (server->todotail != NULL)
+                server->todotail->next = job;
+            else
+                server->todo = job;
+            server->todotail = job;
+            pthread_cond_signal(&server->cond);
+            pthread_mutex_unlock(&server->lock);
+            return;
+        }
+    }
+    if (conn->eof && conn->out.len == 0)
+        conn_kill(server, conn);
+}
+
+static void conn_read(struct server *server, struct conn *conn)
+{
+    ssize_t n;
+
+    while (1) {
+        buffer_reserve(&conn->in, READSIZE);
+        n = read(conn->fd, conn->in.data + conn->in.len,
+                 conn->in.cap - conn->in.len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                conn_kill(server, conn);
+            break;
+        }
+        if (n == 0) {
+            conn->eof = 1;
+            break;
+        }
+        conn->in.len += n;
+        if (conn->in.len > (size_t)PROTO_MAXFRAME + 4)
+            break;
+    }
+    conn_dispatch(server, conn);
+}
+
+static void accept_conns(struct server *server)
+{
+    struct epoll_event ev;
+    struct conn *conn;
+    int fd;
+
+    while ((fd = accept4(server->listenfd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+        conn = calloc(1, sizeof(struct conn));
+        if (conn == NULL)
+            fatal_error("out of memory");
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        if (epoll_ctl(server->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            close(fd);
+            free(conn);
+        }
+    }
+}
+
+/*
+ * Queues the responses of the jobs the workers have finished.
+ */
+static void collect_jobs(struct server *server)
+{
+    struct job *job, *next;
+    struct conn *conn;
+    uint64_t count;
+    char header[4];
+
+    if (read(server->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("read");
+    pthread_mutex_lock(&server->lock);
+    job = server->done;
+    server->done = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    for (; job != NULL; job = next) {
+        next = job->next;
+        conn = job->conn;
+        conn->busy = 0;
+        if (!conn->dead) {
+            put_be32(header, strlen(job->response));
+            buffer_append(&conn->out, header, 4);
+            buffer_append(&conn->out, job->response, strlen(job->response));
+            conn_flush(server, conn);
+            conn_dispatch(server, conn);
+            if (!conn->dead)
+                conn_setevents(server, conn);
+        }
+        free(job->payload);
+        free(job);
+    }
+}
+
+/*
+ * Frees the connections closed during the last batch of events, unless
+ * a worker still holds one of their requests.
+ */
+static void reap_conns(struct server *server)
+{
+    struct conn **p = &server->deadlist;
+
+    while (*p != NULL) {
+        struct conn *conn = *p;
+        if (conn->busy) {
+            p = &conn->nextdead;
+            continue;
+        }
+        *p = conn->nextdead;
+        free(conn->in.data);
+        free(conn->out.data);
+        free(conn);
+    }
+}
+
+static int listen_on(char *socketpath)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(socketpath) >= sizeof(addr.sun_path))
+        fatal_error("socket path too long");
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("socket");
+        fatal_error("socket() failed");
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketpath);
+    unlink(socketpath);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        fatal_error("bind() failed");
+    }
+    if (listen(fd, SOMAXCONN) < 0) {
+        perror("listen");
+        fatal_error("listen() failed");
+    }
+    return fd;
+}
+
+void serve(char *socketpath, scorefunc_t score, void *model, int nthreads)
+{
+    struct server server;
+    struct epoll_event ev, events[MAXEVENTS];
+    struct sigaction sa;
+    sigset_t stopsigs, oldmask, waitmask;
+    pthread_t *threads;
+    struct job *job;
+    int i, n;
+
+    memset(&server, 0, sizeof(server));
+    server.score = score;
+    server.model = model;
+    pthread_mutex_init(&server.lock, NULL);
+    pthread_cond_init(&server.cond, NULL);
+
+    /*
+     * Stop cleanly on SIGINT and SIGTERM.  They stay blocked, in the
+     * workers too, except while the loop waits in epoll_pwait(), so one
+     * that arrives after the loop has checked stop_requested interrupts
+     * the wait instead of being lost.
+     */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigemptyset(&stopsigs);
+    sigaddset(&stopsigs, SIGINT);
+    sigaddset(&stopsigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopsigs, &oldmask);
+    waitmask = oldmask;
+    sigdelset(&waitmask, SIGINT);
+    sigdelset(&waitmask, SIGTERM);
+
+    server.listenfd = listen_on(socketpath);
+    server.eventfd = eventfd(0, EFD_NONBLOCK);
+    server.epfd = epoll_create1(0);
+    if (server.eventfd < 0 || server.epfd < 0) {
+        perror("epoll");
+        fatal_error("cannot set up event loop");
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_marker;
+    epoll_ctl(server.epfd, EPOLL_CTL_ADD, server.listenfd, &ev);
+    ev.data.ptr = &event_marker;
+    epoll_ctl(server.epfd, EPOLL_CTL_ADD, server.eventfd, &ev);
+
+    threads = malloc(sizeof(pthread_t) * nthreads);
+    if (threads == NULL)
+        fatal_error("out of memory");
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&threads[i], NULL, worker_main, &server) != 0)
+            fatal_error("pthread_create() failed");
+    }
+    fprintf(stderr, "listening on %s with %d worker(s)\n", socketpath,
+            nthreads);
+
+    while (!stop_requested) {
+        n = epoll_pwait(server.epfd, events, MAXEVENTS, -1, &waitmask);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_pwait");
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            struct conn *conn = events[i].data.ptr;
+
+            if (events[i].data.ptr == &listen_marker) {
+                accept_conns(&server);
+                continue;
+            }
+            if (events[i].data.ptr == &event_marker) {
+                collect_jobs(&server);
+                continue;
+            }
+            if (conn->dead)
+                continue;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                conn_read(&server, conn);
+            if (!conn->dead && (events[i].events & EPOLLOUT)) {
+                conn_flush(&server, conn);
+                conn_dispatch(&server, conn);
+            }
+            if (!conn->dead)
+                conn_setevents(&server, conn);
+        }
+        reap_conns(&server);
+    }
+
+    /* Shut down: stop the workers, then drop whatever is left */
+    pthread_mutex_lock(&server.lock);
+    server.stopping = 1;
+    pthread_cond_broadcast(&server.cond);
+    pthread_mutex_unlock(&server.lock);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+    while ((job = server.todo) != NULL) {
+        server.todo = job->next;
+        job->conn->busy = 0;
+        free(job->payload);
+        free(job);
+    }
+    collect_jobs(&server);
+    close(server.listenfd);
+    close(server.eventfd);
+    close(server.epfd);
+    unlink(socketpath);
+    pthread_mutex_destroy(&server.lock);
+    pthread_cond_destroy(&server.cond);
+    pthread_sigmask(SIG_SETMASK, &oldmask, NULL);
+}
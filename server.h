@@ -0,0 +1,18 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "classify.h"
+
+/*
+ * Listens on a Unix domain socket at the given path and answers
+ * classification requests, as described in protocol.h, until the
+ * process receives SIGINT or SIGTERM.
+ *
+ * A single event loop multiplexes all connections with epoll, and hands
+ * complete requests to nthreads worker threads that tokenize and score
+ * them with the given scoring function and model, counting the spam
+ * phrases set with classify_setphrases() as well.
+ */
+void serve(char *socketpath, scorefunc_t score, void *model, int nthreads);
+
+#endif
@@ -5,6 +5,11 @@
 
 #include "set.h"
 #include "common.h"
+#include "stats.h"
+#include "alloc.h"
+
+// Calls the comparison function of the given set, counting the call
+#define COMPARE(set, a, b) (stats_count(STATS_COMPARES, 1), (set)->compare(a, b))
 
 
 // Local defenitions
@@ -23,7 +28,7 @@ static void verify_property_5(snode_t *root);
 static void verify_property_5_helper(snode_t *n, int black_count, int *black_count_path);
 static snode_t *lookup_node(set_t *t, void *key);
 
-static snode_t *new_node(void *key, void *value, color node_color, snode_t *left, snode_t *right);
+static snode_t *new_node(set_t *set, void *key, void *value, color node_color, snode_t *left, snode_t *right);
 static snode_t *lookup_node(set_t *t, void *key);
 static void rotate_left(set_t *t, snode_t *n);
 static void rotate_right(set_t *t, snode_t *n);
@@ -35,9 +40,13 @@ static void insert_case3(set_t *t, snode_t *n);
 static void insert_case4(set_t *t, snode_t *n);
 static void insert_case5(set_t *t, snode_t *n);
 
-static void _set_destroy(snode_t *node);
+static void _set_destroy(set_t *set, snode_t *node);
 static snode_t *maximum_node(snode_t *n);
 static snode_t *minimum_node(snode_t *n);
+static snode_t *successor(snode_t *n);
+static snode_t *lower_bound(set_t *t, snode_t *n, void *key);
+static snode_t *seek_node(set_t *t, snode_t *n, void *key);
+static int intersect(set_t *a, set_t *b, set_t *result, int limit);
 
 //Set node structure
 struct snode    {
@@ -51,6 +60,7 @@ struct snode    {
 //Set iterator structure
 struct set_iter {
     snode_t *node;
+    set_t *set;
 };
 
 //Set structure
@@ -58,6 +68,8 @@ struct set  {
     snode_t *root;
     cmpfunc_t compare;
     int numitems;
+    allocator_t *alloc;
+    alloc_stats_t mem;      // The set itself and its nodes
 };
 
 //Find the grandparent node
@@ -166,7 +178,7 @@ snode_t *lookup_node(set_t *t, void *key)
 {
     snode_t *n = t->root;
     while (n != NULL) {
-        int comp_result = t->compare(key, n->key);
+        int comp_result = COMPARE(t, key, n->key);
         if (comp_result == 0) {
             return n;
         } else if (comp_result < 0) {
@@ -224,22 +236,34 @@ void replace_node(set_t *t, snode_t *oldn, snode_t *newn)
 //Creates a new set
 set_t *set_create(cmpfunc_t compare)
 {
-    set_t *set;
-    set = (set_t*)malloc(sizeof(set_t));
-    if (set == NULL)
-        return NULL;
-    
+    return set_create_alloc(compare, alloc_default());
+}
+
+//Creates a new set whose memory comes from the given allocator
+set_t *set_create_alloc(cmpfunc_t compare, allocator_t *alloc)
+{
+    alloc_stats_t mem = { 0 };
+    set_t *set = alloc_get(alloc, sizeof(set_t), &mem);
+
     set->root = NULL;
     set->compare = compare;
     set->numitems = 0;
+    set->alloc = alloc;
+    set->mem = mem;
     verify_properties(set);
     return set;
 }
 
+void set_memstats(set_t *set, alloc_stats_t *stats)
+{
+    *stats = set->mem;
+}
+
 /* Create new node */
-snode_t *new_node(void *key, void *value, color node_color, snode_t *left, snode_t *right)
+snode_t *new_node(set_t *set, void *key, void *value, color node_color, snode_t *left, snode_t *right)
 {
-    snode_t *result = (snode_t*)malloc(sizeof(snode_t));
+    snode_t *result = alloc_get(set->alloc, sizeof(snode_t), &set->mem);
+    stats_count(STATS_NODE_ALLOCS, 1);
     result->key = key;
     result->value = value;
     result->color = node_color;
@@ -253,17 +277,20 @@ snode_t *new_node(void *key, void *value, color node_color, snode_t *left, snode
 
 void set_destroy(set_t *set)
 {
+    alloc_stats_t mem;
+
     if (set->root != NULL)
-        _set_destroy(set->root);
-    free(set);
+        _set_destroy(set, set->root);
+    mem = set->mem;
+    alloc_put(set->alloc, set, sizeof(set_t), &mem);
 }
 
-void _set_destroy(snode_t *node)
+void _set_destroy(set_t *set, snode_t *node)
 {
     if (node == NULL) return;
-    _set_destroy(node->left);
-    _set_destroy(node->right);
-    free(node);
+    _set_destroy(set, node->left);
+    _set_destroy(set, node->right);
+    alloc_put(set->alloc, node, sizeof(snode_t), &set->mem);
     
 }
 
@@ -275,17 +302,17 @@ int set_size(set_t *set)
 //Adds a element to the set
 void set_add(set_t *set, void *key, void *elem)
 {
-    snode_t *inserted_node = new_node(key, elem, RED, NULL, NULL);
+    snode_t *inserted_node = new_node(set, key, elem, RED, NULL, NULL);
     if (set->root == NULL)  {
         set->root = inserted_node;
     }   else    {
         snode_t *n = set->root;
         while (1)   {
-            int comp_results = set->compare(key, n->key);
+            int comp_results = COMPARE(set, key, n->key);
             if (comp_results == 0)  {
                 n->value = elem;
                 // Clean up inserted node, it is not used
-                free(inserted_node);
+                alloc_put(set->alloc, inserted_node, sizeof(snode_t), &set->mem);
                 return;
             }   else if (comp_results < 0)   {
                 if (n->left == NULL)    {
@@ -376,9 +403,17 @@ int set_contains(set_t *set, void *key)
     return n == NULL ? 0 : 1;
 }
 
+void *set_get(set_t *set, void *key)
+{
+    snode_t *n = lookup_node(set, key);
+    return n == NULL ? NULL : n->value;
+}
+
 // Union of the given sets
 set_t *set_union(set_t *a, set_t *b)
 {
+    stats_timer_t timer;
+    stats_start(&timer);
     set_t *unionset = set_copy(a);
     set_iter_t *iter = set_createiter(b);
     
@@ -386,28 +421,28 @@ set_t *set_union(set_t *a, set_t *b)
         set_add(unionset, iter->node->key, iter->node->value);
         set_next(iter);
     }
+    set_destroyiter(iter);
+    stats_stop(&timer, STAGE_UNION);
     return unionset;
 }
 
 // Intersection of the given sets
 set_t *set_intersection(set_t *a, set_t *b)
 {
-    set_t *intersect = set_create(a->compare);
-    set_iter_t *iter = set_createiter(a); 
-    
-    while (set_hasnext(iter) != 0)  {
-        if (set_contains(b, iter->node->key))    {
-            set_add(intersect, iter->node->key, iter->node->value);
-        }
-        set_next(iter);
-    }
-    return intersect;
+    stats_timer_t timer;
+    stats_start(&timer);
+    set_t *result = set_create_alloc(a->compare, a->alloc);
+    intersect(a, b, result, 0);
+    stats_stop(&timer, STAGE_INTERSECTION);
+    return result;
 }
 
 // Difference of the given sets
 set_t *set_difference(set_t *a, set_t *b)
 {
-    set_t *difference = set_create(a->compare);
+    stats_timer_t timer;
+    stats_start(&timer);
+    set_t *difference = set_create_alloc(a->compare, a->alloc);
     set_iter_t *iter = set_createiter(a); 
     
     while (set_hasnext(iter) != 0)  {
@@ -416,24 +451,268 @@ set_t *set_difference(set_t *a, set_t *b)
         }
         set_next(iter);
     }
+    set_destroyiter(iter);
+    stats_stop(&timer, STAGE_DIFFERENCE);
     return difference;
     
 }
 
+// Orders sets by increasing size
+static int compare_sizes(const void *a, const void *b)
+{
+    set_t *sa = *(set_t **)a, *sb = *(set_t **)b;
+    return (sa->numitems > sb->numitems) - (sa->numitems < sb->numitems);
+}
+
+// Intersection of many sets
+set_t *set_intersection_many(set_t **sets, int n)
+{
+    set_t *result = set_create_alloc(sets[0]->compare, sets[0]->alloc);
+    set_t **order;
+    snode_t **fingers, *s;
+    int i;
+    stats_timer_t timer;
+
+    assert(n >= 1);
+    stats_start(&timer);
+    order = malloc(sizeof(set_t *) * n);
+    fingers = malloc(sizeof(snode_t *) * n);
+    if (order == NULL || fingers == NULL)
+        fatal_error("out of memory");
+    memcpy(order, sets, sizeof(set_t *) * n);
+    qsort(order, n, sizeof(set_t *), compare_sizes);
+    if (order[0]->numitems == 0)
+        goto done;
+    for (i = 1; i < n; i++)
+        fingers[i] = minimum_node(order[i]->root);
+
+    // Walk the candidates of the smallest set and gallop through the others
+    for (s = minimum_node(order[0]->root); s != NULL; s = successor(s)) {
+        snode_t *keep = s;
+        for (i = 1; i < n; i++) {
+            fingers[i] = seek_node(order[i], fingers[i], s->key);
+            if (fingers[i] == NULL)
+                goto done;      // Set i has nothing left to match
+            if (COMPARE(result, s->key, fingers[i]->key) != 0)
+                break;
+            if (order[i] == sets[0])
+                keep = fingers[i];
+        }
+        if (i == n)
+            set_add(result, keep->key, keep->value);
+    }
+done:
+    free(order);
+    free(fingers);
+    stats_stop(&timer, STAGE_INTERSECTION);
+    return result;
+}
+
+// A node in the k-way merge heap of set_union_many()
+struct mergehead {
+    snode_t *node;
+    int index;          // Which set the node belongs to
+};
+
+// Returns 1 if heap entry a should come out before b
+static int merge_before(cmpfunc_t compare, struct mergehead *a, struct mergehead *b)
+{
+    int comp_result;
+
+    stats_count(STATS_COMPARES, 1);
+    comp_result = compare(a->node->key, b->node->key);
+    return comp_result < 0 || (comp_result == 0 && a->index < b->index);
+}
+
+static void sift_down(cmpfunc_t compare, struct mergehead *heap, int size, int i)
+{
+    while (1) {
+        int smallest = i, l = 2 * i + 1, r = 2 * i + 2;
+        struct mergehead tmp;
+
+        if (l < size && merge_before(compare, &heap[l], &heap[smallest]))
+            smallest = l;
+        if (r < size && merge_before(compare, &heap[r], &heap[smallest]))
+            smallest = r;
+        if (smallest == i)
+            return;
+        tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Union of many sets
+set_t *set_union_many(set_t **sets, int n)
+{
+    set_t *result = set_create_alloc(sets[0]->compare, sets[0]->alloc);
+    struct mergehead *heap;
+    snode_t *last = NULL;
+    int i, size = 0;
+    stats_timer_t timer;
+
+    assert(n >= 1);
+    stats_start(&timer);
+    heap = malloc(sizeof(struct mergehead) * n);
+    if (heap == NULL)
+        fatal_error("out of memory");
+    for (i = 0; i < n; i++) {
+        snode_t *first = minimum_node(sets[i]->root);
+        if (first != NULL) {
+            heap[size].node = first;
+            heap[size].index = i;
+            size++;
+        }
+    }
+    for (i = size / 2 - 1; i >= 0; i--)
+        sift_down(result->compare, heap, size, i);
+
+    // Pop the smallest key; equal keys pop in set order, so the first wins
+    while (size > 0) {
+        snode_t *node = heap[0].node;
+        if (last == NULL || COMPARE(result, last->key, node->key) != 0) {
+            set_add(result, node->key, node->value);
+            last = node;
+        }
+        heap[0].node = successor(node);
+        if (heap[0].node == NULL)
+            heap[0] = heap[--size];
+        sift_down(result->compare, heap, size, 0);
+    }
+    free(heap);
+    stats_stop(&timer, STAGE_UNION);
+    return result;
+}
+
+// Size of the intersection of the given sets
+int set_intersection_size(set_t *a, set_t *b, int limit)
+{
+    stats_timer_t timer;
+    int count;
+
+    stats_start(&timer);
+    count = intersect(a, b, NULL, limit);
+    stats_stop(&timer, STAGE_INTERSECTION);
+    return count;
+}
+
+/* Size ratios at which intersect() switches strategy */
+#define MERGE_RATIO  8      // Merge when the larger set is at most 8x larger
+#define PROBE_LIMIT  16     // Probe when the smaller set is this small
+
+/*
+ * Intersects a and b, adding the common elements of a to result (if it
+ * is not NULL), and returns the number of common elements.  Stops once
+ * limit elements are found, if limit is positive.
+ *
+ * The strategy depends on the sizes of the sets.  Sets of similar size
+ * are merged in order, in O(m + n).  A tiny set is probed element by
+ * element into the larger one, in O(m log n).  Otherwise the smaller
+ * set is walked in order while a finger into the larger set gallops
+ * ahead to each key, in O(m log(n/m)).
+ */
+static int intersect(set_t *a, set_t *b, set_t *result, int limit)
+{
+    set_t *small = a, *large = b;
+    snode_t *s, *l;
+    int count = 0;
+
+    if (a->numitems > b->numitems) {
+        small = b;
+        large = a;
+    }
+    if (small->numitems == 0)
+        return 0;
+
+    if (large->numitems <= MERGE_RATIO * small->numitems) {
+        s = minimum_node(a->root);
+        l = minimum_node(b->root);
+        while (s != NULL && l != NULL) {
+            int comp_result = COMPARE(a, s->key, l->key);
+            if (comp_result < 0) {
+                s = successor(s);
+            } else if (comp_result > 0) {
+                l = successor(l);
+            } else {
+                if (result != NULL)
+                    set_add(result, s->key, s->value);
+                if (++count == limit)
+                    break;
+                s = successor(s);
+                l = successor(l);
+            }
+        }
+        return count;
+    }
+
+    l = minimum_node(large->root);
+    for (s = minimum_node(small->root); s != NULL; s = successor(s)) {
+        snode_t *match;
+
+        if (small->numitems <= PROBE_LIMIT) {
+            match = lookup_node(large, s->key);
+        } else {
+            l = seek_node(large, l, s->key);
+            if (l == NULL)
+                break;
+            match = COMPARE(a, s->key, l->key) == 0 ? l : NULL;
+        }
+        if (match != NULL) {
+            // Keep the element of a, as it may differ from the one in b
+            snode_t *keep = (small == a) ? s : match;
+            if (result != NULL)
+                set_add(result, keep->key, keep->value);
+            if (++count == limit)
+                break;
+        }
+    }
+    return count;
+}
+
+// Size of the union of the given sets
+int set_union_size(set_t *a, set_t *b, int limit)
+{
+    int larger = a->numitems > b->numitems ? a->numitems : b->numitems;
+    int count;
+
+    // The union is at least as large as either set
+    if (limit > 0 && larger >= limit)
+        return limit;
+    count = a->numitems + b->numitems - set_intersection_size(a, b, 0);
+    return (limit > 0 && count > limit) ? limit : count;
+}
+
+// Size of the difference of the given sets
+int set_difference_size(set_t *a, set_t *b, int limit)
+{
+    snode_t *n;
+    int count = 0;
+    stats_timer_t timer;
+
+    stats_start(&timer);
+    for (n = minimum_node(a->root); n != NULL; n = successor(n)) {
+        if (lookup_node(b, n->key) == NULL) {
+            count++;
+            if (count == limit)
+                break;
+        }
+    }
+    stats_stop(&timer, STAGE_DIFFERENCE);
+    return count;
+}
+
 // Returns a copy of the given set
 set_t *set_copy(set_t *set)
 {
-    set_t *copyset = set_create(set->compare);
-    if (copyset == NULL)
-        return NULL;
+    set_t *copyset = set_create_alloc(set->compare, set->alloc);
     set_iter_t *iter = set_createiter(set);
-    if (iter == NULL)
-        return NULL;
     
     while (set_hasnext(iter) != 0)    {
         set_add(copyset, iter->node->key, iter->node->value);
         set_next(iter);
     }
+    set_destroyiter(iter);
     return copyset;
 }
 
@@ -443,16 +722,17 @@ set_iter_t *set_createiter(set_t *set)
     //assert(set != NULL);
     //assert(set->root != NULL);
 
-    set_iter_t *iter = (set_iter_t*)malloc(sizeof(set_iter_t));
-    if (iter == NULL)
-        return NULL;
+    // Iterators only read the set, which may be shared between threads,
+    // so they come from the heap rather than from its allocator
+    set_iter_t *iter = alloc_get(alloc_default(), sizeof(set_iter_t), NULL);
     iter->node = minimum_node(set->root);
+    iter->set = set;
     return iter;
 }
 
 void set_destroyiter(set_iter_t *iter)
 {
-    free(iter);
+    alloc_put(alloc_default(), iter, sizeof(set_iter_t), NULL);
 }
 
 int set_hasnext(set_iter_t *iter)
@@ -467,27 +747,77 @@ void *set_next(set_iter_t *iter)
         return NULL;
     
     void *elem = iter->node->value; //Used as a temporary value to hold the current value of the node
-    
-    if (iter->node->right != NULL)  {
-        iter->node = iter->node->right;
-        while (iter->node->left != NULL)    {
-            iter->node = iter->node->left;
+    iter->node = successor(iter->node);
+    return elem;
+}
+
+void set_iter_seek(set_iter_t *iter, void *key)
+{
+    if (iter != NULL && iter->node != NULL)
+        iter->node = seek_node(iter->set, iter->node, key);
+}
+
+// Returns the first node at or below n whose key is not less than key, or NULL
+static snode_t *lower_bound(set_t *t, snode_t *n, void *key)
+{
+    snode_t *best = NULL;
+
+    while (n != NULL) {
+        if (COMPARE(t, n->key, key) >= 0) {
+            best = n;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    return best;
+}
+
+/*
+ * Returns the first node at or after n (in order) whose key is not less
+ * than key, or NULL if there is none.  Climbs from n only as far as
+ * needed before descending again, so seeking a short distance ahead is
+ * cheap: O(log d) for a distance of d nodes.
+ */
+static snode_t *seek_node(set_t *t, snode_t *n, void *key)
+{
+    snode_t *parent;
+
+    if (COMPARE(t, n->key, key) >= 0)
+        return n;
+    // Here n < key.  While n is a right child its parent is smaller still.
+    while ((parent = n->parent) != NULL) {
+        if (n == parent->left && COMPARE(t, parent->key, key) >= 0) {
+            snode_t *found = lower_bound(t, n->right, key);
+            return found != NULL ? found : parent;
+        }
+        n = parent;
+    }
+    return lower_bound(t, n->right, key);
+}
+
+// Returns the in-order successor of the given node, or NULL if it is the last
+static snode_t *successor(snode_t *n)
+{
+    if (n->right != NULL)  {
+        n = n->right;
+        while (n->left != NULL)    {
+            n = n->left;
         }
     }   else    {
-        snode_t *child; // Child of the iterator
+        snode_t *child; // Child of the current node
         while(1){
-            child = iter->node;
-            iter->node = iter->node->parent;
-            if (iter->node == NULL) {
+            child = n;
+            n = n->parent;
+            if (n == NULL) {
                 break;
             }
-            if (child == iter->node->left)
+            if (child == n->left)
                 break;
             
         }
     }
-    
-    return elem;
+    return n;
 }
 
 static snode_t *maximum_node(snode_t *n)
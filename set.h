@@ -3,6 +3,9 @@
 
 #include "common.h"
 
+struct allocator;
+struct alloc_stats;
+
 /*
  * The type of sets.
  */
@@ -21,6 +24,22 @@ typedef struct set set_t;
  */
 set_t *set_create(cmpfunc_t compare);
 
+/*
+ * Creates a new set that takes its memory, and that of its nodes, from
+ * the given allocator.  Its iterators, which only read the set, still
+ * come from alloc_default().  The sets computed from it by the
+ * functions below use the same allocator.  A set with an allocator of
+ * its own must not be used from several threads at once.
+ */
+set_t *set_create_alloc(cmpfunc_t compare, struct allocator *alloc);
+
+/*
+ * Stores the memory statistics of the given set in stats: the bytes
+ * taken by the set and its nodes, and the number of allocations and
+ * frees made for them.
+ */
+void set_memstats(set_t *set, struct alloc_stats *stats);
+
 /*
  * Destroys the given set.  Subsequently accessing the set
  * will lead to undefined behavior.
@@ -43,6 +62,12 @@ void set_add(set_t *set, void *key, void *elem);
  */
 int set_contains(set_t *set, void *key);
 
+/*
+ * Returns the element that was added to the given set with the given
+ * key, or NULL if the set contains no such key.
+ */
+void *set_get(set_t *set, void *key);
+
 /*
  * Returns the union of the two given sets; the returned
  * set contains all elements that are contained in either
@@ -64,6 +89,44 @@ set_t *set_intersection(set_t *a, set_t *b);
  */
 set_t *set_difference(set_t *a, set_t *b);
 
+/*
+ * Returns the union of the n given sets, for n >= 1.  The sets are
+ * merged in one pass with a k-way heap merge, instead of folding them
+ * pairwise through n-1 intermediate sets.  Where several sets hold
+ * equal keys, the element of the earliest set in the array is kept.
+ */
+set_t *set_union_many(set_t **sets, int n);
+
+/*
+ * Returns the intersection of the n given sets, for n >= 1.  The
+ * smallest set supplies the candidates, which are looked for in the
+ * other sets from smallest to largest.  Returns as soon as it is known
+ * that no further candidates can match, and at once if any set is
+ * empty.  The elements kept are those of sets[0].
+ */
+set_t *set_intersection_many(set_t **sets, int n);
+
+/*
+ * Returns the size of the union of the two given sets, without
+ * building the union.  If limit is positive, counting stops once the
+ * size reaches limit, and limit is returned.
+ */
+int set_union_size(set_t *a, set_t *b, int limit);
+
+/*
+ * Returns the size of the intersection of the two given sets, without
+ * building the intersection.  If limit is positive, counting stops
+ * once the size reaches limit, and limit is returned.
+ */
+int set_intersection_size(set_t *a, set_t *b, int limit);
+
+/*
+ * Returns the size of the set difference of the two given sets, without
+ * building the difference.  If limit is positive, counting stops once
+ * the size reaches limit, and limit is returned.
+ */
+int set_difference_size(set_t *a, set_t *b, int limit);
+
 /*
  * Returns a copy of the given set.
  */
@@ -97,4 +160,13 @@ int set_hasnext(set_iter_t *iter);
  */
 void *set_next(set_iter_t *iter);
 
+/*
+ * Advances the given set iterator to the first element whose key is
+ * not less than the given key, so that set_next() returns it.  Never
+ * moves the iterator backwards.  Seeking d elements ahead takes
+ * O(log d) time, so a sorted sequence of keys can be searched for in
+ * a single forward pass.
+ */
+void set_iter_seek(set_iter_t *iter, void *key);
+
 #endif
@@ -0,0 +1,446 @@
+#include "setexpr.h"
+#include "list.h"
+#include "set.h"
+#include "arena.h"
+#include "dedup.h"
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+enum exprkind {
+    EXPR_SET,
+    EXPR_ALLDOCS,
+    EXPR_ANYDOCS,
+    EXPR_INTERSECTION,
+    EXPR_UNION,
+    EXPR_DIFFERENCE
+};
+
+struct setexpr {
+    enum exprkind kind;
+    set_t *set;         /* EXPR_SET */
+    list_t *files;      /* EXPR_ALLDOCS and EXPR_ANYDOCS */
+    setexpr_t *left;    /* Binary operators */
+    setexpr_t *right;
+};
+
+/*
+ * Evaluation state.  Each document's words are read into the document
+ * arena, which is reset before the next document is read.  Words that
+ * survive into a result are first copied into the result arena.
+ */
+struct evalctx {
+    arena_t *result;
+    arena_t *doc;
+};
+
+/* A document and its size, for ordering documents */
+struct doc {
+    char *path;
+    off_t size;
+};
+
+static set_t *eval(struct evalctx *ctx, setexpr_t *e);
+static set_t *restrict_to(struct evalctx *ctx, setexpr_t *e, set_t *cand);
+static set_t *exclude(struct evalctx *ctx, setexpr_t *e, set_t *cand);
+
+static setexpr_t *newexpr(enum exprkind kind)
+{
+    setexpr_t *e = calloc(1, sizeof(setexpr_t));
+    if (e == NULL)
+        fatal_error("out of memory");
+    e->kind = kind;
+    return e;
+}
+
+setexpr_t *setexpr_set(set_t *set)
+{
+    setexpr_t *e = newexpr(EXPR_SET);
+    e->set = set;
+    return e;
+}
+
+setexpr_t *setexpr_alldocs(list_t *files)
+{
+    setexpr_t *e = newexpr(EXPR_ALLDOCS);
+    e->files = files;
+    return e;
+}
+
+setexpr_t *setexpr_anydocs(list_t *files)
+{
+    setexpr_t *e = newexpr(EXPR_ANYDOCS);
+    e->files = files;
+    return e;
+}
+
+static setexpr_t *newbinary(enum exprkind kind, setexpr_t *a, setexpr_t *b)
+{
+    setexpr_t *e = newexpr(kind);
+    e->left = a;
+    e->right = b;
+    return e;
+}
+
+setexpr_t *setexpr_intersection(setexpr_t *a, setexpr_t *b)
+{
+    return newbinary(EXPR_INTERSECTION, a, b);
+}
+
+setexpr_t *setexpr_union(setexpr_t *a, setexpr_t *b)
+{
+    return newbinary(EXPR_UNION, a, b);
+}
+
+setexpr_t *setexpr_difference(setexpr_t *a, setexpr_t *b)
+{
+    return newbinary(EXPR_DIFFERENCE, a, b);
+}
+
+void setexpr_destroy(setexpr_t *expr)
+{
+    if (expr == NULL)
+        return;
+    setexpr_destroy(expr->left);
+    setexpr_destroy(expr->right);
+    free(expr);
+}
+
+set_t *setexpr_eval(setexpr_t *expr, arena_t *arena)
+{
+    struct evalctx ctx;
+    set_t *result;
+
+    ctx.result = arena;
+    ctx.doc = arena_create();
+    result = eval(&ctx, expr);
+    arena_destroy(ctx.doc);
+    return result;
+}
+
+static int compare_docs(const void *a, const void *b)
+{
+    const struct doc *da = a, *db = b;
+    return (da->size > db->size) - (da->size < db->size);
+}
+
+/*
+ * Drops the documents that are copies of earlier ones from the given
+ * sorted array, and returns the number of documents left.  Copies have
+ * the same size, so only documents that share their size with another
+ * one need to be hashed.  A copy never changes the value of an
+ * expression over documents.
+ */
+static int drop_copies(struct doc *docs, int numdocs)
+{
+    dedup_t *dedup = dedup_create();
+    int i, j, k, n = 0;
+
+    for (i = 0; i < numdocs; i = j) {
+        for (j = i + 1; j < numdocs && docs[j].size == docs[i].size; j++)
+            ;
+        for (k = i; k < j; k++) {
+            if (j - i == 1 || dedup_check(dedup, docs[k].path, k) < 0)
+                docs[n++] = docs[k];
+        }
+    }
+    dedup_destroy(dedup);
+    return n;
+}
+
+/*
+ * Returns the documents of the given list as an array, smallest first,
+ * so that intersections over them shrink as early as possible.
+ */
+static struct doc *sorted_docs(list_t *files, int *numdocs)
+{
+    struct doc *docs;
+    list_iter_t *iter;
+    struct stat st;
+    int i;
+
+    *numdocs = list_size(files);
+    docs = malloc(sizeof(struct doc) * (*numdocs + 1));
+    if (docs == NULL)
+        fatal_error("out of memory");
+    iter = list_createiter(files);
+    for (i = 0; list_hasnext(iter); i++) {
+        docs[i].path = list_next(iter);
+        docs[i].size = stat(docs[i].path, &st) == 0 ? st.st_size : 0;
+    }
+    list_destroyiter(iter);
+    qsort(docs, *numdocs, sizeof(struct doc), compare_docs);
+    if (dedup_enabled())
+        *numdocs = drop_copies(docs, *numdocs);
+    return docs;
+}
+
+/*
+ * Adds the elements of src to dst.  Word sets store each word as both
+ * key and element, so the element doubles as the key.
+ */
+static void add_all(set_t *dst, set_t *src)
+{
+    set_iter_t *iter = set_createiter(src);
+    while (set_hasnext(iter)) {
+        void *elem = set_next(iter);
+        set_add(dst, elem, elem);
+    }
+    set_destroyiter(iter);
+}
+
+/*
+ * Reads the words of the given document, releasing those of the
+ * previous one.
+ */
+static set_t *read_doc(struct evalctx *ctx, char *path)
+{
+    arena_reset(ctx->doc);
+    return tokenize(path, ctx->doc);
+}
+
+/*
+ * Adds the words of the given document set to dst, copying the words
+ * that are new to dst into the result arena.
+ */
+static void add_promoted(struct evalctx *ctx, set_t *dst, set_t *words)
+{
+    set_iter_t *iter = set_createiter(words);
+    while (set_hasnext(iter)) {
+        char *word = set_next(iter);
+        if (!set_contains(dst, word)) {
+            word = arena_strdup(ctx->result, word);
+            set_add(dst, word, word);
+        }
+    }
+    set_destroyiter(iter);
+}
+
+/*
+ * Returns 1 if the value of the given expression is known to be no
+ * larger than its smallest input, so that it is cheap to evaluate
+ * eagerly and use as the candidates for its siblings.
+ */
+static int bounded(setexpr_t *e)
+{
+    switch (e->kind) {
+    case EXPR_SET:
+    case EXPR_ALLDOCS:
+        return 1;
+    case EXPR_INTERSECTION:
+        return bounded(e->left) || bounded(e->right);
+    case EXPR_DIFFERENCE:
+        return bounded(e->left);
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Returns 1 if the given expression is a chain of operators of the
+ * given kind whose leaves are all sets, 0 otherwise.  If sets is not
+ * NULL, the leaves are stored into it.  Counts the leaves in *numsets.
+ */
+static int gather(setexpr_t *e, enum exprkind kind, set_t **sets, int *numsets)
+{
+    if (e->kind == EXPR_SET) {
+        if (sets != NULL)
+            sets[*numsets] = e->set;
+        (*numsets)++;
+        return 1;
+    }
+    return e->kind == kind &&
+           gather(e->left, kind, sets, numsets) &&
+           gather(e->right, kind, sets, numsets);
+}
+
+/*
+ * Evaluates a chain of intersections or unions over sets with a single
+ * k-way operation, or returns NULL if the expression is not such a
+ * chain.
+ */
+static set_t *eval_many(setexpr_t *e)
+{
+    set_t **sets, *result;
+    int numsets = 0;
+
+    if (!gather(e, e->kind, NULL, &numsets))
+        return NULL;
+    sets = malloc(sizeof(set_t *) * numsets);
+    if (sets == NULL)
+        fatal_error("out of memory");
+    numsets = 0;
+    gather(e, e->kind, sets, &numsets);
+    if (e->kind == EXPR_INTERSECTION)
+        result = set_intersection_many(sets, numsets);
+    else
+        result = set_union_many(sets, numsets);
+    free(sets);
+    return result;
+}
+
+/*
+ * Replaces the candidate set with the given one, destroying the old.
+ */
+static set_t *replace(set_t *old, set_t *new)
+{
+    set_destroy(old);
+    return new;
+}
+
+static set_t *eval(struct evalctx *ctx, setexpr_t *e)
+{
+    set_t *result;
+    struct doc *docs;
+    int i, numdocs;
+
+    switch (e->kind) {
+    case EXPR_SET:
+        return set_copy(e->set);
+    case EXPR_ALLDOCS:
+        docs = sorted_docs(e->files, &numdocs);
+        if (numdocs == 0) {
+            result = set_create(compare_words);
+        }
+        else {
+            /* The first document supplies the candidates, so its words
+             * stay in an arena of their own until the survivors are
+             * known and promoted.  The candidate sets derived from it
+             * go on the heap, which gives back the nodes of each */
+            arena_t *first = arena_create();
+            set_t *firstwords = tokenize(docs[0].path, first);
+            set_t *cand = set_create(compare_words);
+            add_all(cand, firstwords);
+            set_destroy(firstwords);
+            for (i = 1; i < numdocs && set_size(cand) > 0; i++) {
+                set_t *words = read_doc(ctx, docs[i].path);
+                cand = replace(cand, set_intersection(cand, words));
+                set_destroy(words);
+            }
+            result = set_create(compare_words);
+            add_promoted(ctx, result, cand);
+            set_destroy(cand);
+            arena_destroy(first);
+        }
+        free(docs);
+        return result;
+    case EXPR_ANYDOCS:
+        result = set_create(compare_words);
+        docs = sorted_docs(e->files, &numdocs);
+        for (i = 0; i < numdocs; i++) {
+            set_t *words = read_doc(ctx, docs[i].path);
+            add_promoted(ctx, result, words);
+            set_destroy(words);
+        }
+        free(docs);
+        return result;
+    case EXPR_INTERSECTION:
+        if ((result = eval_many(e)) != NULL)
+            return result;
+        if (!bounded(e->left) && bounded(e->right))
+            return restrict_to(ctx, e->left, eval(ctx, e->right));
+        return restrict_to(ctx, e->right, eval(ctx, e->left));
+    case EXPR_UNION:
+        if ((result = eval_many(e)) != NULL)
+            return result;
+        result = eval(ctx, e->left);
+        {
+            set_t *right = eval(ctx, e->right);
+            add_all(result, right);
+            set_destroy(right);
+        }
+        return result;
+    case EXPR_DIFFERENCE:
+        return exclude(ctx, e->right, eval(ctx, e->left));
+    }
+    return NULL;
+}
+
+/*
+ * Returns the candidates that are in the value of the given expression.
+ * Takes ownership of the candidate set.
+ */
+static set_t *restrict_to(struct evalctx *ctx, setexpr_t *e, set_t *cand)
+{
+    set_t *hits, *rest;
+    struct doc *docs;
+    int i, numdocs;
+
+    if (set_size(cand) == 0)
+        return cand;
+    switch (e->kind) {
+    case EXPR_SET:
+        return replace(cand, set_intersection(cand, e->set));
+    case EXPR_ALLDOCS:
+        docs = sorted_docs(e->files, &numdocs);
+        for (i = 0; i < numdocs && set_size(cand) > 0; i++) {
+            set_t *words = read_doc(ctx, docs[i].path);
+            cand = replace(cand, set_intersection(cand, words));
+            set_destroy(words);
+        }
+        free(docs);
+        return cand;
+    case EXPR_ANYDOCS:
+        /* Move candidates to the hits as documents are found to hold them */
+        hits = set_create(compare_words);
+        docs = sorted_docs(e->files, &numdocs);
+        for (i = numdocs - 1; i >= 0 && set_size(cand) > 0; i--) {
+            set_t *words = read_doc(ctx, docs[i].path);
+            set_t *found = set_intersection(cand, words);
+            add_all(hits, found);
+            set_destroy(found);
+            cand = replace(cand, set_difference(cand, words));
+            set_destroy(words);
+        }
+        free(docs);
+        set_destroy(cand);
+        return hits;
+    case EXPR_INTERSECTION:
+        return restrict_to(ctx, e->right, restrict_to(ctx, e->left, cand));
+    case EXPR_UNION:
+        hits = restrict_to(ctx, e->left, set_copy(cand));
+        rest = restrict_to(ctx, e->right, replace(cand, set_difference(cand, hits)));
+        add_all(hits, rest);
+        set_destroy(rest);
+        return hits;
+    case EXPR_DIFFERENCE:
+        return exclude(ctx, e->right, restrict_to(ctx, e->left, cand));
+    }
+    return cand;
+}
+
+/*
+ * Returns the candidates that are not in the value of the given
+ * expression.  Takes ownership of the candidate set.
+ */
+static set_t *exclude(struct evalctx *ctx, setexpr_t *e, set_t *cand)
+{
+    set_t *inside;
+    struct doc *docs;
+    int i, numdocs;
+
+    if (set_size(cand) == 0)
+        return cand;
+    switch (e->kind) {
+    case EXPR_SET:
+        return replace(cand, set_difference(cand, e->set));
+    case EXPR_ANYDOCS:
+        /* Drop candidates as soon as any document holds them, trying the
+         * largest documents first as they tend to drop the most */
+        docs = sorted_docs(e->files, &numdocs);
+        for (i = numdocs - 1; i >= 0 && set_size(cand) > 0; i--) {
+            set_t *words = read_doc(ctx, docs[i].path);
+            cand = replace(cand, set_difference(cand, words));
+            set_destroy(words);
+        }
+        free(docs);
+        return cand;
+    case EXPR_UNION:
+        return exclude(ctx, e->right, exclude(ctx, e->left, cand));
+    default:
+        inside = restrict_to(ctx, e, set_copy(cand));
+        cand = replace(cand, set_difference(cand, inside));
+        set_destroy(inside);
+        return cand;
+    }
+}
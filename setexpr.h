@@ -0,0 +1,63 @@
+#ifndef SETEXPR_H
+#define SETEXPR_H
+
+#include "common.h"
+
+/*
+ * Lazy set expressions over sets of words.  An expression is built from
+ * existing sets and from lists of documents, and is only computed when
+ * evaluated.  The evaluator streams over the documents one at a time
+ * and never builds the intermediate sets it can avoid: a difference
+ * only keeps the candidates of its left side, drops each one as soon
+ * as a document on its right side contains it, and stops reading as
+ * soon as no candidates remain.
+ *
+ * Expressions compare words with compare_words().
+ */
+struct setexpr;
+typedef struct setexpr setexpr_t;
+
+/*
+ * Returns an expression for the given set.  The set is not copied, and
+ * must outlive the expression.
+ */
+setexpr_t *setexpr_set(struct set *set);
+
+/*
+ * Returns an expression for the words found in every one of the given
+ * documents.  The list holds file names, and must outlive the
+ * expression.
+ */
+setexpr_t *setexpr_alldocs(struct list *files);
+
+/*
+ * Returns an expression for the words found in any of the given
+ * documents.  The list holds file names, and must outlive the
+ * expression.
+ */
+setexpr_t *setexpr_anydocs(struct list *files);
+
+/*
+ * Returns expressions for the intersection, the union and the set
+ * difference of the two given expressions.  The new expression takes
+ * ownership of a and b.
+ */
+setexpr_t *setexpr_intersection(setexpr_t *a, setexpr_t *b);
+setexpr_t *setexpr_union(setexpr_t *a, setexpr_t *b);
+setexpr_t *setexpr_difference(setexpr_t *a, setexpr_t *b);
+
+/*
+ * Evaluates the given expression, and returns its value as a new set.
+ * Words read from documents are only kept for as long as they may
+ * still be part of the value; the ones that end up in it are copied
+ * into the given arena, which owns them.  Words taken from the sets in
+ * the expression are not copied.
+ */
+struct set *setexpr_eval(setexpr_t *expr, struct arena *arena);
+
+/*
+ * Destroys the given expression and the expressions it owns.
+ */
+void setexpr_destroy(setexpr_t *expr);
+
+#endif
@@ -0,0 +1,315 @@
+#include "sketch.h"
+#include "common.h"
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define DEPTH    4          /* Rows of counters */
+#define MAXWORD  100        /* As in common.c */
+#define EULER    2.718281828459045
+
+/* One of the most frequent words, in the heap */
+struct entry {
+    uint64_t hash;
+    uint64_t count;         /* The estimate when the word was last seen */
+    size_t slot;            /* Its slot in the index */
+    char word[MAXWORD + 1];
+};
+
+/*
+ * The counters are DEPTH rows of width counters each, and each row
+ * counts each word in a cell of its own choosing.  A word's count is
+ * the smallest of its cells, which others may have added to as well.
+ *
+ * The most frequent words are kept in a min-heap on their counts, so
+ * the least frequent of them is the one a more frequent word replaces.
+ * The index finds a word in the heap by its hash: it is a hash table
+ * with linear probing of heap positions plus one, with 0 for empty.
+ */
+struct sketch {
+    uint32_t *counters;
+    size_t mask;            /* width - 1 */
+    uint64_t total;
+    struct entry *heap;
+    int size;
+    int k;
+    int *index;
+    size_t indexmask;
+};
+
+sketch_t *sketch_create(size_t size, int k)
+{
+    sketch_t *sketch = malloc(sizeof(sketch_t));
+    size_t width = 256, n = 1;
+
+    if (sketch == NULL)
+        fatal_error("out of memory");
+    while (2 * width * DEPTH * sizeof(uint32_t) <= size)
+        width *= 2;
+    while (n < 4 * (size_t)k)
+        n *= 2;
+    sketch->counters = calloc(width * DEPTH, sizeof(uint32_t));
+    sketch->mask = width - 1;
+    sketch->total = 0;
+    sketch->heap = malloc(sizeof(struct entry) * (k > 0 ? k : 1));
+    sketch->size = 0;
+    sketch->k = k;
+    sketch->index = calloc(n, sizeof(int));
+    sketch->indexmask = n - 1;
+    if (sketch->counters == NULL || sketch->heap == NULL ||
+        sketch->index == NULL)
+        fatal_error("out of memory");
+    return sketch;
+}
+
+void sketch_destroy(sketch_t *sketch)
+{
+    free(sketch->counters);
+    free(sketch->heap);
+    free(sketch->index);
+    free(sketch);
+}
+
+/*
+ * Spreads the bits of the word hash, since the cells are chosen by its
+ * low bits.
+ */
+static uint64_t word_hash(const char *word)
+{
+    uint64_t h = hash_word(word);
+
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/* The cell of the given row that counts the word with the given hash */
+static uint32_t *cell(sketch_t *sketch, uint64_t hash, int row)
+{
+    uint64_t step = (hash >> 32) | 1;
+
+    return &sketch->counters[row * (sketch->mask + 1) +
+                             ((hash + row * step) & sketch->mask)];
+}
+
+static uint64_t estimate(sketch_t *sketch, uint64_t hash)
+{
+    uint32_t min = *cell(sketch, hash, 0);
+    int row;
+
+    for (row = 1; row < DEPTH; row++) {
+        uint32_t c = *cell(sketch, hash, row);
+        if (c < min)
+            min = c;
+    }
+    return min;
+}
+
+/*
+ * Counts one more occurrence with a conservative update: only the
+ * cells below the new estimate are raised, which keeps the estimates
+ * of other words sharing them lower.  Returns the new estimate.
+ */
+static uint64_t update(sketch_t *sketch, uint64_t hash)
+{
+    uint32_t *cells[DEPTH], min;
+    int row;
+
+    for (row = 0; row < DEPTH; row++)
+        cells[row] = cell(sketch, hash, row);
+    min = *cells[0];
+    for (row = 1; row < DEPTH; row++) {
+        if (*cells[row] < min)
+            min = *cells[row];
+    }
+    if (min == UINT32_MAX)
+        return min;
+    min++;
+    for (row = 0; row < DEPTH; row++) {
+        if (*cells[row] < min)
+            *cells[row] = min;
+    }
+    return min;
+}
+
+/* Returns the heap position of the given word, or -1 */
+static int find(sketch_t *sketch, uint64_t hash, const char *word)
+{
+    size_t i = hash & sketch->indexmask;
+
+    while (sketch->index[i] != 0) {
+        struct entry *e = &sketch->heap[sketch->index[i] - 1];
+        if (e->hash == hash && strcmp(e->word, word) == 0)
+            return sketch->index[i] - 1;
+        i = (i + 1) & sketch->indexmask;
+    }
+    return -1;
+}
+
+static void index_add(sketch_t *sketch, int pos)
+{
+    size_t i = sketch->heap[pos].hash & sketch->indexmask;
+
+    while (sketch->index[i] != 0)
+        i = (i + 1) & sketch->indexmask;
+    sketch->index[i] = pos + 1;
+    sketch->heap[pos].slot = i;
+}
+
+/*
+ * Empties the given slot, moving back any entry after it that could
+ * no longer be found past the hole.
+ */
+static void index_remove(sketch_t *sketch, size_t hole)
+{
+    size_t i = hole, home;
+
+    for (;;) {
+        i = (i + 1) & sketch->indexmask;
+        if (sketch->index[i] == 0)
+            break;
+        home = sketch->heap[sketch->index[i] - 1].hash & sketch->indexmask;
+        /* Leave the entry if its home is cyclically in (hole, i] */
+        if (hole < i ? (home > hole && home <= i) : (home > hole || home <= i))
+            continue;
+        sketch->index[hole] = sketch->index[i];
+        sketch->heap[sketch->index[hole] - 1].slot = hole;
+        hole = i;
+    }
+    sketch->index[hole] = 0;
+}
+
+static void swap(sketch_t *sketch, int a, int b)
+{
+    struct entry tmp = sketch->heap[a];
+
+    sketch->heap[a] = sketch->heap[b];
+    sketch->heap[b] = tmp;
+    sketch->index[sketch->heap[a].slot] = a + 1;
+    sketch->index[sketch->heap[b].slot] = b + 1;
+}
+
+static void sift_up(sketch_t *sketch, int pos)
+{
+    while (pos > 0 &&
+           sketch->heap[pos].count < sketch->heap[(pos - 1) / 2].count) {
+        swap(sketch, pos, (pos - 1) / 2);
+        pos = (pos - 1) / 2;
+    }
+}
+
+static void sift_down(sketch_t *sketch, int pos)
+{
+    for (;;) {
+        int smallest = pos, l = 2 * pos + 1, r = 2 * pos + 2;
+
+        if (l < sketch->size &&
+            sketch->heap[l].count < sketch->heap[smallest].count)
+            smallest = l;
+        if (r < sketch->size &&
+            sketch->heap[r].count < sketch->heap[smallest].count)
+            smallest = r;
+        if (smallest == pos)
+            return;
+        swap(sketch, pos, smallest);
+        pos = smallest;
+    }
+}
+
+static void set_entry(sketch_t *sketch, int pos, uint64_t hash,
+                      const char *word, uint64_t count)
+{
+    struct entry *e = &sketch->heap[pos];
+    size_t len = strlen(word);
+
+    if (len > MAXWORD)
+        len = MAXWORD;
+    memcpy(e->word, word, len);
+    e->word[len] = 0;
+    e->hash = hash;
+    e->count = count;
+    index_add(sketch, pos);
+}
+
+void sketch_add(sketch_t *sketch, const char *word)
+{
+    uint64_t hash = word_hash(word), count;
+    int pos;
+
+    sketch->total++;
+    count = update(sketch, hash);
+    if (sketch->k == 0)
+        return;
+    /*
+     * The counts of the words in the heap are estimates from before,
+     * and estimates only grow, so a word whose estimate is no more
+     * than the least of the heap cannot be in it.  This skips the
+     * index for most rare words.
+     */
+    if (sketch->size == sketch->k && count <= sketch->heap[0].count)
+        return;
+    pos = find(sketch, hash, word);
+    if (pos >= 0) {
+        sketch->heap[pos].count = count;
+        sift_down(sketch, pos);
+    }
+    else if (sketch->size < sketch->k) {
+        pos = sketch->size++;
+        set_entry(sketch, pos, hash, word, count);
+        sift_up(sketch, pos);
+    }
+    else {
+        index_remove(sketch, sketch->heap[0].slot);
+        set_entry(sketch, 0, hash, word, count);
+        sift_down(sketch, 0);
+    }
+}
+
+uint64_t sketch_count(sketch_t *sketch, const char *word)
+{
+    return estimate(sketch, word_hash(word));
+}
+
+uint64_t sketch_total(sketch_t *sketch)
+{
+    return sketch->total;
+}
+
+/* The e * total / width bound of the count-min sketch */
+uint64_t sketch_error(sketch_t *sketch)
+{
+    return (uint64_t)(EULER * sketch->total / (sketch->mask + 1) + 0.5);
+}
+
+double sketch_confidence(void)
+{
+    double miss = 1;
+    int row;
+
+    for (row = 0; row < DEPTH; row++)
+        miss /= EULER;
+    return 1 - miss;
+}
+
+static int compare_top(const void *a, const void *b)
+{
+    const sketch_top_t *x = a, *y = b;
+
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return strcmp(x->word, y->word);
+}
+
+int sketch_top(sketch_t *sketch, sketch_top_t *top)
+{
+    int i;
+
+    for (i = 0; i < sketch->size; i++) {
+        top[i].word = sketch->heap[i].word;
+        top[i].count = estimate(sketch, sketch->heap[i].hash);
+    }
+    qsort(top, sketch->size, sizeof(sketch_top_t), compare_top);
+    return sketch->size;
+}
@@ -0,0 +1,66 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A word frequency sketch: a count-min sketch of how often each word
+ * was seen, and the k most frequent words so far.  Its memory is fixed
+ * when it is created, however many distinct words it sees.
+ *
+ * The count of a word is never underestimated.  It is overestimated
+ * by at most sketch_error() with a probability of at least
+ * sketch_confidence().
+ */
+struct sketch;
+typedef struct sketch sketch_t;
+
+/*
+ * Creates an empty sketch that takes about the given number of bytes
+ * for its counters and keeps the k most frequent words.
+ */
+sketch_t *sketch_create(size_t size, int k);
+
+/*
+ * Destroys the given sketch.
+ */
+void sketch_destroy(sketch_t *sketch);
+
+/*
+ * Counts one more occurrence of the given word.
+ */
+void sketch_add(sketch_t *sketch, const char *word);
+
+/*
+ * Returns the estimated number of occurrences of the given word.
+ */
+uint64_t sketch_count(sketch_t *sketch, const char *word);
+
+/*
+ * Returns the number of words counted, with repeats.
+ */
+uint64_t sketch_total(sketch_t *sketch);
+
+/*
+ * Returns the bound on overestimates, which grows with the total, and
+ * the probability that it holds for any one word, which is the same
+ * for every sketch.
+ */
+uint64_t sketch_error(sketch_t *sketch);
+double sketch_confidence(void);
+
+/* One of the most frequent words */
+typedef struct sketch_top {
+    const char *word;       /* Owned by the sketch */
+    uint64_t count;
+} sketch_top_t;
+
+/*
+ * Stores the most frequent words in top, most frequent first, and
+ * returns how many there are, at most k.  The words stay valid until
+ * the sketch next changes.
+ */
+int sketch_top(sketch_t *sketch, sketch_top_t *top);
+
+#endif
@@ -4,42 +4,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
 #include "common.h"
+#include "classify.h"
+#include "model.h"
+#include "counts.h"
+#include "server.h"
+#include "setexpr.h"
+#include "arena.h"
+#include "stats.h"
+#include "cache.h"
+#include "dedup.h"
+#include "partial.h"
+#include "hash.h"
+#include "ngram.h"
+#include "sketch.h"
+#include "watch.h"
 
-/*
- * Case-insensitive comparison function for strings.
- */
-static int compare_words(void *a, void *b)
-{
-    return strcasecmp(a, b);
-}
-
-/*
- * Returns the set of (unique) words found in the given file.
- */
-static set_t *tokenize(char *filename)
-{
-	set_t *wordset = set_create(compare_words);
-	list_t *wordlist = list_create(compare_words);
-	list_iter_t *it;
-	FILE *f;
-	
-	f = fopen(filename, "r");
-	if (f == NULL) {
-		perror("fopen");
-		fatal_error("fopen() failed");
-	}
-	tokenize_file(f, wordlist);
-	
-	it = list_createiter(wordlist);
-	while (list_hasnext(it)) {
-                void *tmp = list_next(it);
-		set_add(wordset, tmp, tmp);		
-	}
-	list_destroyiter(it);
-	list_destroy(wordlist);
-	return wordset;
-}
+/* The order of the phrase features, or 0 to use single words only */
+static int ngrams;
 
 /*
  * Prints a set of words.
@@ -69,79 +54,894 @@ static void list_printwords(char *prefix, list_t *words)
 	printf("\n");
 	list_destroyiter(it);
 }
-typedef set_t*(*operation_t)(set_t *, set_t *); //A set operation prototype
+/*
+ * Trains on the given corpora and returns the set of spam words: the
+ * words found in every spam mail and in no non-spam mail.  The words
+ * are allocated from the given arena.
+ */
+static set_t *train(char *spamdir, char *nonspamdir, arena_t *arena)
+{
+        list_t *spamfiles = find_files(spamdir);
+        list_t *nonspamfiles = find_files(nonspamdir);
+
+        //Spam words are in every spam mail, and in none of the non-spam mails.
+        //Evaluating this as one expression never builds the non-spam union.
+        setexpr_t *expr = setexpr_difference(setexpr_alldocs(spamfiles),
+                                             setexpr_anydocs(nonspamfiles));
+        set_t *diffset = setexpr_eval(expr, arena);
+
+        setexpr_destroy(expr);
+        list_destroy(spamfiles);
+        list_destroy(nonspamfiles);
+        return diffset;
+}
+
+/*
+ * Scores a mail by counting the words it shares with the spam word set.
+ */
+static int score_set(void *model, set_t *words)
+{
+        return set_intersection_size(model, words, 0);
+}
+
+static void usage(char *progname)
+{
+        fprintf(stderr,
+                "usage: %s [-j threads] <spamdir> <nonspamdir> <maildir>\n"
+                "       %s train [-o model] <spamdir> <nonspamdir>\n"
+                "       %s train-shard [-o partial] [-s k/n] [-f] <spam> <nonspam>\n"
+                "       %s merge [-o model] [-p] <partial>...\n"
+                "       %s classify [-j threads] <model>... <maildir>\n"
+                "       %s classify -0|-L <model>... < messages\n"
+                "       %s add <model> spam|ham <path>...\n"
+                "       %s remove <model> spam|ham <path>...\n"
+                "       %s serve [-j threads] <socket> <model>\n"
+                "       %s serve [-j threads] <socket> <spamdir> <nonspamdir>\n"
+                "       %s profile [-k count] [-m size] <dir>...\n"
+                "       %s watch <model> <maildir>\n"
+                "       %s watch <spamdir> <nonspamdir> <maildir>\n"
+                "Any form may start with --stats or --stats=json to print run\n"
+                "statistics to stderr when done, with --cache <dir> to keep\n"
+                "tokenized files and directory listings in <dir> between runs,\n"
+                "with --dedup to tokenize and score byte-identical mails once,\n"
+                "counting them once in training, and with --ngrams[=2|3] to also\n"
+                "train on phrases of up to 3 (or 2) words.  Models trained with\n"
+                "phrases keep them in <model>.grams, which classify then uses.\n"
+                "train-shard and merge take --mem-limit <size>[K|M|G] to keep\n"
+                "about that much of the non-spam vocabulary in memory, and\n"
+                "spill the rest to temporary files.  profile prints the count\n"
+                "most frequent words of each directory, counted approximately\n"
+                "in about <size>[K|M|G] bytes.  classify with several models\n"
+                "tokenizes each mail once and prints a verdict per model,\n"
+                "counting each model's own phrases.\n",
+                progname, progname, progname, progname, progname, progname,
+                progname, progname, progname, progname, progname, progname,
+                progname);
+}
 
 /*
- * This function does the set operation given as input
+ * Trains on the corpora and classifies the mails in one go.
  */
-set_t *operation_handler(char *dirname, operation_t operation)
+static int cmd_filter(int argc, char **argv)
 {
-        list_t *files = find_files(dirname);    //The files within the folder given as input
-        list_iter_t *iter = list_createiter(files); //Iterator to iterate over the number of files
+        int opt, nthreads = 1;
+        
+        while ((opt = getopt(argc, argv, "j:")) != -1) {
+                switch (opt) {
+                case 'j':
+                        nthreads = atoi(optarg);
+                        break;
+                default:
+                        return -1;
+                }
+        }
+	if (argc - optind != 3 || nthreads < 1)
+                return -1;
+        
+        arena_t *arena = arena_create();
+        set_t *diffset = train(argv[optind], argv[optind + 1], arena);
 
-        set_t *set, *tmp, *tmp2;
-        if (list_hasnext(iter))
-            set = tokenize(list_next(iter));
+        //Phrases are trained the same way, on hashes instead of words
+        gramset_t *phrases = NULL;
+        if (ngrams > 0) {
+                list_t *spamfiles = find_files(argv[optind]);
+                list_t *hamfiles = find_files(argv[optind + 1]);
+                phrases = ngram_train(spamfiles, hamfiles, ngrams);
+                classify_setphrases(phrases, ngrams);
+                list_destroy(spamfiles);
+                list_destroy(hamfiles);
+        }
+
+        //Classify the mails, printing the verdicts in the order they were found
+        list_t *maillist = find_files(argv[optind + 2]);
+        classify_files(maillist, score_set, diffset, nthreads);
+        list_destroy(maillist);
+        if (phrases != NULL) {
+                classify_setphrases(NULL, 0);
+                gramset_destroy(phrases);
+        }
+        set_destroy(diffset);
+        arena_destroy(arena);
+        return 0;
+}
 
-        while (list_hasnext(iter))   {
-            tmp = tokenize(list_next(iter));
-            tmp2 = set;
+/*
+ * Returns the name of the file with the given suffix kept alongside the
+ * given model: ".counts" for the document counts, and ".grams" for the
+ * spam phrases.
+ */
+static char *sidecar_filename(char *modelfile, char *suffix)
+{
+        char *filename = malloc(strlen(modelfile) + strlen(suffix) + 1);
+        if (filename == NULL)
+                fatal_error("out of memory");
+        sprintf(filename, "%s%s", modelfile, suffix);
+        return filename;
+}
 
-            set = operation(set, tmp);  //Do the operation given as input
+/*
+ * Adds every file under the given path to the document counts, or
+ * removes them if remove is nonzero.
+ */
+static void count_files(counts_t *counts, char *path, int spam, int remove)
+{
+        list_t *files = find_files(path);
+        list_iter_t *iter = list_createiter(files);
+        arena_t *arena = arena_create();
+        dedup_t *dedup = dedup_enabled() ? dedup_create() : NULL;
+        int id, original;
 
-            set_destroy(tmp);
-            set_destroy(tmp2);
+        //The counts keep their own copies, so each mail's words can go at once.
+        //With deduplication, copies of a mail under the same path count once.
+        for (id = 0; list_hasnext(iter); id++) {
+                set_t *words;
+                if (dedup != NULL) {
+                        words = dedup_tokenize(dedup, list_next(iter), id,
+                                               arena, &original, NULL, NULL);
+                        if (words == NULL)
+                                continue;
+                }
+                else {
+                        words = tokenize(list_next(iter), arena);
+                }
+                if (remove)
+                        counts_remove(counts, words, spam);
+                else
+                        counts_add(counts, words, spam);
+                set_destroy(words);
+                arena_reset(arena);
         }
+        if (dedup != NULL)
+                dedup_destroy(dedup);
+        arena_destroy(arena);
         list_destroyiter(iter);
         list_destroy(files);
-        return set;
+}
 
+/*
+ * Derives the spam words from the given counts and writes both the
+ * model and the counts next to it.
+ */
+static void save_model(counts_t *counts, char *modelfile)
+{
+        char *countsfile = sidecar_filename(modelfile, ".counts");
+        set_t *spamwords = counts_spamwords(counts);
+        model_t *model = model_create(spamwords);
+
+        model_save(model, modelfile);
+        counts_save(counts, countsfile);
+        fprintf(stderr, "%s: %d spam word(s) from %d spam and %d non-spam mail(s)\n",
+                modelfile, model_size(model), counts_spamdocs(counts),
+                counts_hamdocs(counts));
+        model_destroy(model);
+        set_destroy(spamwords);
+        free(countsfile);
 }
 
+/*
+ * Trains on the corpora and writes the spam words to a model file.
+ */
+static int cmd_train(int argc, char **argv)
+{
+        char *modelfile = "spamfilter.model";
+        int opt;
+
+        while ((opt = getopt(argc, argv, "o:")) != -1) {
+                switch (opt) {
+                case 'o':
+                        modelfile = optarg;
+                        break;
+                default:
+                        return -1;
+                }
+        }
+        if (argc - optind != 2)
+                return -1;
+
+        counts_t *counts = counts_create();
+        count_files(counts, argv[optind], 1, 0);
+        count_files(counts, argv[optind + 1], 0, 0);
+        save_model(counts, modelfile);
+        counts_destroy(counts);
+
+        //A model trained without phrases must not keep those of an older one
+        char *gramsfile = sidecar_filename(modelfile, ".grams");
+        if (ngrams > 0) {
+                list_t *spamfiles = find_files(argv[optind]);
+                list_t *hamfiles = find_files(argv[optind + 1]);
+                gramset_t *phrases = ngram_train(spamfiles, hamfiles, ngrams);
+                gramset_save(phrases, ngrams, gramsfile);
+                fprintf(stderr, "%s: %d spam phrase(s) of up to %d words\n",
+                        gramsfile, gramset_size(phrases), ngrams);
+                gramset_destroy(phrases);
+                list_destroy(spamfiles);
+                list_destroy(hamfiles);
+        }
+        else {
+                unlink(gramsfile);
+        }
+        free(gramsfile);
+        return 0;
+}
+
+/*
+ * Reads a list of file names, one per line, from the given file.
+ */
+static list_t *read_filelist(char *filename)
+{
+        list_t *files = list_create(compare_strings);
+        char line[4096], *p, *path;
+        FILE *f;
+
+        f = fopen(filename, "r");
+        if (f == NULL) {
+                perror("fopen");
+                fatal_error("fopen() failed");
+        }
+        while (fgets(line, sizeof(line), f) != NULL) {
+                p = line + strlen(line) - 1;
+                while (p >= line && isspace((unsigned char)*p))
+                        *p-- = 0;
+                if (line[0] == 0)
+                        continue;
+                path = strdup(line);
+                if (path == NULL)
+                        fatal_error("out of memory");
+                list_addlast(files, path);
+        }
+        fclose(f);
+        return files;
+}
 
+/*
+ * Returns the files of shard k out of n: those whose name hashes to k.
+ * Takes ownership of the given list.
+ */
+static list_t *shard_files(list_t *files, int k, int n)
+{
+        list_t *shard;
+        char *path;
 
+        if (n <= 1)
+                return files;
+        shard = list_create(compare_strings);
+        while (list_size(files) > 0) {
+                path = list_popfirst(files);
+                if (hash_bytes(path, strlen(path)) % n == (uint64_t)k)
+                        list_addlast(shard, path);
+                else
+                        free(path);
+        }
+        list_destroy(files);
+        return shard;
+}
+
+/*
+ * Trains on one shard of the corpora and writes a partial model, for
+ * merging with the partial models of the other shards.
+ */
+static int cmd_train_shard(int argc, char **argv)
+{
+        char *partialfile = "spamfilter.partial";
+        int opt, fromlists = 0, k = 0, n = 1;
+
+        while ((opt = getopt(argc, argv, "o:s:f")) != -1) {
+                switch (opt) {
+                case 'o':
+                        partialfile = optarg;
+                        break;
+                case 's':
+                        if (sscanf(optarg, "%d/%d", &k, &n) != 2)
+                                return -1;
+                        break;
+                case 'f':
+                        fromlists = 1;
+                        break;
+                default:
+                        return -1;
+                }
+        }
+        if (argc - optind != 2 || n < 1 || k < 0 || k >= n)
+                return -1;
+
+        //With -f, the arguments list the files instead of holding them
+        list_t *spamfiles, *hamfiles;
+        if (fromlists) {
+                spamfiles = read_filelist(argv[optind]);
+                hamfiles = read_filelist(argv[optind + 1]);
+        }
+        else {
+                spamfiles = find_files(argv[optind]);
+                hamfiles = find_files(argv[optind + 1]);
+        }
+        spamfiles = shard_files(spamfiles, k, n);
+        hamfiles = shard_files(hamfiles, k, n);
+
+        partial_t *partial = partial_train(spamfiles, hamfiles);
+        partial_save(partial, partialfile);
+        fprintf(stderr, "%s: shard %d/%d, %d spam and %d non-spam mail(s)\n",
+                partialfile, k, n, partial_spamdocs(partial),
+                partial_hamdocs(partial));
+        partial_destroy(partial);
+        list_destroy(spamfiles);
+        list_destroy(hamfiles);
+        return 0;
+}
+
+/*
+ * Merges partial models into a model, or with -p into another partial
+ * model.
+ */
+static int cmd_merge(int argc, char **argv)
+{
+        char *outfile = NULL;
+        int opt, i, topartial = 0;
+
+        while ((opt = getopt(argc, argv, "o:p")) != -1) {
+                switch (opt) {
+                case 'o':
+                        outfile = optarg;
+                        break;
+                case 'p':
+                        topartial = 1;
+                        break;
+                default:
+                        return -1;
+                }
+        }
+        if (argc - optind < 1)
+                return -1;
+        if (outfile == NULL)
+                outfile = topartial ? "spamfilter.partial" : "spamfilter.model";
+
+        partial_t *merged = partial_load(argv[optind]);
+        for (i = optind + 1; i < argc; i++) {
+                partial_t *partial = partial_load(argv[i]);
+                partial_merge(merged, partial);
+                partial_destroy(partial);
+        }
+        if (topartial) {
+                partial_save(merged, outfile);
+        }
+        else {
+                set_t *spamwords = partial_spamwords(merged);
+                model_t *model = model_create(spamwords);
+                model_save(model, outfile);
+                fprintf(stderr, "%s: %d spam word(s) from %d spam and %d non-spam mail(s)\n",
+                        outfile, model_size(model), partial_spamdocs(merged),
+                        partial_hamdocs(merged));
+                model_destroy(model);
+                set_destroy(spamwords);
+        }
+        partial_destroy(merged);
+        return 0;
+}
+
+/*
+ * Brings the spam phrases saved with a model, if any, up to date with
+ * mails added to it: a new spam mail keeps only the phrases it shares,
+ * and a new non-spam mail drops the phrases it holds.  Removing mails
+ * cannot bring back phrases, so the phrases are left as they are then,
+ * which may miss some but never adds any.
+ */
+static void update_phrases(char *modelfile, char **paths, int numpaths,
+                           int spam)
+{
+        char *gramsfile = sidecar_filename(modelfile, ".grams");
+        gramset_t *phrases;
+        int i, order;
+
+        if (access(gramsfile, F_OK) == 0) {
+                phrases = gramset_load(gramsfile, &order);
+                for (i = 0; i < numpaths; i++) {
+                        list_t *files = find_files(paths[i]);
+                        list_iter_t *iter = list_createiter(files);
+                        while (list_hasnext(iter)) {
+                                gramset_t *grams = ngram_tokenize(list_next(iter), order);
+                                if (spam)
+                                        gramset_retain(phrases, grams);
+                                else
+                                        gramset_discard(phrases, grams);
+                                gramset_destroy(grams);
+                        }
+                        list_destroyiter(iter);
+                        list_destroy(files);
+                }
+                gramset_save(phrases, order, gramsfile);
+                gramset_destroy(phrases);
+        }
+        free(gramsfile);
+}
+
+/*
+ * Adds mails to, or removes mails from, a trained model using the
+ * document counts saved with it, without retraining on the corpora.
+ */
+static int cmd_update(int argc, char **argv, int remove)
+{
+        char *modelfile, *countsfile;
+        int i, spam;
+
+        if (argc < 4)
+                return -1;
+        modelfile = argv[1];
+        if (strcmp(argv[2], "spam") == 0)
+                spam = 1;
+        else if (strcmp(argv[2], "ham") == 0)
+                spam = 0;
+        else
+                return -1;
+
+        countsfile = sidecar_filename(modelfile, ".counts");
+        counts_t *counts = counts_load(countsfile);
+        for (i = 3; i < argc; i++)
+                count_files(counts, argv[i], spam, remove);
+        save_model(counts, modelfile);
+        if (!remove)
+                update_phrases(modelfile, argv + 3, argc - 3, spam);
+        counts_destroy(counts);
+        free(countsfile);
+        return 0;
+}
+
+/*
+ * Loads the spam phrases saved with the given model, if any, and makes
+ * classification use them.  Returns them, or NULL.
+ */
+static gramset_t *load_phrases(char *modelfile)
+{
+        char *gramsfile = sidecar_filename(modelfile, ".grams");
+        gramset_t *phrases = NULL;
+        int order;
+
+        if (access(gramsfile, F_OK) == 0) {
+                phrases = gramset_load(gramsfile, &order);
+                classify_setphrases(phrases, order);
+        }
+        free(gramsfile);
+        return phrases;
+}
+
+static void unload_phrases(gramset_t *phrases)
+{
+        if (phrases != NULL) {
+                classify_setphrases(NULL, 0);
+                gramset_destroy(phrases);
+        }
+}
+
+/*
+ * Classifies the mails under a directory, or the messages streamed on
+ * standard input, against each of several trained model files at once,
+ * tokenizing each mail once.  The spam phrases saved with a model, if
+ * any, count against that model only.
+ */
+static int classify_multi(char **modelfiles, int nmodels, char *maildir,
+                          int stream, enum framing framing, int nthreads)
+{
+        model_t **models;
+        modelset_t *set;
+        gramset_t **phrases;
+        gramindex_t *index = NULL;
+        int i, order, maxorder = 0;
+
+        if (nmodels > MODELSET_MAX) {
+                fprintf(stderr, "at most %d models at once\n", MODELSET_MAX);
+                return -1;
+        }
+        models = malloc(sizeof(model_t *) * nmodels);
+        phrases = malloc(sizeof(gramset_t *) * nmodels);
+        if (models == NULL || phrases == NULL)
+                fatal_error("out of memory");
+        for (i = 0; i < nmodels; i++) {
+                char *gramsfile = sidecar_filename(modelfiles[i], ".grams");
+
+                models[i] = model_load(modelfiles[i]);
+                phrases[i] = NULL;
+                if (access(gramsfile, F_OK) == 0) {
+                        phrases[i] = gramset_load(gramsfile, &order);
+                        if (order > maxorder)
+                                maxorder = order;
+                }
+                free(gramsfile);
+        }
+        set = modelset_create(models, nmodels);
+
+        /* Phrase hashes do not depend on the order of the scanner, so
+         * one scanner of the largest order serves every model */
+        if (maxorder > 0) {
+                index = gramindex_create(phrases, nmodels);
+                classify_setphraseindex(index, maxorder);
+        }
+        for (i = 0; i < nmodels; i++) {
+                if (phrases[i] != NULL)
+                        gramset_destroy(phrases[i]);
+        }
+        free(phrases);
+        if (stream) {
+                classify_stream_multi(0, framing, modelset_score, set,
+                                      modelfiles, nmodels);
+        }
+        else {
+                list_t *maillist = find_files(maildir);
+                classify_files_multi(maillist, modelset_score, set,
+                                     modelfiles, nmodels, nthreads);
+                list_destroy(maillist);
+        }
+        if (index != NULL) {
+                classify_setphraseindex(NULL, 0);
+                gramindex_destroy(index);
+        }
+        modelset_destroy(set);
+        for (i = 0; i < nmodels; i++)
+                model_destroy(models[i]);
+        free(models);
+        return 0;
+}
+
+/*
+ * Classifies the mails under a directory, or the messages streamed on
+ * standard input, against one or more previously trained model files.
+ */
+static int cmd_classify(int argc, char **argv)
+{
+        int opt, nthreads = 1, stream = 0, nmodels;
+        enum framing framing = FRAMING_NUL;
+
+        while ((opt = getopt(argc, argv, "j:0L")) != -1) {
+                switch (opt) {
+                case 'j':
+                        nthreads = atoi(optarg);
+                        break;
+                case '0':
+                        stream = 1;
+                        framing = FRAMING_NUL;
+                        break;
+                case 'L':
+                        stream = 1;
+                        framing = FRAMING_LENGTH;
+                        break;
+                default:
+                        return -1;
+                }
+        }
+        nmodels = argc - optind - (stream ? 0 : 1);
+        if (nmodels < 1 || nthreads < 1)
+                return -1;
+        if (nmodels > 1)
+                return classify_multi(argv + optind, nmodels, argv[argc - 1],
+                                      stream, framing, nthreads);
+
+        model_t *model = model_load(argv[optind]);
+        gramset_t *phrases = load_phrases(argv[optind]);
+        if (stream) {
+                classify_stream(0, framing, model_score, model);
+        }
+        else {
+                list_t *maillist = find_files(argv[optind + 1]);
+                classify_files(maillist, model_score, model, nthreads);
+                list_destroy(maillist);
+        }
+        unload_phrases(phrases);
+        model_destroy(model);
+        return 0;
+}
+
+/*
+ * Trains a model on the given corpora in memory.  With --ngrams, also
+ * trains spam phrases and makes classification use them, storing them
+ * in *phrases for unload_phrases(); *phrases is NULL otherwise.
+ */
+static model_t *train_model(char *spamdir, char *nonspamdir,
+                            gramset_t **phrases)
+{
+        counts_t *counts = counts_create();
+        count_files(counts, spamdir, 1, 0);
+        count_files(counts, nonspamdir, 0, 0);
+        set_t *spamwords = counts_spamwords(counts);
+        model_t *model = model_create(spamwords);
+        set_destroy(spamwords);
+        counts_destroy(counts);
+
+        *phrases = NULL;
+        if (ngrams > 0) {
+                list_t *spamfiles = find_files(spamdir);
+                list_t *hamfiles = find_files(nonspamdir);
+                *phrases = ngram_train(spamfiles, hamfiles, ngrams);
+                classify_setphrases(*phrases, ngrams);
+                list_destroy(spamfiles);
+                list_destroy(hamfiles);
+        }
+        return model;
+}
+
+/*
+ * Loads or trains a model once, then answers classification requests
+ * on a Unix domain socket until interrupted.
+ */
+static int cmd_serve(int argc, char **argv)
+{
+        gramset_t *phrases = NULL;
+        model_t *model;
+        int opt, nthreads = 1;
+
+        while ((opt = getopt(argc, argv, "j:")) != -1) {
+                switch (opt) {
+                case 'j':
+                        nthreads = atoi(optarg);
+                        break;
+                default:
+                        return -1;
+                }
+        }
+        if (nthreads < 1)
+                return -1;
+        if (argc - optind == 2) {
+                model = model_load(argv[optind + 1]);
+                phrases = load_phrases(argv[optind + 1]);
+        }
+        else if (argc - optind == 3) {
+                model = train_model(argv[optind + 1], argv[optind + 2],
+                                    &phrases);
+        }
+        else {
+                return -1;
+        }
+
+        serve(argv[optind], model_score, model, nthreads);
+        unload_phrases(phrases);
+        model_destroy(model);
+        return 0;
+}
+
+/*
+ * Loads or trains a model once, then classifies mail as it is
+ * delivered into a maildir until interrupted.
+ */
+static int cmd_watch(int argc, char **argv)
+{
+        gramset_t *phrases = NULL;
+        model_t *model;
+
+        if (argc == 3) {
+                model = model_load(argv[1]);
+                phrases = load_phrases(argv[1]);
+        }
+        else if (argc == 4) {
+                model = train_model(argv[1], argv[2], &phrases);
+        }
+        else {
+                return -1;
+        }
+
+        watch(argv[argc - 1], model_score, model);
+        unload_phrases(phrases);
+        model_destroy(model);
+        return 0;
+}
+
+/*
+ * Parses a size in bytes, with an optional K, M or G suffix.  Returns 0
+ * on success, or -1 if the size is not valid or does not fit a size_t.
+ */
+static int parse_size(char *s, size_t *size)
+{
+        char *end;
+        unsigned long long n;
+        int shift = 0;
+
+        //strtoull() would take a sign, and wrap a negative size around
+        if (!isdigit((unsigned char)*s))
+                return -1;
+        errno = 0;
+        n = strtoull(s, &end, 10);
+        if (errno == ERANGE)
+                return -1;
+        switch (toupper((unsigned char)*end)) {
+        case 'G':
+                shift += 10;
+                /* Fall through */
+        case 'M':
+                shift += 10;
+                /* Fall through */
+        case 'K':
+                shift += 10;
+                end++;
+                break;
+        }
+        if (*end != 0 || n > (SIZE_MAX >> shift))
+                return -1;
+        *size = (size_t)n << shift;
+        return 0;
+}
+
+static void profile_word(void *sketch, const char *word)
+{
+        sketch_add(sketch, word);
+}
+
+/*
+ * Counts every word of the mails under each directory, repeats
+ * included, in a sketch of fixed size, and prints the most frequent
+ * words of each.
+ */
+static int cmd_profile(int argc, char **argv)
+{
+        size_t size = 4 << 20;
+        int opt, i, j, n, k = 20;
+
+        while ((opt = getopt(argc, argv, "k:m:")) != -1) {
+                switch (opt) {
+                case 'k':
+                        k = atoi(optarg);
+                        if (k < 1)
+                                return -1;
+                        break;
+                case 'm':
+                        if (parse_size(optarg, &size) < 0)
+                                return -1;
+                        break;
+                default:
+                        return -1;
+                }
+        }
+        if (argc - optind < 1)
+                return -1;
+
+        sketch_top_t *top = malloc(sizeof(sketch_top_t) * k);
+        if (top == NULL)
+                fatal_error("out of memory");
+        for (i = optind; i < argc; i++) {
+                sketch_t *sketch = sketch_create(size, k);
+                list_t *files = find_files(argv[i]);
+                list_iter_t *iter = list_createiter(files);
+                while (list_hasnext(iter)) {
+                        FILE *f = fopen(list_next(iter), "r");
+                        if (f == NULL) {
+                                perror("fopen");
+                                fatal_error("fopen() failed");
+                        }
+                        tokenize_each(f, profile_word, sketch);
+                        fclose(f);
+                }
+                list_destroyiter(iter);
+
+                printf("%s: %llu word(s) in %d mail(s), counts at most %llu "
+                       "over with %.0f%% confidence\n", argv[i],
+                       (unsigned long long)sketch_total(sketch),
+                       list_size(files),
+                       (unsigned long long)sketch_error(sketch),
+                       100 * sketch_confidence());
+                n = sketch_top(sketch, top);
+                for (j = 0; j < n; j++)
+                        printf("%12llu %s\n", (unsigned long long)top[j].count,
+                               top[j].word);
+                list_destroy(files);
+                sketch_destroy(sketch);
+        }
+        free(top);
+        return 0;
+}
 
 /*
  * Main entry point.
  */
 int main(int argc, char **argv)
 {
-	char *spamdir, *nonspamdir, *maildir;
-        
-	
-	if (argc != 4) {
-		fprintf(stderr, "usage: %s <spamdir> <nonspamdir> <maildir>\n",
-				argv[0]);
-		return 1;
-	}
-	spamdir = argv[1];
-	nonspamdir = argv[2];
-	maildir = argv[3];
-        
-        //Find intersection of the spamset. Then the unionset of the non-spam mails
-        set_t *spamset = operation_handler(spamdir, set_intersection);
-        set_t * nonspamset = operation_handler(nonspamdir, set_union);
+        int status, stats = 0, json = 0, memlimit = 0, skip;
+        cache_t *cache = NULL;
 
-        //Create and find the differance set
-        set_t *diffset = set_create(compare_words);
-        diffset = set_difference(spamset, nonspamset);
-        set_destroy(spamset);
-        set_destroy(nonspamset);        
+        /*
+         * Strip leading --stats, --dedup, --ngrams, --mem-limit and
+         * --cache options, keeping argv[0] for the usage message
+         */
+        for (;;) {
+                if (argc > 1 && (strcmp(argv[1], "--stats") == 0 ||
+                                 strcmp(argv[1], "--stats=json") == 0)) {
+                        stats = 1;
+                        json = strcmp(argv[1], "--stats=json") == 0;
+                        skip = 1;
+                }
+                else if (argc > 1 && strncmp(argv[1], "--ngrams", 8) == 0) {
+                        if (strcmp(argv[1], "--ngrams") == 0)
+                                ngrams = NGRAM_MAXORDER;
+                        else if (sscanf(argv[1], "--ngrams=%d", &ngrams) != 1 ||
+                                 ngrams < 2 || ngrams > NGRAM_MAXORDER)
+                                ngrams = -1;
+                        skip = 1;
+                }
+                else if (argc > 1 && strcmp(argv[1], "--dedup") == 0) {
+                        dedup_enable(1);
+                        skip = 1;
+                }
+                else if (argc > 2 && strcmp(argv[1], "--mem-limit") == 0) {
+                        size_t limit;
+                        if (parse_size(argv[2], &limit) < 0) {
+                                usage(argv[0]);
+                                return 1;
+                        }
+                        partial_setmemlimit(limit);
+                        memlimit = 1;
+                        skip = 2;
+                }
+                else if (argc > 2 && strcmp(argv[1], "--cache") == 0) {
+                        if (cache == NULL)
+                                cache = cache_open(argv[2]);
+                        skip = 2;
+                }
+                else {
+                        break;
+                }
+                argv[skip] = argv[0];
+                argc -= skip;
+                argv += skip;
+        }
+        if (ngrams < 0) {
+                usage(argv[0]);
+                return 1;
+        }
+        /* Only the partial models of train-shard and merge are bounded */
+        if (memlimit && (argc < 2 || (strcmp(argv[1], "train-shard") != 0 &&
+                                      strcmp(argv[1], "merge") != 0))) {
+                fprintf(stderr, "--mem-limit applies to train-shard and "
+                        "merge only\n");
+                usage(argv[0]);
+                return 1;
+        }
+        tokenize_setcache(cache);
 
+        if (argc > 1 && strcmp(argv[1], "train") == 0)
+                status = cmd_train(argc - 1, argv + 1);
+        else if (argc > 1 && strcmp(argv[1], "train-shard") == 0)
+                status = cmd_train_shard(argc - 1, argv + 1);
+        else if (argc > 1 && strcmp(argv[1], "merge") == 0)
+                status = cmd_merge(argc - 1, argv + 1);
+        else if (argc > 1 && strcmp(argv[1], "classify") == 0)
+                status = cmd_classify(argc - 1, argv + 1);
+        else if (argc > 1 && strcmp(argv[1], "add") == 0)
+                status = cmd_update(argc - 1, argv + 1, 0);
+        else if (argc > 1 && strcmp(argv[1], "remove") == 0)
+                status = cmd_update(argc - 1, argv + 1, 1);
+        else if (argc > 1 && strcmp(argv[1], "serve") == 0)
+                status = cmd_serve(argc - 1, argv + 1);
+        else if (argc > 1 && strcmp(argv[1], "watch") == 0)
+                status = cmd_watch(argc - 1, argv + 1);
+        else if (argc > 1 && strcmp(argv[1], "profile") == 0)
+                status = cmd_profile(argc - 1, argv + 1);
+        else
+                status = cmd_filter(argc, argv);
 
-        list_t *maillist = find_files(maildir);
-        list_iter_t *mailiter = list_createiter(maillist);
-        set_t *resultset, *mailset;
-        
-        while (list_hasnext(mailiter))  {
-            mailset = tokenize(list_peeknext(mailiter));    //Peek at the next item within the mailset
-            resultset = set_intersection(diffset, mailset);
-            printf("%s: %d spam word(s) -> %s\n", list_next(mailiter), set_size(resultset), (set_size(resultset) > 0) ? "SPAM" : "Not spam");   //Print whether the mail is spam or not
-            set_destroy(mailset);
-            set_destroy(resultset);
+        if (status < 0) {
+                usage(argv[0]);
+                return 1;
         }
-        list_destroy(maillist);
-        list_destroyiter(mailiter);
-        
-    return 0;
+        if (cache != NULL) {
+                tokenize_setcache(NULL);
+                cache_close(cache);
+        }
+        if (dedup_enabled())
+                dedup_report(stderr);
+        if (stats)
+                stats_print(stderr, json);
+        return status;
 }
@@ -0,0 +1,309 @@
+#include "spill.h"
+#include "arena.h"
+#include "typedset.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Estimated memory taken by each word in memory beyond the characters
+ * of long words: a set node and the allocator's header for it.
+ */
+#define NODE_OVERHEAD (sizeof(ssoset_node_t) + 16)
+
+/*
+ * Runs are merged into one once there are this many, which keeps the
+ * number of open files bounded.
+ */
+#define MAXRUNS 64
+
+struct spill {
+    size_t limit;
+    ssoset_t *words;    /* The words not spilled yet, short ones inline */
+    arena_t *arena;     /* Owns the long words not spilled yet */
+    FILE **runs;        /* Temporary files of NUL-terminated sorted words */
+    int numruns;
+    int maxruns;
+};
+
+/* One source of words being merged: a run, or the words in memory */
+struct source {
+    FILE *run;          /* NULL for the words in memory */
+    ssoset_node_t *node;    /* The next node of the words in memory */
+    char *word;         /* The current word of the source */
+    char *buf;          /* getdelim() buffer for runs */
+    size_t cap;
+};
+
+struct spill_iter {
+    struct source *sources;
+    int *heap;          /* Indexes of the sources not yet exhausted */
+    int size;
+    char *last;         /* The word last returned */
+    size_t lastcap;
+    int havelast;
+};
+
+spill_t *spill_create(size_t limit)
+{
+    spill_t *spill = malloc(sizeof(spill_t));
+
+    if (spill == NULL)
+        fatal_error("out of memory");
+    spill->limit = limit;
+    spill->words = ssoset_create(NULL);
+    spill->arena = arena_create();
+    spill->runs = NULL;
+    spill->numruns = 0;
+    spill->maxruns = 0;
+    return spill;
+}
+
+void spill_destroy(spill_t *spill)
+{
+    int i;
+
+    for (i = 0; i < spill->numruns; i++)
+        fclose(spill->runs[i]);
+    free(spill->runs);
+    ssoset_destroy(spill->words);
+    arena_destroy(spill->arena);
+    free(spill);
+}
+
+/*
+ * Creates a new run.  Temporary files are deleted by the system once
+ * closed.
+ */
+static FILE *create_run(void)
+{
+    FILE *f = tmpfile();
+
+    if (f == NULL) {
+        perror("tmpfile");
+        fatal_error("tmpfile() failed");
+    }
+    return f;
+}
+
+static void put_word(FILE *run, const char *word)
+{
+    size_t len = strlen(word) + 1;
+
+    if (fwrite(word, 1, len, run) != len) {
+        perror("fwrite");
+        fatal_error("fwrite() failed");
+    }
+}
+
+static void finish_run(FILE *run)
+{
+    if (fflush(run) != 0) {
+        perror("fflush");
+        fatal_error("fflush() failed");
+    }
+}
+
+/*
+ * Merges all the runs into one.  Called with no words in memory.
+ */
+static void compact(spill_t *spill)
+{
+    FILE *merged = create_run();
+    spill_iter_t *iter = spill_createiter(spill);
+    int i;
+
+    while (spill_hasnext(iter))
+        put_word(merged, spill_next(iter));
+    spill_destroyiter(iter);
+    finish_run(merged);
+    for (i = 0; i < spill->numruns; i++)
+        fclose(spill->runs[i]);
+    spill->runs[0] = merged;
+    spill->numruns = 1;
+}
+
+/*
+ * Writes the words in memory out as a new run, and frees them.
+ */
+static void write_run(spill_t *spill)
+{
+    ssoset_node_t *n;
+    FILE *f = create_run();
+
+    for (n = ssoset_first(spill->words); n != NULL; n = ssoset_next(n))
+        put_word(f, sso_str(&n->key));
+    finish_run(f);
+
+    if (spill->numruns == spill->maxruns) {
+        spill->maxruns = spill->maxruns == 0 ? 8 : 2 * spill->maxruns;
+        spill->runs = realloc(spill->runs, sizeof(FILE *) * spill->maxruns);
+        if (spill->runs == NULL)
+            fatal_error("out of memory");
+    }
+    spill->runs[spill->numruns++] = f;
+    stats_count(STATS_SPILLED_RUNS, 1);
+    ssoset_destroy(spill->words);
+    spill->words = ssoset_create(NULL);
+    arena_reset(spill->arena);
+    if (spill->numruns == MAXRUNS)
+        compact(spill);
+}
+
+void spill_add(spill_t *spill, char *word)
+{
+    sso_t key = sso_make(word);
+
+    if (ssoset_contains(spill->words, key))
+        return;
+    if (key.len == SSO_LONG)
+        key.u.ptr = arena_strdup(spill->arena, word);
+    ssoset_add(spill->words, key);
+    if (spill->limit > 0 &&
+        arena_used(spill->arena) +
+        (size_t)ssoset_size(spill->words) * NODE_OVERHEAD >= spill->limit)
+        write_run(spill);
+}
+
+/*
+ * Moves the given source to its next word.  Returns 0 if it has none.
+ */
+static int advance(struct source *src)
+{
+    if (src->run == NULL) {
+        if (src->node == NULL)
+            return 0;
+        src->word = (char *)sso_str(&src->node->key);
+        src->node = ssoset_next(src->node);
+        return 1;
+    }
+    if (getdelim(&src->buf, &src->cap, '\0', src->run) < 0)
+        return 0;
+    src->word = src->buf;
+    return 1;
+}
+
+// Returns 1 if source a should come out of the heap before source b
+static int merge_before(spill_iter_t *iter, int a, int b)
+{
+    int comp_result;
+
+    stats_count(STATS_COMPARES, 1);
+    comp_result = compare_words(iter->sources[a].word, iter->sources[b].word);
+    return comp_result < 0 || (comp_result == 0 && a < b);
+}
+
+static void sift_down(spill_iter_t *iter, int i)
+{
+    while (1) {
+        int smallest = i, l = 2 * i + 1, r = 2 * i + 2, tmp;
+
+        if (l < iter->size && merge_before(iter, iter->heap[l], iter->heap[smallest]))
+            smallest = l;
+        if (r < iter->size && merge_before(iter, iter->heap[r], iter->heap[smallest]))
+            smallest = r;
+        if (smallest == i)
+            return;
+        tmp = iter->heap[i];
+        iter->heap[i] = iter->heap[smallest];
+        iter->heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+/*
+ * Moves the source at the top of the heap to its next word, dropping it
+ * from the heap if it has none.
+ */
+static void pop(spill_iter_t *iter)
+{
+    if (!advance(&iter->sources[iter->heap[0]]))
+        iter->heap[0] = iter->heap[--iter->size];
+    sift_down(iter, 0);
+}
+
+/*
+ * Drops the words at the top of the heap that equal the word last
+ * returned, which other runs also held.
+ */
+static void skip_returned(spill_iter_t *iter)
+{
+    while (iter->size > 0 && iter->havelast &&
+           compare_words(iter->sources[iter->heap[0]].word, iter->last) == 0)
+        pop(iter);
+}
+
+spill_iter_t *spill_createiter(spill_t *spill)
+{
+    spill_iter_t *iter = malloc(sizeof(spill_iter_t));
+    int i, n = spill->numruns + 1;
+
+    if (iter == NULL)
+        fatal_error("out of memory");
+    iter->sources = calloc(n, sizeof(struct source));
+    iter->heap = malloc(sizeof(int) * n);
+    if (iter->sources == NULL || iter->heap == NULL)
+        fatal_error("out of memory");
+    iter->size = 0;
+    iter->last = NULL;
+    iter->lastcap = 0;
+    iter->havelast = 0;
+    for (i = 0; i < n; i++) {
+        struct source *src = &iter->sources[i];
+        if (i < spill->numruns) {
+            src->run = spill->runs[i];
+            rewind(src->run);
+        }
+        else {
+            src->node = ssoset_first(spill->words);
+        }
+        if (advance(src))
+            iter->heap[iter->size++] = i;
+    }
+    for (i = iter->size / 2 - 1; i >= 0; i--)
+        sift_down(iter, i);
+    return iter;
+}
+
+void spill_destroyiter(spill_iter_t *iter)
+{
+    int i;
+
+    /* The words in memory are always the last source */
+    for (i = 0; iter->sources[i].run != NULL; i++)
+        free(iter->sources[i].buf);
+    free(iter->sources);
+    free(iter->heap);
+    free(iter->last);
+    free(iter);
+}
+
+int spill_hasnext(spill_iter_t *iter)
+{
+    skip_returned(iter);
+    return iter->size > 0;
+}
+
+char *spill_next(spill_iter_t *iter)
+{
+    char *word;
+    size_t len;
+
+    skip_returned(iter);
+    if (iter->size == 0)
+        return NULL;
+    word = iter->sources[iter->heap[0]].word;
+    len = strlen(word) + 1;
+    if (len > iter->lastcap) {
+        iter->lastcap = len * 2;
+        iter->last = realloc(iter->last, iter->lastcap);
+        if (iter->last == NULL)
+            fatal_error("out of memory");
+    }
+    memcpy(iter->last, word, len);
+    iter->havelast = 1;
+    pop(iter);
+    return iter->last;
+}
@@ -0,0 +1,57 @@
+#ifndef SPILL_H
+#define SPILL_H
+
+#include "common.h"
+
+/*
+ * A set of words that stays within a memory budget by spilling to
+ * disk.  Words are collected in memory until the budget is reached,
+ * then written out in order as a sorted run to a temporary file, and
+ * collection starts over.  Iterating over the set merges the runs and
+ * the words still in memory, so the set never has to fit in memory as
+ * a whole.  Only adding words and iterating over them in order are
+ * supported.
+ *
+ * Words are compared with compare_words(), and the spilled set holds
+ * copies of the words added to it.
+ */
+struct spill;
+typedef struct spill spill_t;
+
+/*
+ * Creates a new, empty spilled set that keeps at most about limit bytes
+ * of words in memory, or never spills if limit is 0.
+ */
+spill_t *spill_create(size_t limit);
+
+/*
+ * Destroys the given spilled set and removes its runs.
+ */
+void spill_destroy(spill_t *spill);
+
+/*
+ * Adds a copy of the given word to the set, unless it already holds it.
+ * Words already spilled to a run may be added again, and are only
+ * merged away when iterating.
+ */
+void spill_add(spill_t *spill, char *word);
+
+/*
+ * The type of spilled set iterators, which return the words of the set
+ * in order, once each.  The set must not change while iterated over,
+ * and only one iterator may be open on it at a time.
+ */
+struct spill_iter;
+typedef struct spill_iter spill_iter_t;
+
+spill_iter_t *spill_createiter(spill_t *spill);
+void spill_destroyiter(spill_iter_t *iter);
+int spill_hasnext(spill_iter_t *iter);
+
+/*
+ * Returns the next word of the set.  The word stays valid until the
+ * next call to spill_next() or spill_destroyiter().
+ */
+char *spill_next(spill_iter_t *iter);
+
+#endif
@@ -0,0 +1,239 @@
+#include "stats.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* Process resource usage, printed with or without the counters */
+static void print_rusage(FILE *out, int json)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    if (json)
+        fprintf(out, "\"process\":{\"user_seconds\":%.6f,"
+                "\"sys_seconds\":%.6f,\"peak_rss_kb\":%ld}",
+                ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+                ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+                ru.ru_maxrss);
+    else
+        fprintf(out, "process: user %.3fs, sys %.3fs, peak rss %ld KB\n",
+                ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+                ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6,
+                ru.ru_maxrss);
+}
+
+#ifndef NO_STATS
+
+#include <pthread.h>
+
+static const char *counter_names[STATS_NUM_COUNTERS] = {
+    "bytes_read", "tokens", "unique_tokens", "compares", "node_allocs",
+    "cache_hits", "cache_misses", "duplicates",
+    "spilled_runs", "wordset_bytes"
+};
+
+static const char *stage_names[STATS_NUM_STAGES] = {
+    "find_files", "tokenize", "intersection", "union", "difference",
+    "model_io"
+};
+
+/*
+ * Latencies below 2^SUBBITS ns get a bucket each.  Above that, each
+ * power of two is split into 2^SUBBITS buckets, so a bucket is within
+ * about 6% of any latency in it.
+ */
+#define SUBBITS 4
+
+__thread struct stats_block *stats_local_block;
+
+static struct stats_block *blocks;
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct stats_block *stats_register(void)
+{
+    struct stats_block *block = calloc(1, sizeof(struct stats_block));
+
+    if (block == NULL)
+        fatal_error("out of memory");
+    pthread_mutex_lock(&blocks_lock);
+    block->next = blocks;
+    blocks = block;
+    pthread_mutex_unlock(&blocks_lock);
+    return block;
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t stats_now(void)
+{
+    return clock_ns(CLOCK_MONOTONIC);
+}
+
+void stats_start(stats_timer_t *timer)
+{
+    timer->wall = clock_ns(CLOCK_MONOTONIC);
+    timer->cpu = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void stats_stop(stats_timer_t *timer, enum stats_stage stage)
+{
+    struct stats_block *block = stats_local();
+
+    block->calls[stage]++;
+    block->wall[stage] += clock_ns(CLOCK_MONOTONIC) - timer->wall;
+    block->cpu[stage] += clock_ns(CLOCK_THREAD_CPUTIME_ID) - timer->cpu;
+}
+
+static int bucket_of(uint64_t ns)
+{
+    int msb;
+
+    if (ns < (1 << SUBBITS))
+        return (int)ns;
+    msb = 63 - __builtin_clzll(ns);
+    return (msb - SUBBITS + 1) * (1 << SUBBITS) +
+           (int)((ns >> (msb - SUBBITS)) & ((1 << SUBBITS) - 1));
+}
+
+/* The largest latency that falls in the given bucket */
+static uint64_t bucket_limit(int bucket)
+{
+    int group = bucket >> SUBBITS, sub = bucket & ((1 << SUBBITS) - 1);
+
+    if (group == 0)
+        return sub;
+    return (((uint64_t)(1 << SUBBITS) + sub + 1) << (group - 1)) - 1;
+}
+
+void stats_latency(uint64_t ns)
+{
+    struct stats_block *block = stats_local();
+    int bucket = bucket_of(ns);
+
+    if (bucket >= STATS_BUCKETS)
+        bucket = STATS_BUCKETS - 1;
+    block->latencies[bucket]++;
+    if (ns > block->maxlatency)
+        block->maxlatency = ns;
+}
+
+void stats_wordset(uint64_t bytes)
+{
+    struct stats_block *block = stats_local();
+
+    block->counters[STATS_WORDSET_BYTES] += bytes;
+    if (bytes > block->maxwordset)
+        block->maxwordset = bytes;
+}
+
+/*
+ * Returns an upper bound on the given percentile of the histogram,
+ * which holds total latencies, clamped to the largest latency seen.
+ */
+static uint64_t percentile(uint64_t *hist, uint64_t total, uint64_t max,
+                           double p)
+{
+    uint64_t rank = (uint64_t)(total * p), seen = 0, limit;
+    int i;
+
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > rank)
+            break;
+    }
+    if (i == STATS_BUCKETS)
+        return max;
+    limit = bucket_limit(i);
+    return limit < max ? limit : max;
+}
+
+void stats_print(FILE *out, int json)
+{
+    struct stats_block sum, *b;
+    uint64_t mails = 0, p50, p99;
+    int i;
+
+    memset(&sum, 0, sizeof(sum));
+    pthread_mutex_lock(&blocks_lock);
+    for (b = blocks; b != NULL; b = b->next) {
+        for (i = 0; i < STATS_NUM_COUNTERS; i++)
+            sum.counters[i] += b->counters[i];
+        for (i = 0; i < STATS_NUM_STAGES; i++) {
+            sum.calls[i] += b->calls[i];
+            sum.wall[i] += b->wall[i];
+            sum.cpu[i] += b->cpu[i];
+        }
+        for (i = 0; i < STATS_BUCKETS; i++)
+            sum.latencies[i] += b->latencies[i];
+        if (b->maxlatency > sum.maxlatency)
+            sum.maxlatency = b->maxlatency;
+        if (b->maxwordset > sum.maxwordset)
+            sum.maxwordset = b->maxwordset;
+    }
+    pthread_mutex_unlock(&blocks_lock);
+    for (i = 0; i < STATS_BUCKETS; i++)
+        mails += sum.latencies[i];
+    p50 = percentile(sum.latencies, mails, sum.maxlatency, 0.50);
+    p99 = percentile(sum.latencies, mails, sum.maxlatency, 0.99);
+
+    if (json) {
+        fprintf(out, "{\"counters\":{");
+        for (i = 0; i < STATS_NUM_COUNTERS; i++)
+            fprintf(out, "%s\"%s\":%llu", i ? "," : "", counter_names[i],
+                    (unsigned long long)sum.counters[i]);
+        fprintf(out, "},\"stages\":{");
+        for (i = 0; i < STATS_NUM_STAGES; i++)
+            fprintf(out, "%s\"%s\":{\"calls\":%llu,\"wall_seconds\":%.6f,"
+                    "\"cpu_seconds\":%.6f}", i ? "," : "", stage_names[i],
+                    (unsigned long long)sum.calls[i], sum.wall[i] / 1e9,
+                    sum.cpu[i] / 1e9);
+        fprintf(out, "},\"latency\":{\"mails\":%llu,\"p50_us\":%.1f,"
+                "\"p99_us\":%.1f,\"max_us\":%.1f},",
+                (unsigned long long)mails, p50 / 1e3, p99 / 1e3,
+                sum.maxlatency / 1e3);
+        fprintf(out, "\"memory\":{\"wordset_peak_bytes\":%llu},",
+                (unsigned long long)sum.maxwordset);
+        print_rusage(out, json);
+        fprintf(out, "}\n");
+        return;
+    }
+    for (i = 0; i < STATS_NUM_COUNTERS; i++)
+        fprintf(out, "%-14s %llu\n", counter_names[i],
+                (unsigned long long)sum.counters[i]);
+    for (i = 0; i < STATS_NUM_STAGES; i++)
+        fprintf(out, "%-14s %llu call(s), wall %.3fs, cpu %.3fs\n",
+                stage_names[i], (unsigned long long)sum.calls[i],
+                sum.wall[i] / 1e9, sum.cpu[i] / 1e9);
+    fprintf(out, "latency: %llu mail(s), p50 %.1fus, p99 %.1fus, max %.1fus\n",
+            (unsigned long long)mails, p50 / 1e3, p99 / 1e3,
+            sum.maxlatency / 1e3);
+    fprintf(out, "memory: largest word set %llu byte(s)\n",
+            (unsigned long long)sum.maxwordset);
+    print_rusage(out, json);
+}
+
+#else
+
+void stats_print(FILE *out, int json)
+{
+    if (json) {
+        fprintf(out, "{");
+        print_rusage(out, json);
+        fprintf(out, "}\n");
+    }
+    else {
+        fprintf(out, "(built without statistics)\n");
+        print_rusage(out, json);
+    }
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Run statistics: event counters, per-stage wall and CPU time, and a
+ * histogram of per-mail latencies.  Each thread updates a block of its
+ * own, so recording an event is a plain increment; the blocks are only
+ * summed when the statistics are printed.
+ *
+ * Statistics are compiled in by default.  Building with -DNO_STATS
+ * turns every recording call below into a no-op.
+ */
+
+enum stats_counter {
+    STATS_BYTES_READ,       /* Bytes of mail fed to the tokenizer */
+    STATS_TOKENS,           /* Words recognized, duplicates included */
+    STATS_UNIQUE_TOKENS,    /* Words that were new to their message */
+    STATS_COMPARES,         /* Calls to set comparison functions */
+    STATS_NODE_ALLOCS,      /* Set and list nodes allocated */
+    STATS_CACHE_HITS,       /* Files whose words were read from the cache */
+    STATS_CACHE_MISSES,     /* Files tokenized and stored in the cache */
+    STATS_DUPLICATES,       /* Files skipped as copies of earlier files */
+    STATS_SPILLED_RUNS,     /* Sorted runs of words spilled to disk */
+    STATS_WORDSET_BYTES,    /* Memory of the word sets of messages */
+    STATS_NUM_COUNTERS
+};
+
+/*
+ * Stages may nest; each one is timed inclusively.
+ */
+enum stats_stage {
+    STAGE_FIND_FILES,
+    STAGE_TOKENIZE,
+    STAGE_INTERSECTION,
+    STAGE_UNION,
+    STAGE_DIFFERENCE,
+    STAGE_MODEL_IO,
+    STATS_NUM_STAGES
+};
+
+/*
+ * The start of a stage, as returned by stats_start().
+ */
+typedef struct stats_timer {
+    uint64_t wall;
+    uint64_t cpu;
+} stats_timer_t;
+
+#ifndef NO_STATS
+
+#define STATS_BUCKETS 1024
+
+struct stats_block {
+    uint64_t counters[STATS_NUM_COUNTERS];
+    uint64_t calls[STATS_NUM_STAGES];
+    uint64_t wall[STATS_NUM_STAGES];    /* Nanoseconds */
+    uint64_t cpu[STATS_NUM_STAGES];     /* Nanoseconds */
+    uint64_t latencies[STATS_BUCKETS];  /* Log-linear histogram */
+    uint64_t maxlatency;
+    uint64_t maxwordset;                /* Bytes */
+    struct stats_block *next;
+};
+
+extern __thread struct stats_block *stats_local_block;
+
+/*
+ * Allocates the calling thread's block.  Use stats_local() instead.
+ */
+struct stats_block *stats_register(void);
+
+/*
+ * Returns the calling thread's block.
+ */
+static inline struct stats_block *stats_local(void)
+{
+    if (stats_local_block == NULL)
+        stats_local_block = stats_register();
+    return stats_local_block;
+}
+
+/*
+ * Adds n to the given counter.
+ */
+static inline void stats_count(enum stats_counter counter, uint64_t n)
+{
+    stats_local()->counters[counter] += n;
+}
+
+/*
+ * Returns the current monotonic time, in nanoseconds.
+ */
+uint64_t stats_now(void);
+
+/*
+ * Marks the start of a stage in the given timer.
+ */
+void stats_start(stats_timer_t *timer);
+
+/*
+ * Ends the stage started in the given timer, adding the wall and CPU
+ * time spent since to it.  CPU time is that of the calling thread.
+ */
+void stats_stop(stats_timer_t *timer, enum stats_stage stage);
+
+/*
+ * Records the latency of one mail, in nanoseconds.
+ */
+void stats_latency(uint64_t ns);
+
+/*
+ * Records the memory taken by the set of words of one mail, in bytes.
+ */
+void stats_wordset(uint64_t bytes);
+
+#else
+
+#define stats_count(counter, n)   ((void)0)
+#define stats_now()               ((uint64_t)0)
+#define stats_start(timer)        ((void)(timer))
+#define stats_stop(timer, stage)  ((void)(timer))
+#define stats_latency(ns)         ((void)(ns))
+#define stats_wordset(bytes)      ((void)(bytes))
+
+#endif
+
+/*
+ * Prints the statistics gathered by all threads so far, as text or,
+ * if json is nonzero, as a single JSON object.  Threads should have
+ * stopped recording.
+ */
+void stats_print(FILE *out, int json);
+
+#endif
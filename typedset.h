@@ -0,0 +1,515 @@
+#ifndef TYPEDSET_H
+#define TYPEDSET_H
+
+#include "common.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+/*
+ * Type-specialized sets and lists.  SET_DEFINE(name, type, cmp) and
+ * LIST_DEFINE(name, type, cmp) generate a red-black tree set and a
+ * doubly linked list whose nodes store keys of the given type inline,
+ * and whose comparisons expand the cmp macro in place, so that the
+ * compiler can inline them instead of calling through a cmpfunc_t.
+ *
+ * cmp(c, a, b) is given the container and two keys, and returns a
+ * negative, zero, or positive value like strcmp().  Only the generic
+ * instantiations over void * use the container, to reach the
+ * comparison function it was created with; specialized containers are
+ * created with a NULL comparison function.
+ *
+ * For a set named foo, the generated API is:
+ *
+ *   foo_t *foo_create(cmpfunc_t compare);
+ *   void foo_destroy(foo_t *set);
+ *   int foo_size(foo_t *set);
+ *   int foo_add(foo_t *set, type key);       1 if key was added
+ *   int foo_contains(foo_t *set, type key);
+ *   type *foo_find(foo_t *set, type key);    the stored key, or NULL
+ *   type *foo_insert(foo_t *set, type key);  the stored key, added if new
+ *   foo_node_t *foo_first(foo_t *set);       iteration in key order,
+ *   foo_node_t *foo_next(foo_node_t *node);  with node->key
+ *   foo_t *foo_union(foo_t *a, foo_t *b);
+ *   foo_t *foo_intersection(foo_t *a, foo_t *b);
+ *   foo_t *foo_difference(foo_t *a, foo_t *b);
+ *
+ * Set operations keep the keys of a where a and b hold equal keys.
+ *
+ * For a list named bar, the generated API is:
+ *
+ *   bar_t *bar_create(cmpfunc_t compare);
+ *   void bar_destroy(bar_t *list);
+ *   int bar_size(bar_t *list);
+ *   void bar_addfirst(bar_t *list, type elem);
+ *   void bar_addlast(bar_t *list, type elem);
+ *   type bar_popfirst(bar_t *list);          the list must not be empty
+ *   type bar_poplast(bar_t *list);
+ *   int bar_contains(bar_t *list, type elem);
+ *   void bar_sort(bar_t *list);
+ *   bar_node_t *bar_first(bar_t *list);      iteration in list order,
+ *   bar_node_t *bar_next(bar_node_t *node);  with node->elem
+ */
+
+/* Comparison macros for the common key types */
+#define TYPED_CMP_NUM(c, a, b)   (((a) > (b)) - ((a) < (b)))
+#define TYPED_CMP_STR(c, a, b)   strcmp(a, b)
+#define TYPED_CMP_WORD(c, a, b)  strcasecmp(a, b)
+#define TYPED_CMP_FUNC(c, a, b)  ((c)->compare(a, b))
+
+/*
+ * Short-string keys.  A string of up to SSO_INLINE characters is
+ * copied into the key itself, and so into the node that holds it, so
+ * that comparing it reads the node's own cache line rather than
+ * chasing a pointer.  A longer string is referred to by pointer, and
+ * must outlive the key, as with char * keys.
+ */
+#define SSO_INLINE 15
+#define SSO_LONG   255      /* len of a key referring to its string */
+
+typedef struct sso {
+    union {
+        char inl[SSO_INLINE + 1];   /* NUL-terminated */
+        const char *ptr;
+    } u;
+    unsigned char len;
+} sso_t;
+
+static inline sso_t sso_make(const char *s)
+{
+    sso_t key;
+    size_t len = strlen(s);
+
+    if (len <= SSO_INLINE) {
+        memcpy(key.u.inl, s, len + 1);
+        key.len = len;
+    }
+    else {
+        key.u.ptr = s;
+        key.len = SSO_LONG;
+    }
+    return key;
+}
+
+/* The string of the given key, which must stay put while it is used */
+static inline const char *sso_str(const sso_t *key)
+{
+    return key->len == SSO_LONG ? key->u.ptr : key->u.inl;
+}
+
+#define TYPED_CMP_SSOWORD(c, a, b)  strcasecmp(sso_str(&(a)), sso_str(&(b)))
+
+#define SET_DEFINE(name, type, cmp)                                         \
+typedef struct name##_node {                                                \
+    type key;                                                               \
+    struct name##_node *left;                                               \
+    struct name##_node *right;                                              \
+    struct name##_node *parent;                                             \
+    int red;                                                                \
+} name##_node_t;                                                            \
+                                                                            \
+typedef struct name {                                                       \
+    name##_node_t *root;                                                    \
+    int size;                                                               \
+    cmpfunc_t compare;                                                      \
+} name##_t;                                                                 \
+                                                                            \
+static inline name##_t *name##_create(cmpfunc_t compare)                    \
+{                                                                           \
+    name##_t *set = malloc(sizeof(name##_t));                               \
+    if (set == NULL)                                                        \
+        fatal_error("out of memory");                                       \
+    set->root = NULL;                                                       \
+    set->size = 0;                                                          \
+    set->compare = compare;                                                 \
+    return set;                                                             \
+}                                                                           \
+                                                                            \
+static inline void name##_destroynodes(name##_node_t *n)                    \
+{                                                                           \
+    while (n != NULL) {                                                     \
+        name##_node_t *right = n->right;                                    \
+        name##_destroynodes(n->left);                                       \
+        free(n);                                                            \
+        n = right;                                                          \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static inline void name##_destroy(name##_t *set)                            \
+{                                                                           \
+    name##_destroynodes(set->root);                                         \
+    free(set);                                                              \
+}                                                                           \
+                                                                            \
+static inline int name##_size(name##_t *set)                                \
+{                                                                           \
+    return set->size;                                                       \
+}                                                                           \
+                                                                            \
+static inline type *name##_find(name##_t *set, type key)                    \
+{                                                                           \
+    name##_node_t *n = set->root;                                           \
+    while (n != NULL) {                                                     \
+        int c = cmp(set, key, n->key);                                      \
+        if (c == 0)                                                         \
+            return &n->key;                                                 \
+        n = c < 0 ? n->left : n->right;                                     \
+    }                                                                       \
+    return NULL;                                                            \
+}                                                                           \
+                                                                            \
+static inline int name##_contains(name##_t *set, type key)                  \
+{                                                                           \
+    return name##_find(set, key) != NULL;                                   \
+}                                                                           \
+                                                                            \
+static inline void name##_rotate(name##_t *set, name##_node_t *n, int left) \
+{                                                                           \
+    name##_node_t *p = n->parent, *c = left ? n->right : n->left;           \
+    if (left) {                                                             \
+        n->right = c->left;                                                 \
+        if (c->left != NULL)                                                \
+            c->left->parent = n;                                            \
+        c->left = n;                                                        \
+    }                                                                       \
+    else {                                                                  \
+        n->left = c->right;                                                 \
+        if (c->right != NULL)                                               \
+            c->right->parent = n;                                           \
+        c->right = n;                                                       \
+    }                                                                       \
+    n->parent = c;                                                          \
+    c->parent = p;                                                          \
+    if (p == NULL)                                                          \
+        set->root = c;                                                      \
+    else if (p->left == n)                                                  \
+        p->left = c;                                                        \
+    else                                                                    \
+        p->right = c;                                                       \
+}                                                                           \
+                                                                            \
+static inline type *name##_insert(name##_t *set, type key)                  \
+{                                                                           \
+    name##_node_t *n = set->root, *p = NULL, *g, *u, *added;                \
+    int c = 0;                                                              \
+                                                                            \
+    while (n != NULL) {                                                     \
+        c = cmp(set, key, n->key);                                          \
+        if (c == 0)                                                         \
+            return &n->key;                                                 \
+        p = n;                                                              \
+        n = c < 0 ? n->left : n->right;                                     \
+    }                                                                       \
+    n = added = malloc(sizeof(name##_node_t));                              \
+    if (n == NULL)                                                          \
+        fatal_error("out of memory");                                       \
+    stats_count(STATS_NODE_ALLOCS, 1);                                      \
+    n->key = key;                                                           \
+    n->left = n->right = NULL;                                              \
+    n->parent = p;                                                          \
+    n->red = 1;                                                             \
+    if (p == NULL)                                                          \
+        set->root = n;                                                      \
+    else if (c < 0)                                                         \
+        p->left = n;                                                        \
+    else                                                                    \
+        p->right = n;                                                       \
+    set->size++;                                                            \
+                                                                            \
+    /* Restore the red-black properties */                                  \
+    while ((p = n->parent) != NULL && p->red) {                             \
+        g = p->parent;                                                      \
+        u = (p == g->left) ? g->right : g->left;                            \
+        if (u != NULL && u->red) {                                          \
+            p->red = 0;                                                     \
+            u->red = 0;                                                     \
+            g->red = 1;                                                     \
+            n = g;                                                          \
+            continue;                                                       \
+        }                                                                   \
+        if (p == g->left && n == p->right) {                                \
+            name##_rotate(set, p, 1);                                       \
+            n = p;                                                          \
+            p = n->parent;                                                  \
+        }                                                                   \
+        else if (p == g->right && n == p->left) {                           \
+            name##_rotate(set, p, 0);                                       \
+            n = p;                                                          \
+            p = n->parent;                                                  \
+        }                                                                   \
+        p->red = 0;                                                         \
+        g->red = 1;                                                         \
+        name##_rotate(set, g, p != g->left);                                \
+    }                                                                       \
+    set->root->red = 0;                                                     \
+    return &added->key;                                                     \
+}                                                                           \
+                                                                            \
+static inline int name##_add(name##_t *set, type key)                       \
+{                                                                           \
+    int size = set->size;                                                   \
+    name##_insert(set, key);                                                \
+    return set->size != size;                                               \
+}                                                                           \
+                                                                            \
+static inline name##_node_t *name##_first(name##_t *set)                    \
+{                                                                           \
+    name##_node_t *n = set->root;                                           \
+    if (n != NULL)                                                          \
+        while (n->left != NULL)                                             \
+            n = n->left;                                                    \
+    return n;                                                               \
+}                                                                           \
+                                                                            \
+static inline name##_node_t *name##_next(name##_node_t *n)                  \
+{                                                                           \
+    if (n->right != NULL) {                                                 \
+        n = n->right;                                                       \
+        while (n->left != NULL)                                             \
+            n = n->left;                                                    \
+        return n;                                                           \
+    }                                                                       \
+    while (n->parent != NULL && n == n->parent->right)                      \
+        n = n->parent;                                                      \
+    return n->parent;                                                       \
+}                                                                           \
+                                                                            \
+/* Merges a and b in order, keeping keys only in a (keep & 1), in       */  \
+/* both (keep & 2), and only in b (keep & 4)                            */  \
+static inline name##_t *name##_merge(name##_t *a, name##_t *b, int keep)    \
+{                                                                           \
+    name##_t *result = name##_create(a->compare);                           \
+    name##_node_t *x = name##_first(a), *y = name##_first(b);               \
+    while (x != NULL || y != NULL) {                                        \
+        int c = x == NULL ? 1 : y == NULL ? -1 : cmp(a, x->key, y->key);    \
+        if (c < 0) {                                                        \
+            if (keep & 1)                                                   \
+                name##_add(result, x->key);                                 \
+            x = name##_next(x);                                             \
+        }                                                                   \
+        else if (c > 0) {                                                   \
+            if (keep & 4)                                                   \
+                name##_add(result, y->key);                                 \
+            y = name##_next(y);                                             \
+        }                                                                   \
+        else {                                                              \
+            if (keep & 2)                                                   \
+                name##_add(result, x->key);                                 \
+            x = name##_next(x);                                             \
+            y = name##_next(y);                                             \
+        }                                                                   \
+    }                                                                       \
+    return result;                                                          \
+}                                                                           \
+                                                                            \
+static inline name##_t *name##_union(name##_t *a, name##_t *b)              \
+{                                                                           \
+    return name##_merge(a, b, 7);                                           \
+}                                                                           \
+                                                                            \
+static inline name##_t *name##_intersection(name##_t *a, name##_t *b)       \
+{                                                                           \
+    return name##_merge(a, b, 2);                                           \
+}                                                                           \
+                                                                            \
+static inline name##_t *name##_difference(name##_t *a, name##_t *b)         \
+{                                                                           \
+    return name##_merge(a, b, 1);                                           \
+}
+
+#define LIST_DEFINE(name, type, cmp)                                        \
+typedef struct name##_node {                                                \
+    type elem;                                                              \
+    struct name##_node *next;                                               \
+    struct name##_node *prev;                                               \
+} name##_node_t;                                                            \
+                                                                            \
+typedef struct name {                                                       \
+    name##_node_t *head;                                                    \
+    name##_node_t *tail;                                                    \
+    int size;                                                               \
+    cmpfunc_t compare;                                                      \
+} name##_t;                                                                 \
+                                                                            \
+static inline name##_t *name##_create(cmpfunc_t compare)                    \
+{                                                                           \
+    name##_t *list = malloc(sizeof(name##_t));                              \
+    if (list == NULL)                                                       \
+        fatal_error("out of memory");                                       \
+    list->head = list->tail = NULL;                                         \
+    list->size = 0;                                                         \
+    list->compare = compare;                                                \
+    return list;                                                            \
+}                                                                           \
+                                                                            \
+static inline void name##_destroy(name##_t *list)                           \
+{                                                                           \
+    name##_node_t *n = list->head;                                          \
+    while (n != NULL) {                                                     \
+        name##_node_t *next = n->next;                                      \
+        free(n);                                                            \
+        n = next;                                                           \
+    }                                                                       \
+    free(list);                                                             \
+}                                                                           \
+                                                                            \
+static inline int name##_size(name##_t *list)                               \
+{                                                                           \
+    return list->size;                                                      \
+}                                                                           \
+                                                                            \
+static inline name##_node_t *name##_newnode(type elem)                      \
+{                                                                           \
+    name##_node_t *n = malloc(sizeof(name##_node_t));                       \
+    if (n == NULL)                                                          \
+        fatal_error("out of memory");                                       \
+    stats_count(STATS_NODE_ALLOCS, 1);                                      \
+    n->elem = elem;                                                         \
+    return n;                                                               \
+}                                                                           \
+                                                                            \
+static inline void name##_addfirst(name##_t *list, type elem)               \
+{                                                                           \
+    name##_node_t *n = name##_newnode(elem);                                \
+    n->prev = NULL;                                                         \
+    n->next = list->head;                                                   \
+    if (list->head != NULL)                                                 \
+        list->head->prev = n;                                               \
+    else                                                                    \
+        list->tail = n;                                                     \
+    list->head = n;                                                         \
+    list->size++;                                                           \
+}                                                                           \
+                                                                            \
+static inline void name##_addlast(name##_t *list, type elem)                \
+{                                                                           \
+    name##_node_t *n = name##_newnode(elem);                                \
+    n->next = NULL;                                                         \
+    n->prev = list->tail;                                                   \
+    if (list->tail != NULL)                                                 \
+        list->tail->next = n;                                               \
+    else                                                                    \
+        list->head = n;                                                     \
+    list->tail = n;                                                         \
+    list->size++;                                                           \
+}                                                                           \
+                                                                            \
+static inline type name##_popfirst(name##_t *list)                          \
+{                                                                           \
+    name##_node_t *n = list->head;                                          \
+    type elem = n->elem;                                                    \
+    list->head = n->next;                                                   \
+    if (list->head != NULL)                                                 \
+        list->head->prev = NULL;                                            \
+    else                                                                    \
+        list->tail = NULL;                                                  \
+    list->size--;                                                           \
+    free(n);                                                                \
+    return elem;                                                            \
+}                                                                           \
+                                                                            \
+static inline type name##_poplast(name##_t *list)                           \
+{                                                                           \
+    name##_node_t *n = list->tail;                                          \
+    type elem = n->elem;                                                    \
+    list->tail = n->prev;                                                   \
+    if (list->tail != NULL)                                                 \
+        list->tail->next = NULL;                                            \
+    else                                                                    \
+        list->head = NULL;                                                  \
+    list->size--;                                                           \
+    free(n);                                                                \
+    return elem;                                                            \
+}                                                                           \
+                                                                            \
+static inline int name##_contains(name##_t *list, type elem)                \
+{                                                                           \
+    name##_node_t *n;                                                       \
+    for (n = list->head; n != NULL; n = n->next) {                          \
+        if (cmp(list, elem, n->elem) == 0)                                  \
+            return 1;                                                       \
+    }                                                                       \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+/* Bottom-up merge sort of the next links; prev links are fixed after */    \
+static inline void name##_sort(name##_t *list)                              \
+{                                                                           \
+    name##_node_t *head = list->head, *prev, *n;                            \
+    int width;                                                              \
+                                                                            \
+    for (width = 1; width < list->size; width *= 2) {                       \
+        name##_node_t *rest = head, **tail = &head;                         \
+        while (rest != NULL) {                                              \
+            name##_node_t *a = rest, *b, *end;                              \
+            int i;                                                          \
+            for (i = 1, end = a; i < width && end->next != NULL; i++)       \
+                end = end->next;                                            \
+            b = end->next;                                                  \
+            end->next = NULL;                                               \
+            for (i = 1, end = b; i < width && end != NULL &&                \
+                 end->next != NULL; i++)                                    \
+                end = end->next;                                            \
+            rest = end != NULL ? end->next : NULL;                          \
+            if (end != NULL)                                                \
+                end->next = NULL;                                           \
+            while (a != NULL && b != NULL) {                                \
+                if (cmp(list, b->elem, a->elem) < 0) {                      \
+                    *tail = b;                                              \
+                    b = b->next;                                            \
+                }                                                           \
+                else {                                                      \
+                    *tail = a;                                              \
+                    a = a->next;                                            \
+                }                                                           \
+                tail = &(*tail)->next;                                      \
+            }                                                               \
+            *tail = a != NULL ? a : b;                                      \
+            while (*tail != NULL)                                           \
+                tail = &(*tail)->next;                                      \
+        }                                                                   \
+    }                                                                       \
+    list->head = head;                                                      \
+    prev = NULL;                                                            \
+    for (n = head; n != NULL; n = n->next) {                                \
+        n->prev = prev;                                                     \
+        prev = n;                                                           \
+    }                                                                       \
+    list->tail = prev;                                                      \
+}                                                                           \
+                                                                            \
+static inline name##_node_t *name##_first(name##_t *list)                   \
+{                                                                           \
+    return list->head;                                                      \
+}                                                                           \
+                                                                            \
+static inline name##_node_t *name##_next(name##_node_t *n)                  \
+{                                                                           \
+    return n->next;                                                         \
+}
+
+/*
+ * The standard instantiations.  wordset, ssoset and ssolist compare
+ * words case-insensitively, like compare_words(); ssoset and ssolist
+ * keep short words inside their nodes.  vset and vlist are the generic
+ * instantiations over void *, comparing with the function they were
+ * created with, like set_t and list_t.  Modules with key types of their
+ * own instantiate the macros themselves.
+ */
+SET_DEFINE(strset, char *, TYPED_CMP_STR)
+SET_DEFINE(wordset, char *, TYPED_CMP_WORD)
+SET_DEFINE(ssoset, sso_t, TYPED_CMP_SSOWORD)
+SET_DEFINE(u32set, uint32_t, TYPED_CMP_NUM)
+SET_DEFINE(intset, int, TYPED_CMP_NUM)
+SET_DEFINE(vset, void *, TYPED_CMP_FUNC)
+
+LIST_DEFINE(strlist, char *, TYPED_CMP_STR)
+LIST_DEFINE(ssolist, sso_t, TYPED_CMP_SSOWORD)
+LIST_DEFINE(u32list, uint32_t, TYPED_CMP_NUM)
+LIST_DEFINE(intlist, int, TYPED_CMP_NUM)
+LIST_DEFINE(vlist, void *, TYPED_CMP_FUNC)
+
+#endif
@@ -0,0 +1,131 @@
+#include "utf8.h"
+#include "utf8tab.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+size_t utf8_ascii_prefix(const char *data, size_t len)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    /* The high bits of 16 bytes at a time */
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        int mask = _mm_movemask_epi8(v);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    while (i < len && (unsigned char)data[i] < 0x80)
+        i++;
+    return i;
+}
+
+static int char_class(uint32_t cp)
+{
+    const unsigned char *block;
+
+    if (cp >= UTF8TAB_LIMIT)
+        return UTF8_SEPARATOR;
+    block = utf8tab_blocks[utf8tab_stage1[cp / UTF8TAB_BLOCK]];
+    cp %= UTF8TAB_BLOCK;
+    return (block[cp / 4] >> (2 * (cp % 4))) & 3;
+}
+
+/*
+ * Finds the run of characters the given one belongs to by binary
+ * search, and folds it if it falls on the stride of the run.
+ */
+static uint32_t fold(uint32_t cp)
+{
+    int lo = 0, hi = sizeof(utf8tab_folds) / sizeof(utf8tab_folds[0]) - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        const struct utf8tab_fold *run = &utf8tab_folds[mid];
+
+        if (cp < run->first)
+            hi = mid - 1;
+        else if (cp > run->last)
+            lo = mid + 1;
+        else if ((cp - run->first) % run->stride == 0)
+            return cp + run->delta;
+        else
+            return cp;
+    }
+    return cp;
+}
+
+static int encode(uint32_t cp, char *buf)
+{
+    if (cp < 0x80) {
+        buf[0] = cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        buf[0] = 0xC0 | (cp >> 6);
+        buf[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    }
+    if (cp < 0x10000) {
+        buf[0] = 0xE0 | (cp >> 12);
+        buf[1] = 0x80 | ((cp >> 6) & 0x3F);
+        buf[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    buf[0] = 0xF0 | (cp >> 18);
+    buf[1] = 0x80 | ((cp >> 12) & 0x3F);
+    buf[2] = 0x80 | ((cp >> 6) & 0x3F);
+    buf[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+int utf8_wordchar(uint32_t cp, char buf[4], int *len)
+{
+    int class = char_class(cp);
+
+    if (class != UTF8_SEPARATOR)
+        *len = encode(fold(cp), buf);
+    return class;
+}
+
+int32_t utf8_decode(utf8_decoder_t *d, unsigned char c)
+{
+    if (d->need == 0) {
+        if (c < 0x80)
+            return c;
+        if (c >= 0xC2 && c <= 0xDF) {
+            d->cp = c & 0x1F;
+            d->need = 1;
+            d->min = 0x80;
+        }
+        else if (c >= 0xE0 && c <= 0xEF) {
+            d->cp = c & 0x0F;
+            d->need = 2;
+            d->min = 0x800;
+        }
+        else if (c >= 0xF0 && c <= 0xF4) {
+            d->cp = c & 0x07;
+            d->need = 3;
+            d->min = 0x10000;
+        }
+        else {
+            return UTF8_BAD;
+        }
+        return UTF8_MORE;
+    }
+    if ((c & 0xC0) != 0x80) {
+        d->need = 0;
+        return UTF8_AGAIN;
+    }
+    d->cp = (d->cp << 6) | (c & 0x3F);
+    if (--d->need > 0)
+        return UTF8_MORE;
+    /* Overlong encodings, surrogates and characters beyond Unicode */
+    if (d->cp < d->min || d->cp > 0x10FFFF ||
+        (d->cp >= 0xD800 && d->cp <= 0xDFFF))
+        return UTF8_BAD;
+    return d->cp;
+}
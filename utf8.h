@@ -0,0 +1,76 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * UTF-8 decoding and the character classes of the tokenizers.  Words
+ * are made of letters, combining marks and decimal digits in any
+ * script, and of ' and _.  CJK ideographs and kana, which are written
+ * without spaces, are each a word on their own.  Bytes that are not
+ * valid UTF-8 separate words.
+ *
+ * Words are case-folded with the simple case folding of Unicode, so
+ * that words that differ only in case come out the same.
+ */
+
+/* Character classes */
+#define UTF8_SEPARATOR  0
+#define UTF8_WORD       1
+#define UTF8_SOLO       2   /* A word on its own */
+
+/*
+ * The folded character of each ASCII word character, and 0 for each
+ * ASCII separator, for scanning ASCII without decoding it.
+ */
+extern const unsigned char utf8_ascii[128];
+
+/*
+ * Returns the length of the longest prefix of data that is plain
+ * ASCII.  Uses SSE2 where available.
+ */
+size_t utf8_ascii_prefix(const char *data, size_t len);
+
+/*
+ * Returns the class of the given code point and, unless it is a
+ * separator, writes the UTF-8 encoding of its case folding to buf and
+ * its length to *len.
+ */
+int utf8_wordchar(uint32_t cp, char buf[4], int *len);
+
+/*
+ * A UTF-8 decoder, fed one byte at a time, so that characters may span
+ * the chunks a message is read in.
+ */
+typedef struct utf8_decoder {
+    uint32_t cp;        /* The bits of the character decoded so far */
+    uint32_t min;       /* The smallest character of this length */
+    int need;           /* Continuation bytes still to come */
+} utf8_decoder_t;
+
+/* Results of utf8_decode() other than a character */
+#define UTF8_MORE   -1  /* The byte starts or continues a character */
+#define UTF8_BAD    -2  /* The bytes of the character are not valid */
+#define UTF8_AGAIN  -3  /* As UTF8_BAD, and the byte must be fed again */
+
+static inline void utf8_init(utf8_decoder_t *d)
+{
+    d->need = 0;
+}
+
+/* Returns 1 if the decoder is in the middle of a character */
+static inline int utf8_pending(utf8_decoder_t *d)
+{
+    return d->need > 0;
+}
+
+/*
+ * Feeds the next byte to the decoder.  Returns the character the byte
+ * completes, or one of the results above.  UTF8_AGAIN means the byte
+ * cut a character short; the decoder has dropped that character and
+ * is ready for the byte to start the next one.
+ */
+int32_t utf8_decode(utf8_decoder_t *d, unsigned char c);
+
+#endif
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include "watch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#define EVENTSIZE 65536
+
+/* What each directory is watched for */
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE)
+
+struct watcher {
+    int fd;
+    char **paths;       /* The directory of each watch descriptor */
+    int maxwd;
+    int numdirs;
+    scorefunc_t score;
+    void *model;
+};
+
+static volatile sig_atomic_t stop_requested;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+static char *join(const char *dir, const char *name)
+{
+    size_t dirlen = strlen(dir), namelen = strlen(name);
+    char *path = malloc(dirlen + namelen + 2);
+
+    if (path == NULL)
+        fatal_error("out of memory");
+    memcpy(path, dir, dirlen);
+    path[dirlen] = '/';
+    memcpy(path + dirlen + 1, name, namelen + 1);
+    return path;
+}
+
+/*
+ * Returns 1 if mail in the given directory is not to be classified: in
+ * "tmp" it is still being delivered, and in "cur" it has been seen, and
+ * is only moved there or renamed as its flags change.
+ */
+static int is_skipped(const char *dir)
+{
+    const char *base = strrchr(dir, '/');
+
+    base = base != NULL ? base + 1 : dir;
+    return strcmp(base, "tmp") == 0 || strcmp(base, "cur") == 0;
+}
+
+/*
+ * Returns 1 if some process has the given file open for writing, which
+ * makes the kernel refuse a read lease on it.  If leases cannot be
+ * taken at all, the file is taken to be complete.
+ */
+static int being_written(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_NONBLOCK), busy = 0;
+
+    if (fd < 0)
+        return 0;
+    if (fcntl(fd, F_SETLEASE, F_RDLCK) < 0)
+        busy = errno == EAGAIN;
+    else
+        fcntl(fd, F_SETLEASE, F_UNLCK);
+    close(fd);
+    return busy;
+}
+
+static void classify(struct watcher *w, char *path)
+{
+    /* A mail may be moved on or deleted before we get to it */
+    if (classify_file(path, w->score, w->model) < 0 && errno != ENOENT)
+        perror(path);
+}
+
+/*
+ * Watches the given directory and those below it.  With scan, also
+ * classifies the files already in them, which may have been written
+ * before the watch was in place.  Files still being written are left
+ * to the IN_CLOSE_WRITE event the watch now gives when they are done,
+ * and directories already watched are not scanned again.
+ */
+static void add_tree(struct watcher *w, char *dir, int scan)
+{
+    struct dirent *de;
+    DIR *d;
+    int wd = inotify_add_watch(w->fd, dir, WATCH_MASK);
+
+    if (wd < 0) {
+        perror(dir);
+        return;
+    }
+    if (wd >= w->maxwd) {
+        int old = w->maxwd;
+        w->maxwd = 2 * wd + 16;
+        w->paths = realloc(w->paths, sizeof(char *) * w->maxwd);
+        if (w->paths == NULL)
+            fatal_error("out of memory");
+        memset(w->paths + old, 0, sizeof(char *) * (w->maxwd - old));
+    }
+    /* A directory moved within the tree keeps its watch, and its files
+     * have been seen; only its path changes, and those below it */
+    if (w->paths[wd] == NULL)
+        w->numdirs++;
+    else
+        scan = 0;
+    free(w->paths[wd]);
+    w->paths[wd] = strdup(dir);
+    if (w->paths[wd] == NULL)
+        fatal_error("out of memory");
+
+    d = opendir(dir);
+    if (d == NULL) {
+        perror(dir);
+        return;
+    }
+    while ((de = readdir(d)) != NULL) {
+        struct stat st;
+        char *path;
+
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        path = join(dir, de->d_name);
+        if (lstat(path, &st) == 0) {
+            if (S_ISDIR(st.st_mode))
+                add_tree(w, path, scan);
+            else if (scan && S_ISREG(st.st_mode) && !is_skipped(dir) &&
+                     !being_written(path))
+                classify(w, path);
+        }
+        free(path);
+    }
+    closedir(d);
+}
+
+static void handle_event(struct watcher *w, struct inotify_event *ev)
+{
+    char *dir, *path;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+        fprintf(stderr, "watch: event queue overflowed, mails were missed\n");
+        return;
+    }
+    if (ev->wd < 0 || ev->wd >= w->maxwd || w->paths[ev->wd] == NULL)
+        return;
+    dir = w->paths[ev->wd];
+    if (ev->mask & IN_IGNORED) {
+        /* The directory is gone */
+        free(dir);
+        w->paths[ev->wd] = NULL;
+        w->numdirs--;
+        return;
+    }
+    if (ev->len == 0)
+        return;
+    path = join(dir, ev->name);
+    if (ev->mask & IN_ISDIR) {
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+            add_tree(w, path, 1);
+    }
+    else if ((ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && !is_skipped(dir)) {
+        classify(w, path);
+    }
+    free(path);
+}
+
+void watch(char *root, scorefunc_t score, void *model)
+{
+    struct watcher w;
+    struct sigaction sa;
+    char *buf, *p, *dir;
+    size_t len;
+    ssize_t n;
+    int i;
+
+    memset(&w, 0, sizeof(w));
+    w.score = score;
+    w.model = model;
+    w.fd = inotify_init1(IN_CLOEXEC);
+    if (w.fd < 0) {
+        perror("inotify_init1");
+        fatal_error("cannot watch for mail");
+    }
+    buf = malloc(EVENTSIZE);
+    if (buf == NULL)
+        fatal_error("out of memory");
+
+    /* Stop cleanly on SIGINT and SIGTERM; read() is not restarted */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    dir = strdup(root);
+    if (dir == NULL)
+        fatal_error("out of memory");
+    len = strlen(dir);
+    while (len > 1 && dir[len - 1] == '/')
+        dir[--len] = 0;
+    add_tree(&w, dir, 0);
+    free(dir);
+    if (w.numdirs == 0)
+        fatal_error("nothing to watch");
+    fprintf(stderr, "watching %d director%s under %s\n", w.numdirs,
+            w.numdirs == 1 ? "y" : "ies", root);
+
+    while (!stop_requested) {
+        n = read(w.fd, buf, EVENTSIZE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            break;
+        }
+        /* The kernel pads each name to keep the next event aligned */
+        for (p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            handle_event(&w, ev);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+    for (i = 0; i < w.maxwd; i++)
+        free(w.paths[i]);
+    free(w.paths);
+    free(buf);
+    close(w.fd);
+}
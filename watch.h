@@ -0,0 +1,22 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "classify.h"
+
+/*
+ * Watches the directory tree under the given root with inotify, and
+ * classifies each file with the given scoring function and model as
+ * soon as it is closed after writing or moved into the tree, printing
+ * its verdict line to standard output, until the process receives
+ * SIGINT or SIGTERM.  Mail already in the tree is left alone.
+ *
+ * Subdirectories created later are watched as well, and the files
+ * already in them when they are found are classified, unless they are
+ * still open for writing.  Files under a directory named "tmp" or "cur"
+ * are skipped: maildir delivery writes mails to "tmp" before moving
+ * them into "new", and mail readers move mails from "new" to "cur" and
+ * rename them there as their flags change, which is no new mail.
+ */
+void watch(char *root, scorefunc_t score, void *model);
+
+#endif